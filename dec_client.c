@@ -1,14 +1,14 @@
-#include <netdb.h>          // DNS functions
 #include <stdlib.h>         // Memory management
 #include <stdio.h>          // Input/ output
-#include <stdbool.h>        // Boolean values
 #include <string.h>         // String functions
-#include <netinet/in.h>     // Internet/ socket functions
-#include <sys/socket.h>     // Socket functions
-#include <arpa/inet.h>      // Internet functions
-#include <sys/types.h>      // Size functions
+#include <fcntl.h>          // File control functions
+#include <stdbool.h>        // Boolean values
 #include <unistd.h>         // Process management/ file operations
-#include <ctype.h>          // Character functions
+#include <sys/mman.h>       // Memory mapping functions
+#include "otp_client.h"     // Client library (libotpclient)
+#include "otp_async.h"      // Pipelined requests over several connections
+#include "otp_container.h"  // Ciphertext container files
+#include "otp_codec.h"      // Text compression
 
 /*
 Program Name: Decryption Client
@@ -18,272 +18,482 @@ Description: Program is part of encryption/ decryption prgram for converting
     This specific program is the client program that makes requests from the 
     decryption server to decrypt ciphertext messages. Program requires 3 arguments:
     message, key sequence, and port number to perform all functions. Client
-    outputs response (expected plaintext) from server to stdout. Program terminates
+    outputs response (expected plaintext) from server to stdout, or to the output file
+    given as optional 4th argument, writing it as it arrives. Program terminates
     if ciphertext or key sequence have any invalid characters, key sequence is shorter
     than ciphertext, or there is an issue with the socket connection. Program sends 
     requests to decryption server via socket request in 5 parts: client ID code, 
     key sequence size, key sequence, ciphertext size, and ciphertext message. Expected
-    response from server is plaintext of message.
+    response from server is plaintext of message. A socket path (containing '/') in 
+    place of the port sends the request over the server UNIX-domain socket, passing
+    the open files instead of their contents. With -c the ciphertext comes from a
+    container file instead: -r decrypts one record, otherwise every record is
+    decrypted in order, one plaintext line each. Records are read through a memory
+    mapping, so only the chosen records' bytes are read and sent. -j spreads records
+    over several pipelined connections (TCP port only). -R sends a ciphertext file
+    as a resumable session that survives dropped connections. -K decrypts with the key
+    characters from key_offset on, as printed by enc_client -P. -z restores plaintext
+    compressed by enc_client -z after decrypting it. With -t the time each stage of
+    the request took (reading the files, connect, handshake, key and text upload,
+    waiting for and receiving the reply) is appended as one JSON line, with byte
+    counts and throughput, to report_file ("-" for stderr). Protocol logic lives in
+    libotpclient (otp_client.c); this program only handles arguments and exit codes.
 */
 
+#define DEC_USAGE "USAGE: %s [-R retries | -z] [-K key_offset] [-t report_file] ciphertext key port|socket_path [output_file]\n" \
+                  "       %s -c container [-r record] [-j connections] key port|socket_path [output_file]\n"
+#define PARALLEL_WINDOW 8           // Records in flight per connection with -j
+
+struct record_result {
+    char *text;                     // Plaintext copied from the completion callback
+    size_t len;
+    int status;
+    bool done;
+};
+
 // Helper function declarations
-void setup_socket(struct sockaddr_in* address, int port_num);
-char* parse_valid_file(char *filepath);
+int decrypt_records(struct otp_conn *conn, const char *container_path, long long record,
+                    int conn_count, const char *target, const char *key, size_t key_len, int out_fd);
+int decrypt_parallel(struct otp_container *container, const char *key_map, size_t key_len,
+                     const char *target, int conn_count, int out_fd);
+void on_record(void *user_data, int status, const char *result, size_t result_len);
+int request_resumable(enum otp_service service, const char *target, const char *key, const char *text,
+                      size_t text_len, int out_fd, int retries);
+int request_key_range(struct otp_conn *conn, const char *key, const char *text, size_t text_len,
+                      int out_fd, bool compressed);
+int write_decoded(const char *coded, size_t coded_len, int out_fd);
+void report_error(int status, const char *key_path);
+void write_timing_report(const char *report_path, const struct otp_timing *timing, int status);
 
 int main(int argc, char *argv[]) {
-    char *key_buffer = NULL;
-    char *text_buffer = NULL;
-    int socket_fd;
-    int bytes_written;
-    int total_written;
-    int bytes_read;
-    int total_read;
-    struct sockaddr_in server_address;
-    char permitted_code[] = "1234";
-    char access_response[10];
+    const char *container_path = NULL;
+    long long record = -1;
+    int conn_count = 1;
+    int retries = -1;
+    long long key_offset = -1;
+    bool compressed = false;
+    const char *report_path = NULL;
+    struct otp_timing timing;
+    int option;
 
     // Verfiy inputs
-    if (argc < 4) {
-        fprintf(stderr,"USAGE: %s ciphertext key port\n", argv[0]);
-        exit(1);
+    while ((option = getopt(argc, argv, "c:r:j:R:K:zt:")) != -1) {
+        switch (option) {
+            case 'c':
+                container_path = optarg;
+                break;
+            case 'r':
+                record = atoll(optarg);
+                break;
+            case 'j':
+                conn_count = atoi(optarg);
+                break;
+            case 'R':
+                retries = atoi(optarg);
+                break;
+            case 'K':
+                key_offset = atoll(optarg);
+                break;
+            case 't':
+                report_path = optarg;
+                break;
+            case 'z':
+                compressed = true;
+                break;
+            default:
+                fprintf(stderr, DEC_USAGE, argv[0], argv[0]);
+                exit(1);
+        }
     }
-    // Parse and check key file
-    key_buffer = parse_valid_file(argv[2]);
-    if (!key_buffer) {
+    // Positional arguments follow the options; a container replaces the ciphertext file
+    int arg_count = argc - optind;
+    int first_arg = container_path ? optind - 1 : optind;
+    if (arg_count < (container_path ? 2 : 3) || conn_count < 1 ||
+            (!container_path && (record >= 0 || conn_count > 1)) || (container_path && (retries >= 0 || key_offset >= 0 || compressed)) ||
+            (compressed && retries >= 0) || (report_path && (container_path || retries >= 0))) {
+        fprintf(stderr, DEC_USAGE, argv[0], argv[0]);
         exit(1);
     }
-    size_t key_len = strlen(key_buffer);
-    
-    // Parse and check ciphertext file
-    text_buffer = parse_valid_file(argv[1]);
-    if (!text_buffer) {
-        free(key_buffer);
+    const char *text_path = container_path ? container_path : argv[first_arg];
+    const char *key_path = argv[first_arg + 1];
+    const char *target = argv[first_arg + 2];
+    const char *out_path = (first_arg + 3 < argc) ? argv[first_arg + 3] : NULL;
+    // Open key and ciphertext files
+    int key_fd = open(key_path, O_RDONLY);
+    if (key_fd < 0) {
+        perror("Error: failed to open file");
         exit(1);
     }
-    size_t text_len = strlen(text_buffer);
-    
-    // Key file cannot be shorter than ciphertext file
-    if (key_len < text_len) {
-        fprintf(stderr,"Error: key \'%s\' is too short\n", argv[2]);
-        free(key_buffer);
-        free(text_buffer);
-        exit(1);
+    int text_fd = -1;
+    if (!container_path) {
+        text_fd = open(text_path, O_RDONLY);
+        if (text_fd < 0) {
+            perror("Error: failed to open file");
+            close(key_fd);
+            exit(1);
+        }
     }
-    // Establish socket connection via port argument 
-    int port_arg = atoi(argv[3]);
-    if (port_arg <= 0) {
-        fprintf(stderr, "Error: invalid port number '%s'\n", argv[3]);
-        exit(1);
+    // Result goes to stdout unless an output file is given
+    int out_fd = STDOUT_FILENO;
+    if (out_path) {
+        out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            perror("Error: failed to open output file");
+            close(key_fd);
+            if (text_fd >= 0) {
+                close(text_fd);
+            }
+            exit(1);
+        }
     }
-    // Create IPv4 TCP socket for sending to server
-    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        perror("Error: could not create/ open socket");
-        free(key_buffer);
-        free(text_buffer);
-        exit(2);
+    // Read and check key and ciphertext before contacting the server (records are read later)
+    if (report_path) {
+        otp_timing_begin(&timing, OTP_DECRYPT, target);
     }
-    // Set up server socket
-    setup_socket(&server_address, port_arg);
-
-    // Connect client to server
-    if (connect(socket_fd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
-        perror("Error: failed to connect to server");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
-    } 
-    // Identify self to server
-    bytes_written = send(socket_fd, permitted_code, strlen(permitted_code), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send client ID");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    char *key_map = NULL;
+    char *text_map = NULL;
+    size_t key_map_size;
+    size_t text_map_size;
+    size_t key_len;
+    size_t text_len;
+    size_t offset = (key_offset < 0) ? 0 : (size_t)key_offset;
+    int status = otp_map_file(key_fd, &key_map, &key_map_size, &key_len);
+    if (status != OTP_OK) {
+        key_map = NULL;
+    } else if (!container_path) {
+        status = otp_map_file(text_fd, &text_map, &text_map_size, &text_len);
+        if (status != OTP_OK) {
+            text_map = NULL;
+        } else if (offset > key_len || text_len > key_len - offset) {
+            status = OTP_ERR_KEY_SHORT;
+        }
     }
-    bytes_written = 0;
-    // Determine if correct server contacted
-    memset(access_response, '\0', sizeof(access_response));
-    bytes_read = recv(socket_fd, access_response, sizeof(access_response) - 1, 0);
-    if (bytes_read < 0) {
-        perror("Error: failed to get server acceptance response");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    otp_timing_mark(report_path ? &timing : NULL, OTP_STAGE_PARSED);
+    if (status != OTP_OK) {
+        report_error(status, key_path);
+    } else {
+        // Establish connection via port or socket path argument
+        struct otp_conn conn;
+        status = (retries >= 0) ? request_resumable(OTP_DECRYPT, target, key_map + offset, text_map, text_len,
+                                                    out_fd, retries)
+                                : report_path ? otp_connect_timed(&conn, OTP_DECRYPT, target, &timing)
+                                              : otp_connect(&conn, OTP_DECRYPT, target);
+        if (status == OTP_ERR_REJECTED) {
+            fprintf(stderr, "Error: could not contact dec_server on %s\n", target);
+        } else if (status != OTP_OK) {
+            fprintf(stderr, "Error: %s (%s)\n", otp_strerror(status), target);
+        }
+        if (status == OTP_OK && retries < 0) {
+            if (container_path) {
+                status = decrypt_records(&conn, container_path, record, conn_count, target, key_map, key_len, out_fd);
+            } else if (key_offset >= 0 || compressed) {
+                status = request_key_range(&conn, key_map + offset, text_map, text_len, out_fd, compressed);
+            } else if (conn.is_unix) {
+                // The server reads the files itself, no contents go through the socket
+                status = otp_request_fds(&conn, text_fd, key_fd, out_fd);
+            } else {
+                status = otp_request_checked(&conn, key_map, key_len, text_map, text_len, NULL, out_fd);
+            }
+            report_error(status, key_path);
+            otp_close(&conn);
+        }
     }
-    access_response[bytes_read] = '\0';
-    // End connection if wrong server
-    if (strcmp(access_response, "dec") != 0) {
-        fprintf(stderr, "Error: could not contact enc_server on port %d\n", port_arg);
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    if (report_path) {
+        write_timing_report(report_path, &timing, status);
     }
-    // Notify server on how much key sequence data is coming
-    int nbo_key_len = htonl(key_len);
-    bytes_written = send(socket_fd, &nbo_key_len, sizeof(nbo_key_len), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send message length");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    if (key_map) {
+        munmap(key_map, key_map_size);
     }
-    bytes_written = 0;
-    // Loop and send message to ensure complete key sequence message sent
-    total_written = 0;
-    while (total_written < key_len) {
-        bytes_written = send(socket_fd, key_buffer + total_written, key_len - total_written, 0);
-        if (bytes_written < 0) {
-            perror("Error: failed to write to server");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_written == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        }
-        total_written += bytes_written;
+    if (text_map) {
+        munmap(text_map, text_map_size);
     }
-    bytes_written = 0;
-    // Notify server on how much ciphertext data is coming
-    int nbo_text_len = htonl(text_len);
-    bytes_written = send(socket_fd, &nbo_text_len, sizeof(nbo_text_len), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send message length");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
-    } 
-    bytes_written = 0;
-    total_written = 0;
-    // Loop and send message to ensure complete ciphertext message sent
-    while (total_written < text_len) {
-        bytes_written = send(socket_fd, text_buffer + total_written, text_len - total_written, 0);
-        if (bytes_written < 0) {
-            perror("Error: failed to write to server");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_written == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
+    close(key_fd);
+    if (text_fd >= 0) {
+        close(text_fd);
+    }
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+    // Exit 1 for bad input files, 2 for socket/ server errors, 3 if server refused (retry later)
+    switch (status) {
+        case OTP_OK:
+            return 0;
+        case OTP_ERR_INPUT:
+        case OTP_ERR_KEY_SHORT:
+        case OTP_ERR_FILE:
+        case OTP_ERR_FORMAT:
+        case OTP_ERR_RANGE:
+        case OTP_ERR_CODEC:
+            exit(1);
+        case OTP_ERR_BUSY:
+        case OTP_ERR_TOO_BIG:
+            exit(3);
+        default:
             exit(2);
+    }
+}
+
+/*
+* Function: decrypt_records()
+*   Decrypts one record (record >= 0) or every record of a container, writing
+*   one plaintext line per record to out_fd in record order.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *container_path: container file
+*   :param long long record: record number, or -1 for all records
+*   :param int conn_count: connections to spread records over (TCP port only)
+*   :param const char *target: port or socket path, for the extra connections
+*   :param const char *key: key file characters (checked)
+*   :param size_t key_len: number of key characters
+*   :param int out_fd: descriptor receiving the plaintext
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int decrypt_records(struct otp_conn *conn, const char *container_path, long long record,
+                    int conn_count, const char *target, const char *key, size_t key_len, int out_fd) {
+    struct otp_container container;
+
+    int status = container_open(&container, container_path, false);
+    if (status == OTP_OK) {
+        status = container_map(&container);
+        if (status == OTP_OK && record >= (long long)container.record_count) {
+            status = OTP_ERR_RANGE;
+        }
+        if (status == OTP_OK && record < 0 && conn_count > 1 && !conn->is_unix) {
+            status = decrypt_parallel(&container, key, key_len, target, conn_count, out_fd);
+        } else {
+            // Only the chosen records' pages are read from the mapping
+            uint64_t first = (record < 0) ? 0 : (uint64_t)record;
+            uint64_t last = (record < 0) ? container.record_count : first + 1;
+            for (uint64_t i = first; i < last && status == OTP_OK; i++) {
+                const struct container_record *entry = &container.records[i];
+                // Only the key characters of this record are sent
+                if (entry->key_offset > key_len || entry->length > key_len - entry->key_offset) {
+                    status = OTP_ERR_KEY_SHORT;
+                    break;
+                }
+                status = otp_request_stream(conn, key + entry->key_offset, entry->length,
+                                            container_record_text(&container, i), entry->length, out_fd);
+            }
         }
-        total_written += bytes_written;
+        container_close(&container);
     }
-    bytes_written = 0;
-    total_written = 0;
-    // Clear out the buffer for response from socket
-    memset(text_buffer, '\0', text_len + 1);
-    // Read response from socket
-    bytes_read = 0;
-    total_read = 0;
-    while (total_read < text_len) {
-        bytes_read = recv(socket_fd, text_buffer + total_read, text_len - total_read, 0);
-        if (bytes_read < 0){
-            perror("Error: failed to read response from socket");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_read == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
+    return status;
+}
+
+/*
+* Function: decrypt_parallel()
+*   Decrypts every record over conn_count pipelined connections, keeping up to
+*   PARALLEL_WINDOW records in flight per connection. Results are written in
+*   record order as soon as every earlier record is written.
+*   :param struct otp_container *container: mapped container
+*   :param const char *key_map: key characters
+*   :param size_t key_len: number of key characters
+*   :param const char *target: server port
+*   :param int conn_count: number of connections
+*   :param int out_fd: descriptor receiving the plaintext
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int decrypt_parallel(struct otp_container *container, const char *key_map, size_t key_len,
+                     const char *target, int conn_count, int out_fd) {
+    int status;
+    uint64_t count = container->record_count;
+    uint64_t window = (uint64_t)conn_count * PARALLEL_WINDOW;
+
+    struct record_result *results = calloc(count + 1, sizeof(struct record_result));
+    if (!results) {
+        return OTP_ERR_NOMEM;
+    }
+    struct otp_async *loop = otp_async_create(OTP_DECRYPT, target, conn_count, &status);
+    if (!loop) {
+        free(results);
+        return status;
+    }
+    uint64_t submitted = 0;
+    uint64_t written = 0;
+    while (written < count && status == OTP_OK) {
+        // Keep the window full, then wait for completions
+        while (submitted < count && submitted - written < window && status == OTP_OK) {
+            const struct container_record *entry = &container->records[submitted];
+            if (entry->key_offset > key_len || entry->length > key_len - entry->key_offset) {
+                status = OTP_ERR_KEY_SHORT;
+                break;
+            }
+            status = otp_async_submit(loop, key_map + entry->key_offset, entry->length,
+                                      container_record_text(container, submitted), entry->length,
+                                      on_record, &results[submitted]);
+            submitted++;
+        }
+        if (status == OTP_OK && otp_async_run(loop, -1) < 0) {
+            status = OTP_ERR_IO;
+        }
+        // Write finished records in order
+        while (written < submitted && results[written].done && status == OTP_OK) {
+            struct record_result *result = &results[written];
+            status = result->status;
+            if (status == OTP_OK && (write(out_fd, result->text, result->len) != (ssize_t)result->len ||
+                                     write(out_fd, "\n", 1) != 1)) {
+                status = OTP_ERR_IO;
+            }
+            free(result->text);
+            result->text = NULL;
+            written++;
         }
-        total_read += bytes_read;
     }
-    text_buffer[text_len] = '\0';
-    printf("%s\n", text_buffer);
-    free(key_buffer);
-    free(text_buffer);
-    close(socket_fd);
-    return 0;
+    otp_async_destroy(loop);
+    for (uint64_t i = written; i < count; i++) {
+        free(results[i].text);
+    }
+    free(results);
+    return status;
 }
 
 /*
-* Function: setup_socket()
-*   Sets up a socket address with port_num value.
-*   :param struct sockaddr_in* address: structure for socket address
-*   :param int port_num: port number for socket address
+* Function: on_record()
+*   Completion callback of one record: keeps a copy of the plaintext until
+*   it can be written in order.
+*   :param void *user_data: the record's struct record_result
+*   :param int status: OTP_OK or OTP_ERR_* status
+*   :param const char *result: plaintext characters
+*   :param size_t result_len: number of plaintext characters
 */
-void setup_socket(struct sockaddr_in* address, int port_num) {
-    // Clear out the address struct
-    memset((char*) address, '\0', sizeof(*address));
+void on_record(void *user_data, int status, const char *result, size_t result_len) {
+    struct record_result *record = user_data;
 
-    // The address should be network capable
-    address->sin_family = AF_INET;
-    // Convert and store the port number in network byte order
-    address->sin_port = htons(port_num);
-    // Allow a client at any address to connect to this server
-    address->sin_addr.s_addr = inet_addr("127.0.0.1");
+    record->status = status;
+    record->done = true;
+    if (status == OTP_OK) {
+        record->text = malloc(result_len + 1);
+        if (!record->text) {
+            record->status = OTP_ERR_NOMEM;
+            return;
+        }
+        memcpy(record->text, result, result_len);
+        record->len = result_len;
+    }
 }
 
 /*
-* Function: parse_valid_file()
-*   Allocates memory for file text.
-*   Verfiies file contains only valid characters. 
-*   Valid characters includes uppercase letters and space character.
-*   Function expects files terminate with a newline character. 
-*   :param char *filepath: filepath for reading
-*   :return char*: pointer to text string in memory or NULL if error
+* Function: request_resumable()
+*   Sends text and key as a resumable session, which survives dropped
+*   connections by resuming where the transfer stopped.
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port or socket path
+*   :param const char *key: key characters from the key offset on (at least text_len)
+*   :param const char *text: text characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result
+*   :param int retries: reconnections allowed without progress
+*   :return int: OTP_OK or OTP_ERR_* status
 */
-char* parse_valid_file(char *filepath) {
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
-        perror("Error: failed to open file");
-        return NULL;
+int request_resumable(enum otp_service service, const char *target, const char *key, const char *text,
+                      size_t text_len, int out_fd, int retries) {
+    // Only the key characters the text uses are sent
+    return otp_request_resumable(service, target, key, text_len, text, text_len, out_fd, retries);
+}
+
+/*
+* Function: request_key_range()
+*   Decrypts the ciphertext file with the key characters starting at key_offset,
+*   streaming the result to out_fd. Only the key characters the ciphertext uses
+*   are sent. Compressed plaintext is received whole, then decompressed.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key characters from the key offset on (checked, at least text_len)
+*   :param const char *text: ciphertext characters (checked)
+*   :param size_t text_len: number of ciphertext characters
+*   :param int out_fd: descriptor receiving the result
+*   :param bool compressed: plaintext was compressed by enc_client -z
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int request_key_range(struct otp_conn *conn, const char *key, const char *text, size_t text_len,
+                      int out_fd, bool compressed) {
+    if (!compressed) {
+        return otp_request_checked(conn, key, text_len, text, text_len, NULL, out_fd);
     }
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    if (file_size < 0) {
-        perror("Error: failed to read file");
-        fclose(file);
-        return NULL;
+    char *coded = malloc(text_len + 1);
+    if (!coded) {
+        return OTP_ERR_NOMEM;
     }
-    rewind(file);
-    // Allocate memory for file text
-    char* buffer = malloc(file_size + 1);
-    if (!buffer) {
-        perror("Error: failed to allocate memory for file text");
-        fclose(file);
-        return NULL;
+    int status = otp_request_checked(conn, key, text_len, text, text_len, coded, -1);
+    if (status == OTP_OK) {
+        status = write_decoded(coded, text_len, out_fd);
     }
-    // Store file contents
-    size_t file_bytes_read = fread(buffer, 1, file_size, file);
-    if (file_bytes_read < 1) {
-        perror("Error: failed to parse file\n");
-        free(buffer);
-        fclose(file);
-        return NULL;
+    free(coded);
+    return status;
+}
+
+/*
+* Function: write_decoded()
+*   Decompresses decrypted text and writes it, with a newline, to out_fd.
+*   :param const char *coded: compressed plaintext characters
+*   :param size_t coded_len: number of compressed characters
+*   :param int out_fd: descriptor receiving the plaintext
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int write_decoded(const char *coded, size_t coded_len, int out_fd) {
+    char *text;
+    size_t text_len;
+
+    int status = codec_decode(coded, coded_len, &text, &text_len);
+    if (status != OTP_OK) {
+        return status;
     }
-    buffer[file_bytes_read] = '\0'; 
-    fclose(file);
-    // Remove the trailing \n 
-    buffer[strcspn(buffer, "\n")] = '\0';
-    // Validate characters (only uppercase letters and spaces)
-    for (size_t i = 0; buffer[i] != '\0'; i++) {
-        if (!(isupper(buffer[i]) || isspace(buffer[i]))) {
-            perror("dec_client error: input contains bad characters");
-            free(buffer);
-            return NULL;
+    for (size_t written = 0; written < text_len && status == OTP_OK; ) {
+        ssize_t bytes = write(out_fd, text + written, text_len - written);
+        if (bytes <= 0) {
+            status = OTP_ERR_FILE;
+        } else {
+            written += bytes;
         }
     }
-    return buffer;
-}
\ No newline at end of file
+    if (status == OTP_OK && write(out_fd, "\n", 1) != 1) {
+        status = OTP_ERR_FILE;
+    }
+    free(text);
+    return status;
+}
+
+/*
+* Function: report_error()
+*   Prints the message for a failed request, or nothing for OTP_OK.
+*   :param int status: OTP_OK or OTP_ERR_* status
+*   :param const char *key_path: key file named in the key too short message
+*/
+void report_error(int status, const char *key_path) {
+    if (status == OTP_ERR_KEY_SHORT) {
+        fprintf(stderr,"Error: key \'%s\' is too short\n", key_path);
+    } else if (status == OTP_ERR_INPUT) {
+        fprintf(stderr, "dec_client error: input contains bad characters\n");
+    } else if (status != OTP_OK) {
+        fprintf(stderr, "Error: %s\n", otp_strerror(status));
+    }
+}
+
+/*
+* Function: write_timing_report()
+*   Appends the stage timings of the request as one JSON line to the report file,
+*   or to stderr for "-". The line goes out in one write, so jobs sharing a
+*   report file do not interleave.
+*   :param const char *report_path: report file, or "-" for stderr
+*   :param const struct otp_timing *timing: stages from otp_connect_timed()
+*   :param int status: OTP_OK or OTP_ERR_* status of the request
+*/
+void write_timing_report(const char *report_path, const struct otp_timing *timing, int status) {
+    char report[1024];
+
+    int len = otp_timing_json(timing, status, report, sizeof(report) - 1);
+    if (len < 0 || len >= (int)sizeof(report) - 1) {
+        return;
+    }
+    report[len++] = '\n';
+    int report_fd = (strcmp(report_path, "-") == 0) ? STDERR_FILENO
+                                                     : open(report_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (report_fd < 0) {
+        perror("Error: failed to open timing report");
+        return;
+    }
+    if (write(report_fd, report, len) != len) {
+        perror("Error: failed to write timing report");
+    }
+    if (report_fd != STDERR_FILENO) {
+        close(report_fd);
+    }
+}
@@ -1,14 +1,15 @@
-#include <netdb.h>          // DNS functions
 #include <stdlib.h>         // Memory management
 #include <stdio.h>          // Input/ output
 #include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
 #include <string.h>         // String functions
-#include <netinet/in.h>     // Internet/ socket functions
-#include <sys/socket.h>     // Socket functions
-#include <arpa/inet.h>      // Internet functions
-#include <sys/types.h>      // Size functions
+#include <fcntl.h>          // File control functions
 #include <unistd.h>         // Process management/ file operations
-#include <ctype.h>          // Character functions
+#include <sys/mman.h>       // Memory mapping functions
+#include "otp_client.h"     // Client library (libotpclient)
+#include "otp_container.h"  // Ciphertext container files
+#include "otp_ledger.h"     // Pad ledger of shared key files
+#include "otp_codec.h"      // Text compression
 
 /*
 Program Name: Encryption Client
@@ -18,272 +19,395 @@ Description: Program is part of encryption/ decryption prgram for converting
     This specific program is the client program that makes requests from the 
     encryption server to encrypt plaintext messages. Program requires 3 arguments:
     message, key sequence, and port number to perform all functions. Client
-    outputs response (expected ciphertext) from server to stdout. Program terminates
+    outputs response (expected ciphertext) from server to stdout, or to the output file
+    given as optional 4th argument, writing it as it arrives. Program terminates
     if plaintext or key sequence have any invalid characters, key sequence is shorter
     than plaintext, or there is an issue with the socket connection. Program sends 
     requests to encryption server via socket request in 5 parts: client ID code, 
     key sequence size, key sequence, plaintext size, and plaintext message. Expected
-    response from server is ciphertext of message.
+    response from server is ciphertext of message. A socket path (containing '/') in 
+    place of the port sends the request over the server UNIX-domain socket, passing
+    the open files instead of their contents. With -c the ciphertext is appended as
+    a new record to a container file instead (its record number is printed), using
+    key characters from -K key_offset, by default the first ones no earlier record
+    of the container used. With -R the request is sent as a resumable session: a
+    dropped connection is reopened (up to retries times without progress) and the
+    transfer continues where it stopped. -K key_offset also picks the first key
+    character of a plain or resumable request. With -P the key characters are claimed
+    from the pad ledger of the key file instead, so clients sharing one large key file
+    never use the same characters; the claimed offset is printed to stderr (the
+    container index keeps it for -c). With -z the plaintext is compressed before it is
+    encrypted, using fewer key characters and bytes on the wire for English-like text;
+    decrypt with dec_client -z. With -t the time each stage of the request took
+    (reading the files, connect, handshake, key and text upload, waiting for and
+    receiving the reply) is appended as one JSON line, with byte counts and
+    throughput, to report_file ("-" for stderr). Protocol logic lives in
+    libotpclient (otp_client.c); this program only handles arguments and exit codes.
 */
 
+#define ENC_USAGE "USAGE: %s [-c container | -R retries | -z] [-K key_offset | -P] [-t report_file] plaintext key port|socket_path [output_file]\n"
+
 // Helper function declarations
-void setup_socket(struct sockaddr_in* address, int port_num);
-char* parse_valid_file(char *filepath);
+int append_record(struct otp_conn *conn, const char *key, size_t key_len, const char *text, size_t text_len,
+                  const char *container_path, long long key_offset, const char *ledger_key_path);
+int request_resumable(enum otp_service service, const char *target, const char *key, size_t key_len,
+                      const char *text, size_t text_len, int out_fd, int retries, long long key_offset,
+                      const char *ledger_key_path);
+int request_key_range(struct otp_conn *conn, const char *key, size_t key_len, const char *text, size_t text_len,
+                      int out_fd, long long key_offset, const char *ledger_key_path, bool compress);
+int pick_key_offset(long long key_offset, const char *ledger_key_path, size_t key_len,
+                    size_t text_len, uint64_t *offset);
+void report_error(int status, const char *key_path);
+void write_timing_report(const char *report_path, const struct otp_timing *timing, int status);
 
 int main(int argc, char *argv[]) {
-    char *key_buffer = NULL;
-    char *text_buffer = NULL;
-    int socket_fd;
-    int bytes_written;
-    int total_written;
-    int bytes_read;
-    int total_read;
-    struct sockaddr_in server_address;
-    char permitted_code[] = "4321";
-    char access_response[10];
+    const char *container_path = NULL;
+    long long key_offset = -1;
+    int retries = -1;
+    bool use_ledger = false;
+    bool compress = false;
+    const char *report_path = NULL;
+    struct otp_timing timing;
+    int option;
 
     // Verfiy inputs
-    if (argc < 4) {
-        fprintf(stderr,"USAGE: %s plaintext key port\n", argv[0]);
-        exit(1);
+    while ((option = getopt(argc, argv, "c:K:R:Pzt:")) != -1) {
+        switch (option) {
+            case 'c':
+                container_path = optarg;
+                break;
+            case 'K':
+                key_offset = atoll(optarg);
+                break;
+            case 'R':
+                retries = atoi(optarg);
+                break;
+            case 'P':
+                use_ledger = true;
+                break;
+            case 't':
+                report_path = optarg;
+                break;
+            case 'z':
+                compress = true;
+                break;
+            default:
+                fprintf(stderr, ENC_USAGE, argv[0]);
+                exit(1);
+        }
     }
-    // Parse and check key file
-    key_buffer = parse_valid_file(argv[2]);
-    if (!key_buffer) {
+    // Positional arguments follow the options
+    int arg_count = argc - optind;
+    if (arg_count < 3 || (key_offset >= 0 && use_ledger) || (container_path && arg_count > 3) ||
+            (container_path && retries >= 0) || (compress && (container_path || retries >= 0)) || (report_path && retries >= 0)) {
+        fprintf(stderr, ENC_USAGE, argv[0]);
         exit(1);
     }
-    size_t key_len = strlen(key_buffer);
-    
-    // Parse and check plaintext file
-    text_buffer = parse_valid_file(argv[1]);
-    if (!text_buffer) {
-        free(key_buffer);
+    const char *text_path = argv[optind];
+    const char *key_path = argv[optind + 1];
+    const char *target = argv[optind + 2];
+    const char *out_path = (arg_count > 3) ? argv[optind + 3] : NULL;
+    const char *ledger_key_path = use_ledger ? key_path : NULL;
+    // Open key and plaintext files
+    int key_fd = open(key_path, O_RDONLY);
+    if (key_fd < 0) {
+        perror("Error: failed to open file");
         exit(1);
     }
-    size_t text_len = strlen(text_buffer);
-    
-    // Key file cannot be shorter than plaintext file
-    if (key_len < text_len) {
-        fprintf(stderr,"Error: key \'%s\' is too short\n", argv[2]);
-        free(key_buffer);
-        free(text_buffer);
+    int text_fd = open(text_path, O_RDONLY);
+    if (text_fd < 0) {
+        perror("Error: failed to open file");
+        close(key_fd);
         exit(1);
     }
-    // Establish socket connection via port argument 
-    int port_arg = atoi(argv[3]);
-    if (port_arg <= 0) {
-        fprintf(stderr, "Error: invalid port number '%s'\n", argv[3]);
-        exit(1);
+    // Result goes to stdout unless an output file is given
+    int out_fd = STDOUT_FILENO;
+    if (out_path) {
+        out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            perror("Error: failed to open output file");
+            close(key_fd);
+            close(text_fd);
+            exit(1);
+        }
     }
-    // Create IPv4 TCP socket for sending to server
-    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        perror("Error: failed to create/ open socket");
-        free(key_buffer);
-        free(text_buffer);
-        exit(2);
+    // Read and check key and plaintext before contacting the server
+    if (report_path) {
+        otp_timing_begin(&timing, OTP_ENCRYPT, target);
     }
-    // Set up server socket
-    setup_socket(&server_address, port_arg);
-
-    // Connect client to server
-    if (connect(socket_fd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
-        perror("Error: failed to connect to server");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
-    } 
-    // Identify self to server
-    bytes_written = send(socket_fd, permitted_code, strlen(permitted_code), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send client ID");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    char *key_map = NULL;
+    char *text_map = NULL;
+    size_t key_map_size;
+    size_t text_map_size;
+    size_t key_len;
+    size_t text_len;
+    int status = otp_map_file(key_fd, &key_map, &key_map_size, &key_len);
+    if (status != OTP_OK) {
+        key_map = NULL;
+    } else if ((status = otp_map_file(text_fd, &text_map, &text_map_size, &text_len)) != OTP_OK) {
+        text_map = NULL;
+    } else if (!container_path && !use_ledger && !compress) {
+        // Other key ranges depend on the container, the ledger or the coded length
+        uint64_t offset;
+        status = pick_key_offset(key_offset, NULL, key_len, text_len, &offset);
     }
-    bytes_written = 0;
-    // Determine if correct server contacted
-    memset(access_response, '\0', sizeof(access_response));
-    bytes_read = recv(socket_fd, access_response, sizeof(access_response) - 1, 0);
-    if (bytes_read < 0) {
-        perror("Error: failed to get server acceptance response");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    otp_timing_mark(report_path ? &timing : NULL, OTP_STAGE_PARSED);
+    if (status != OTP_OK) {
+        report_error(status, key_path);
+    } else {
+        // Establish connection via port or socket path argument
+        struct otp_conn conn;
+        status = (retries >= 0) ? request_resumable(OTP_ENCRYPT, target, key_map, key_len, text_map, text_len,
+                                                    out_fd, retries, key_offset, ledger_key_path)
+                                : report_path ? otp_connect_timed(&conn, OTP_ENCRYPT, target, &timing)
+                                              : otp_connect(&conn, OTP_ENCRYPT, target);
+        if (status == OTP_ERR_REJECTED) {
+            fprintf(stderr, "Error: could not contact enc_server on %s\n", target);
+        } else if (status != OTP_OK) {
+            fprintf(stderr, "Error: %s (%s)\n", otp_strerror(status), target);
+        }
+        if (status == OTP_OK && retries < 0) {
+            if (container_path) {
+                status = append_record(&conn, key_map, key_len, text_map, text_len, container_path,
+                                       key_offset, ledger_key_path);
+            } else if (key_offset >= 0 || use_ledger || compress) {
+                status = request_key_range(&conn, key_map, key_len, text_map, text_len, out_fd,
+                                           key_offset, ledger_key_path, compress);
+            } else if (conn.is_unix) {
+                // The server reads the files itself, no contents go through the socket
+                status = otp_request_fds(&conn, text_fd, key_fd, out_fd);
+            } else {
+                status = otp_request_checked(&conn, key_map, key_len, text_map, text_len, NULL, out_fd);
+            }
+            report_error(status, key_path);
+            otp_close(&conn);
+        }
     }
-    access_response[bytes_read] = '\0';
-    // End connection if wrong server
-    if (strcmp(access_response, "enc") != 0) {
-        fprintf(stderr, "Error: could not contact enc_server on port %d\n", port_arg);
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    if (report_path) {
+        write_timing_report(report_path, &timing, status);
     }
-    // Notify server on how much key sequence data is coming
-    int nbo_key_len = htonl(key_len);
-    bytes_written = send(socket_fd, &nbo_key_len, sizeof(nbo_key_len), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send message length");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
+    if (key_map) {
+        munmap(key_map, key_map_size);
     }
-    bytes_written = 0;
-    // Loop and send message to ensure complete key sequence message sent
-    total_written = 0;
-    while (total_written < key_len) {
-        bytes_written = send(socket_fd, key_buffer + total_written, key_len - total_written, 0);
-        if (bytes_written < 0) {
-            perror("Error: failed to write to server");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_written == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        }
-        total_written += bytes_written;
+    if (text_map) {
+        munmap(text_map, text_map_size);
     }
-    bytes_written = 0;
-    // Notify server on how much plaintext data is coming
-    int nbo_text_len = htonl(text_len);
-    bytes_written = send(socket_fd, &nbo_text_len, sizeof(nbo_text_len), 0);
-    if (bytes_written < 0) {
-        perror("Error: failed to send message length");
-        free(key_buffer);
-        free(text_buffer);
-        close(socket_fd);
-        exit(2);
-    } 
-    bytes_written = 0;
-    total_written = 0;
-    // Loop and send message to ensure complete plaintext message sent
-    while (total_written < text_len) {
-        bytes_written = send(socket_fd, text_buffer + total_written, text_len - total_written, 0);
-        if (bytes_written < 0) {
-            perror("Error: failed to write to server");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_written == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        }
-        total_written += bytes_written;
+    close(key_fd);
+    close(text_fd);
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
     }
-    bytes_written = 0;
-    total_written = 0;
-    // Clear out the buffer for response from socket
-    memset(text_buffer, '\0', text_len + 1);
-    // Read response from socket
-    bytes_read = 0;
-    total_read = 0;
-    while (total_read < text_len) {
-        bytes_read = recv(socket_fd, text_buffer + total_read, text_len - total_read, 0);
-        if (bytes_read < 0){
-            perror("Error: failed to read response from socket");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
-            exit(2);
-        } else if (bytes_read == 0) {
-            fprintf(stderr, "Error: server may have closed connection\n");
-            free(key_buffer);
-            free(text_buffer);
-            close(socket_fd);
+    // Exit 1 for bad input files, 2 for socket/ server errors, 3 if server refused (retry later)
+    switch (status) {
+        case OTP_OK:
+            return 0;
+        case OTP_ERR_INPUT:
+        case OTP_ERR_KEY_SHORT:
+        case OTP_ERR_FILE:
+        case OTP_ERR_FORMAT:
+        case OTP_ERR_RANGE:
+        case OTP_ERR_LEDGER:
+        case OTP_ERR_CODEC:
+            exit(1);
+        case OTP_ERR_BUSY:
+        case OTP_ERR_TOO_BIG:
+            exit(3);
+        default:
             exit(2);
-        }
-        total_read += bytes_read;
     }
-    text_buffer[text_len] = '\0';
-    printf("%s\n", text_buffer);
-    free(key_buffer);
-    free(text_buffer);
-    close(socket_fd);
-    return 0;
 }
 
 /*
-* Function: setup_socket()
-*   Sets up a socket address with port_num value.
-*   :param struct sockaddr_in* address: structure for socket address
-*   :param int port_num: port number for socket address
+* Function: append_record()
+*   Encrypts the plaintext file with key characters starting at key_offset and
+*   appends the ciphertext to a container as a new record, streamed straight
+*   into the container file. Prints the new record number to stdout.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key file characters (checked)
+*   :param size_t key_len: number of key characters
+*   :param const char *text: plaintext characters (checked)
+*   :param size_t text_len: number of plaintext characters
+*   :param const char *container_path: container file (created if missing)
+*   :param long long key_offset: first key character to use, or -1 for the next unused one
+*   :param const char *ledger_key_path: key file whose pad ledger assigns the key characters, or NULL
+*   :return int: OTP_OK or OTP_ERR_* status
 */
-void setup_socket(struct sockaddr_in* address, int port_num) {
-    // Clear out the address struct
-    memset((char*) address, '\0', sizeof(*address));
+int append_record(struct otp_conn *conn, const char *key, size_t key_len, const char *text, size_t text_len,
+                  const char *container_path, long long key_offset, const char *ledger_key_path) {
+    struct otp_container container;
 
-    // The address should be network capable
-    address->sin_family = AF_INET;
-    // Convert and store the port number in network byte order
-    address->sin_port = htons(port_num);
-    // Allow a client at any address to connect to this server
-    address->sin_addr.s_addr = inet_addr("127.0.0.1");
+    int status = container_open(&container, container_path, true);
+    if (status == OTP_OK) {
+        // Default to key characters no earlier record used
+        uint64_t offset = 0;
+        if (key_offset < 0 && !ledger_key_path) {
+            key_offset = container_next_key_offset(&container);
+        }
+        status = pick_key_offset(key_offset, ledger_key_path, key_len, text_len, &offset);
+        if (status == OTP_OK) {
+            status = container_append_begin(&container);
+        }
+        if (status == OTP_OK) {
+            // Only the key characters this record uses are sent
+            status = otp_request_checked(conn, key + offset, text_len, text, text_len, NULL, container.fd);
+            if (status == OTP_OK) {
+                status = container_append_end(&container, text_len, offset);
+            } else {
+                container_append_abort(&container);
+            }
+        }
+        if (status == OTP_OK) {
+            printf("%llu\n", (unsigned long long)container.record_count - 1);
+        }
+        container_close(&container);
+    }
+    return status;
 }
 
 /*
-* Function: parse_valid_file()
-*   Allocates memory for file text.
-*   Verfiies file contains only valid characters. 
-*   Valid characters includes uppercase letters and space character.
-*   Function expects files terminate with a newline character. 
-*   :param char *filepath: filepath for reading
-*   :return char*: pointer to text string in memory or NULL if error
+* Function: request_resumable()
+*   Sends text and key as a resumable session, which survives dropped
+*   connections by resuming where the transfer stopped.
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port or socket path
+*   :param const char *key: key file characters
+*   :param size_t key_len: number of key characters
+*   :param const char *text: text characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result
+*   :param int retries: reconnections allowed without progress
+*   :param long long key_offset: first key character to use, or -1 for the start
+*   :param const char *ledger_key_path: key file whose pad ledger assigns the key characters, or NULL
+*   :return int: OTP_OK or OTP_ERR_* status
 */
-char* parse_valid_file(char *filepath) {
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
-        perror("Error: failed to open file");
-        return NULL;
+int request_resumable(enum otp_service service, const char *target, const char *key, size_t key_len,
+                      const char *text, size_t text_len, int out_fd, int retries, long long key_offset,
+                      const char *ledger_key_path) {
+    uint64_t offset;
+
+    int status = pick_key_offset(key_offset, ledger_key_path, key_len, text_len, &offset);
+    if (status == OTP_OK) {
+        status = otp_request_resumable(service, target, key + offset, key_len - offset,
+                                       text, text_len, out_fd, retries);
     }
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    if (file_size < 0) {
-        perror("Error: failed to read file");
-        fclose(file);
-        return NULL;
+    return status;
+}
+
+/*
+* Function: request_key_range()
+*   Encrypts the plaintext file with the key characters starting at key_offset,
+*   or at the range claimed from the pad ledger, streaming the result to out_fd.
+*   Only the key characters the plaintext uses are sent. Compressed plaintext
+*   uses (and claims) only as many key characters as its coded length.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key file characters (checked)
+*   :param size_t key_len: number of key characters
+*   :param const char *text: plaintext characters (checked)
+*   :param size_t text_len: number of plaintext characters
+*   :param int out_fd: descriptor receiving the result
+*   :param long long key_offset: first key character to use, or -1 for the start
+*   :param const char *ledger_key_path: key file whose pad ledger assigns the key characters, or NULL
+*   :param bool compress: compress the plaintext before encrypting it
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int request_key_range(struct otp_conn *conn, const char *key, size_t key_len, const char *text, size_t text_len,
+                      int out_fd, long long key_offset, const char *ledger_key_path, bool compress) {
+    char *coded = NULL;
+    int status = OTP_OK;
+
+    // Coded text is A-Z/ space like the plaintext it replaces
+    if (compress) {
+        status = codec_encode(text, text_len, &coded, &text_len);
+        text = coded;
     }
-    rewind(file);
-    // Allocate memory for file text
-    char* buffer = malloc(file_size + 1);
-    if (!buffer) {
-        perror("Error: failed to allocate memory for file text");
-        fclose(file);
-        return NULL;
+    uint64_t offset;
+    if (status == OTP_OK) {
+        status = pick_key_offset(key_offset, ledger_key_path, key_len, text_len, &offset);
     }
-    // Store file contents
-    size_t file_bytes_read = fread(buffer, 1, file_size, file);
-    if (file_bytes_read < 1) {
-        perror("Error: failed to parse file");
-        free(buffer);
-        fclose(file);
-        return NULL;
+    if (status == OTP_OK) {
+        status = otp_request_checked(conn, key + offset, text_len, text, text_len, NULL, out_fd);
     }
-    buffer[file_bytes_read] = '\0'; 
-    fclose(file);
-    // Remove the trailing \n 
-    buffer[strcspn(buffer, "\n")] = '\0';
-    // Validate characters (only uppercase letters and spaces)
-    for (size_t i = 0; buffer[i] != '\0'; i++) {
-        if (!(isupper(buffer[i]) || isspace(buffer[i]))) {
-            perror("enc_client error: input contains bad characters");
-            free(buffer);
-            return NULL;
+    free(coded);
+    return status;
+}
+
+/*
+* Function: pick_key_offset()
+*   Chooses the first key character of a request: claimed from the pad ledger
+*   (and printed to stderr, decryption needs it) or the given offset.
+*   :param long long key_offset: first key character to use, or -1 for the start
+*   :param const char *ledger_key_path: key file whose pad ledger assigns the key characters, or NULL
+*   :param size_t key_len: key characters in the key file
+*   :param size_t text_len: key characters needed
+*   :param uint64_t *offset: set to the first key character to use
+*   :return int: OTP_OK, OTP_ERR_KEY_SHORT if the key has too few characters left, or OTP_ERR_* status
+*/
+int pick_key_offset(long long key_offset, const char *ledger_key_path, size_t key_len,
+                    size_t text_len, uint64_t *offset) {
+    struct otp_ledger ledger;
+
+    if (ledger_key_path) {
+        int status = ledger_open(&ledger, ledger_key_path, key_len);
+        if (status != OTP_OK) {
+            return status;
+        }
+        status = ledger_claim(&ledger, text_len, offset);
+        ledger_close(&ledger);
+        if (status == OTP_OK) {
+            fprintf(stderr, "key_offset=%llu\n", (unsigned long long)*offset);
         }
+        return status;
+    }
+    *offset = (key_offset < 0) ? 0 : (uint64_t)key_offset;
+    if (*offset > key_len || text_len > key_len - *offset) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: report_error()
+*   Prints the message for a failed request, or nothing for OTP_OK.
+*   :param int status: OTP_OK or OTP_ERR_* status
+*   :param const char *key_path: key file named in the key too short message
+*/
+void report_error(int status, const char *key_path) {
+    if (status == OTP_ERR_KEY_SHORT) {
+        fprintf(stderr,"Error: key \'%s\' is too short\n", key_path);
+    } else if (status == OTP_ERR_INPUT) {
+        fprintf(stderr, "enc_client error: input contains bad characters\n");
+    } else if (status != OTP_OK) {
+        fprintf(stderr, "Error: %s\n", otp_strerror(status));
     }
-    return buffer;
-}
\ No newline at end of file
+}
+
+/*
+* Function: write_timing_report()
+*   Appends the stage timings of the request as one JSON line to the report file,
+*   or to stderr for "-". The line goes out in one write, so jobs sharing a
+*   report file do not interleave.
+*   :param const char *report_path: report file, or "-" for stderr
+*   :param const struct otp_timing *timing: stages from otp_connect_timed()
+*   :param int status: OTP_OK or OTP_ERR_* status of the request
+*/
+void write_timing_report(const char *report_path, const struct otp_timing *timing, int status) {
+    char report[1024];
+
+    int len = otp_timing_json(timing, status, report, sizeof(report) - 1);
+    if (len < 0 || len >= (int)sizeof(report) - 1) {
+        return;
+    }
+    report[len++] = '\n';
+    int report_fd = (strcmp(report_path, "-") == 0) ? STDERR_FILENO
+                                                     : open(report_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (report_fd < 0) {
+        perror("Error: failed to open timing report");
+        return;
+    }
+    if (write(report_fd, report, len) != len) {
+        perror("Error: failed to write timing report");
+    }
+    if (report_fd != STDERR_FILENO) {
+        close(report_fd);
+    }
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>         // Memory management
+#include <stdbool.h>        // Boolean values
+#include <string.h>         // String functions
+#include <ctype.h>          // Character functions
+#include <errno.h>          // Error numbers
+#include <arpa/inet.h>      // Internet functions
+#include <sys/socket.h>     // Socket functions
+#include <sys/epoll.h>      // Event polling functions
+#include <fcntl.h>          // File control functions
+#include <unistd.h>         // Process management/ file operations
+#include "otp_async.h"
+
+#define ASYNC_MAX_EVENTS 64
+
+struct async_request {
+    otp_callback callback;
+    void *user_data;
+    size_t text_len;                // Result characters expected from server
+    size_t received;                // Result characters read so far
+    char *result;
+    struct async_request *next;
+};
+
+struct async_conn {
+    struct otp_conn conn;
+    bool alive;
+    bool want_write;                // EPOLLOUT registered (unsent requests queued)
+    char *out_buf;                  // Encoded requests not yet written to socket
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    struct async_request *head;     // Oldest outstanding request (next response)
+    struct async_request *tail;
+    size_t outstanding;
+};
+
+struct otp_async {
+    int epoll_fd;
+    int conn_count;
+    struct async_conn *conns;
+    size_t pending;
+};
+
+// Helper function declarations
+static int append_out(struct async_conn *conn, const void *data, size_t len);
+static void flush_conn(struct otp_async *loop, struct async_conn *conn);
+static int read_conn(struct otp_async *loop, struct async_conn *conn);
+static void fail_conn(struct otp_async *loop, struct async_conn *conn, int status);
+static void watch_write(struct otp_async *loop, struct async_conn *conn, bool enable);
+
+/*
+* Function: otp_async_create()
+*   Opens conn_count keep-alive connections to the server for pipelined requests.
+*   Only TCP targets are supported (the UNIX listener takes descriptor requests).
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host
+*   :param int conn_count: number of connections to spread requests over
+*   :param int *status: set to OTP_OK or OTP_ERR_* status
+*   :return struct otp_async*: client loop or NULL if error
+*/
+struct otp_async* otp_async_create(enum otp_service service, const char *target,
+                                   int conn_count, int *status) {
+    if (conn_count < 1 || strchr(target, '/')) {
+        *status = OTP_ERR_CONNECT;
+        return NULL;
+    }
+    struct otp_async *loop = calloc(1, sizeof(struct otp_async));
+    if (!loop) {
+        *status = OTP_ERR_NOMEM;
+        return NULL;
+    }
+    loop->conns = calloc(conn_count, sizeof(struct async_conn));
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!loop->conns || loop->epoll_fd < 0) {
+        *status = loop->conns ? OTP_ERR_IO : OTP_ERR_NOMEM;
+        otp_async_destroy(loop);
+        return NULL;
+    }
+    for (int i = 0; i < conn_count; i++) {
+        struct async_conn *conn = &loop->conns[i];
+        // Handshake is done blocking, everything after is non-blocking
+        *status = otp_connect(&conn->conn, service, target);
+        if (*status != OTP_OK) {
+            otp_async_destroy(loop);
+            return NULL;
+        }
+        loop->conn_count++;
+        conn->alive = true;
+        // Pipelining needs a server that keeps connections alive
+        if (!conn->conn.keep_alive) {
+            *status = OTP_ERR_REJECTED;
+            otp_async_destroy(loop);
+            return NULL;
+        }
+        fcntl(conn->conn.socket_fd, F_SETFL, fcntl(conn->conn.socket_fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, conn->conn.socket_fd, &event) < 0) {
+            *status = OTP_ERR_IO;
+            otp_async_destroy(loop);
+            return NULL;
+        }
+    }
+    *status = OTP_OK;
+    return loop;
+}
+
+/*
+* Function: otp_async_submit()
+*   Queues one request on the connection with the fewest outstanding requests
+*   and starts writing it. Key and text are copied, so caller buffers can be
+*   reused as soon as this returns. Callback runs later from otp_async_run().
+*   :param struct otp_async *loop: client loop
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters (at least 1)
+*   :param otp_callback callback: called with the result
+*   :param void *user_data: passed to callback
+*   :return int: OTP_OK if queued, else OTP_ERR_* status (callback not called)
+*/
+int otp_async_submit(struct otp_async *loop, const char *key, size_t key_len,
+                     const char *text, size_t text_len, otp_callback callback, void *user_data) {
+    if (text_len < 1 || !otp_valid_text(key, key_len) || !otp_valid_text(text, text_len)) {
+        return OTP_ERR_INPUT;
+    }
+    if (key_len < text_len) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    // Least outstanding requests among live connections
+    struct async_conn *conn = NULL;
+    for (int i = 0; i < loop->conn_count; i++) {
+        if (loop->conns[i].alive && (!conn || loop->conns[i].outstanding < conn->outstanding)) {
+            conn = &loop->conns[i];
+        }
+    }
+    if (!conn) {
+        return OTP_ERR_CLOSED;
+    }
+    struct async_request *request = calloc(1, sizeof(struct async_request));
+    if (!request) {
+        return OTP_ERR_NOMEM;
+    }
+    request->result = malloc(text_len);
+    if (!request->result) {
+        free(request);
+        return OTP_ERR_NOMEM;
+    }
+    // Encode Parts 2-5 after any requests still waiting to be written
+    int nbo_key_len = htonl(key_len);
+    int nbo_text_len = htonl(text_len);
+    size_t old_len = conn->out_len;
+    if (append_out(conn, &nbo_key_len, sizeof(nbo_key_len)) < 0 ||
+            append_out(conn, key, key_len) < 0 ||
+            append_out(conn, &nbo_text_len, sizeof(nbo_text_len)) < 0 ||
+            append_out(conn, text, text_len) < 0) {
+        conn->out_len = old_len;
+        free(request->result);
+        free(request);
+        return OTP_ERR_NOMEM;
+    }
+    request->callback = callback;
+    request->user_data = user_data;
+    request->text_len = text_len;
+    if (conn->tail) {
+        conn->tail->next = request;
+    } else {
+        conn->head = request;
+    }
+    conn->tail = request;
+    conn->outstanding++;
+    loop->pending++;
+    flush_conn(loop, conn);
+    return OTP_OK;
+}
+
+/*
+* Function: otp_async_run()
+*   Waits up to timeout_ms for socket activity, writes queued requests, reads
+*   responses and runs callbacks of completed requests.
+*   :param struct otp_async *loop: client loop
+*   :param int timeout_ms: maximum wait (-1 waits until something happens, 0 polls)
+*   :return int: number of completed requests, or OTP_ERR_IO
+*/
+int otp_async_run(struct otp_async *loop, int timeout_ms) {
+    struct epoll_event events[ASYNC_MAX_EVENTS];
+
+    int event_count = epoll_wait(loop->epoll_fd, events, ASYNC_MAX_EVENTS, timeout_ms);
+    if (event_count < 0) {
+        return (errno == EINTR) ? 0 : OTP_ERR_IO;
+    }
+    int completed = 0;
+    for (int i = 0; i < event_count; i++) {
+        struct async_conn *conn = events[i].data.ptr;
+        if (conn->alive && (events[i].events & EPOLLOUT)) {
+            flush_conn(loop, conn);
+        }
+        if (conn->alive && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            completed += read_conn(loop, conn);
+        }
+    }
+    return completed;
+}
+
+/*
+* Function: otp_async_drain()
+*   Runs the loop until every submitted request has completed.
+*   :param struct otp_async *loop: client loop
+*   :return int: OTP_OK or OTP_ERR_IO
+*/
+int otp_async_drain(struct otp_async *loop) {
+    while (loop->pending > 0) {
+        int result = otp_async_run(loop, -1);
+        if (result < 0) {
+            return result;
+        }
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: otp_async_pending()
+*   :param struct otp_async *loop: client loop
+*   :return size_t: number of submitted requests whose callback has not run
+*/
+size_t otp_async_pending(struct otp_async *loop) {
+    return loop->pending;
+}
+
+/*
+* Function: otp_async_fd()
+*   Returns a descriptor that becomes readable when otp_async_run() has work,
+*   for embedding the client in a caller's own poll/ epoll loop.
+*   :param struct otp_async *loop: client loop
+*   :return int: epoll descriptor
+*/
+int otp_async_fd(struct otp_async *loop) {
+    return loop->epoll_fd;
+}
+
+/*
+* Function: otp_async_destroy()
+*   Closes all connections. Outstanding requests complete with OTP_ERR_CLOSED.
+*   :param struct otp_async *loop: client loop
+*/
+void otp_async_destroy(struct otp_async *loop) {
+    if (!loop) {
+        return;
+    }
+    for (int i = 0; i < loop->conn_count; i++) {
+        if (loop->conns[i].alive) {
+            fail_conn(loop, &loop->conns[i], OTP_ERR_CLOSED);
+        }
+        free(loop->conns[i].out_buf);
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    free(loop->conns);
+    free(loop);
+}
+
+/*
+* Function: append_out()
+*   Appends bytes to the connection's unsent request buffer, growing it as needed.
+*   :param struct async_conn *conn: connection
+*   :param const void *data: bytes to append
+*   :param size_t len: number of bytes
+*   :return int: 0 on success, -1 if out of memory
+*/
+static int append_out(struct async_conn *conn, const void *data, size_t len) {
+    if (conn->out_len + len > conn->out_cap) {
+        size_t new_cap = conn->out_cap ? conn->out_cap : 4096;
+        while (new_cap < conn->out_len + len) {
+            new_cap *= 2;
+        }
+        char *new_buf = realloc(conn->out_buf, new_cap);
+        if (!new_buf) {
+            return -1;
+        }
+        conn->out_buf = new_buf;
+        conn->out_cap = new_cap;
+    }
+    memcpy(conn->out_buf + conn->out_len, data, len);
+    conn->out_len += len;
+    return 0;
+}
+
+/*
+* Function: flush_conn()
+*   Writes as much of the unsent request buffer as the socket takes without
+*   blocking, and watches for writability only while something is left.
+*   :param struct otp_async *loop: client loop
+*   :param struct async_conn *conn: connection
+*/
+static void flush_conn(struct otp_async *loop, struct async_conn *conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t bytes_written = send(conn->conn.socket_fd, conn->out_buf + conn->out_sent,
+                                     conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watch_write(loop, conn, true);
+            return;
+        } else if (bytes_written <= 0) {
+            fail_conn(loop, conn, OTP_ERR_CLOSED);
+            return;
+        }
+        conn->out_sent += bytes_written;
+    }
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    watch_write(loop, conn, false);
+}
+
+/*
+* Function: read_conn()
+*   Reads available response bytes into the oldest outstanding requests and runs
+*   callbacks for each one completed.
+*   :param struct otp_async *loop: client loop
+*   :param struct async_conn *conn: connection
+*   :return int: number of completed requests
+*/
+static int read_conn(struct otp_async *loop, struct async_conn *conn) {
+    int completed = 0;
+    while (conn->alive) {
+        struct async_request *request = conn->head;
+        char scratch[64];
+        char *target = request ? request->result + request->received : scratch;
+        size_t want = request ? request->text_len - request->received : sizeof(scratch);
+        ssize_t bytes_read = recv(conn->conn.socket_fd, target, want, 0);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (bytes_read <= 0 || !request) {
+            // Server closed connection or sent bytes nothing was waiting for
+            fail_conn(loop, conn, OTP_ERR_CLOSED);
+            break;
+        }
+        // Lowercase first byte is a status word: server refused the request and closes
+        if (request->received == 0 && islower(target[0])) {
+            fail_conn(loop, conn, otp_reply_status(target, bytes_read));
+            break;
+        }
+        request->received += bytes_read;
+        if (request->received == request->text_len) {
+            conn->head = request->next;
+            if (!conn->head) {
+                conn->tail = NULL;
+            }
+            conn->outstanding--;
+            loop->pending--;
+            completed++;
+            request->callback(request->user_data, OTP_OK, request->result, request->text_len);
+            free(request->result);
+            free(request);
+        }
+    }
+    return completed;
+}
+
+/*
+* Function: fail_conn()
+*   Closes a broken connection and completes its outstanding requests with status.
+*   :param struct otp_async *loop: client loop
+*   :param struct async_conn *conn: connection
+*   :param int status: OTP_ERR_* status passed to callbacks
+*/
+static void fail_conn(struct otp_async *loop, struct async_conn *conn, int status) {
+    conn->alive = false;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->conn.socket_fd, NULL);
+    otp_close(&conn->conn);
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    while (conn->head) {
+        struct async_request *request = conn->head;
+        conn->head = request->next;
+        conn->outstanding--;
+        loop->pending--;
+        request->callback(request->user_data, status, NULL, 0);
+        free(request->result);
+        free(request);
+    }
+    conn->tail = NULL;
+}
+
+/*
+* Function: watch_write()
+*   Turns EPOLLOUT interest on or off for a connection.
+*   :param struct otp_async *loop: client loop
+*   :param struct async_conn *conn: connection
+*   :param bool enable: true to wait for writability
+*/
+static void watch_write(struct otp_async *loop, struct async_conn *conn, bool enable) {
+    if (conn->want_write == enable) {
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN | (enable ? EPOLLOUT : 0), .data.ptr = conn };
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->conn.socket_fd, &event);
+    conn->want_write = enable;
+}
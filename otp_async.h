@@ -0,0 +1,37 @@
+#ifndef OTP_ASYNC_H
+#define OTP_ASYNC_H
+
+#include <stddef.h>         // Size types
+#include "otp_client.h"     // Services and status codes
+
+/*
+Module Name: Asynchronous Client (libotpclient)
+Author: Jose Bianchi
+Description: Non-blocking client that keeps many requests in flight over a small
+    pool of keep-alive connections from one event loop. Requests are pipelined:
+    each connection writes requests back to back and the server answers them in
+    order, so a completion is matched to the oldest outstanding request on that
+    connection. New requests go to the connection with the fewest outstanding.
+    Completion callbacks run from otp_async_run() on the caller's thread.
+*/
+
+/*
+* Type: otp_callback
+*   Called once per submitted request. result holds result_len characters on
+*   OTP_OK and is only valid until the callback returns.
+*/
+typedef void (*otp_callback)(void *user_data, int status, const char *result, size_t result_len);
+
+struct otp_async;
+
+struct otp_async* otp_async_create(enum otp_service service, const char *target,
+                                   int conn_count, int *status);
+int otp_async_submit(struct otp_async *loop, const char *key, size_t key_len,
+                     const char *text, size_t text_len, otp_callback callback, void *user_data);
+int otp_async_run(struct otp_async *loop, int timeout_ms);
+int otp_async_drain(struct otp_async *loop);
+size_t otp_async_pending(struct otp_async *loop);
+int otp_async_fd(struct otp_async *loop);
+void otp_async_destroy(struct otp_async *loop);
+
+#endif
@@ -0,0 +1,569 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <inttypes.h>       // Fixed width format macros
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <netinet/in.h>     // Internet/ socket functions
+#include <sys/socket.h>     // Socket functions
+#include <arpa/inet.h>      // Internet functions
+#include <sys/resource.h>   // Resource usage
+#include <sys/wait.h>       // Process termination functions
+#include <unistd.h>         // Process management/ file operations
+#include <signal.h>         // Signal handling
+#include <time.h>           // Clock functions
+#include "otp_zerocopy.h"   // Zero-copy sends
+#include "otp_codec.h"      // Text compression
+#include "otp_client.h"     // Status codes
+#include "otp_ring.h"       // Shared-memory ring transport
+#include "otp_unix.h"       // Descriptor request status codes
+#include "otp_protocol.h"   // Client codes/ access responses
+
+#define CONNECT_COUNT 5
+#define SINK_BUFFER 1048576         // Bytes a sink reads per call
+#define CODEC_BLOCK 1048576         // Characters coded per call in the codec benchmark
+#define RING_MSG_LEN 48              // Default message size of the ring benchmark
+#define BENCH_USAGE "USAGE: %s [-g gigabytes] [-c chunk_bytes] zerocopy [sink]\n" \
+                    "       %s [-g gigabytes] codec [text_file]\n" \
+                    "       %s [-g gigabytes] ring socket_path [msg_len]\n" \
+                    "       %s sink port\n" \
+                    "  sink: port on this host or ipv4_address:port (default: a local sink)\n"
+
+/*
+Program Name: Benchmarks
+Author: Jose Bianchi
+Description: Program is part of encryption/ decryption prgram for converting
+    plaintext data into ciphertext, using a key via the one-time pad-like approach.
+    This specific program measures the cost of server building blocks in isolation.
+    zerocopy sends -g gigabytes (default 4) of response-like A-Z data to a sink, once
+    with plain copying send() calls and once with MSG_ZEROCOPY as enc_server -z does,
+    each call moving -c bytes (default 1048576), and reports the CPU time (user +
+    system) this process spent per GB for each, and the difference. Without a sink
+    argument a local sink process is forked; over loopback the kernel copies zero-copy
+    data anyway (reported as copied completions), so run "sink port" on another host
+    and pass its address to measure what a network device saves. codec compresses and
+    restores -g gigabytes (default 0.1) of text in 1MB messages, taken from text_file
+    (repeated as needed) or built from common English words, and reports the coded
+    size and the coder's speed next to the cipher's, so its cost can be weighed
+    against the pad and bandwidth it saves. ring sends -g gigabytes (default 0.01) of
+    msg_len character messages (default 48) through the shared-memory ring of an
+    enc_server started with -u socket_path, keeping the ring full, checks every
+    result and reports requests per second; compare servers started with different
+    -g/ -G batching settings (SIGUSR1 on the server shows how requests were batched).
+*/
+
+struct send_pass {
+    const char *name;
+    bool zerocopy;
+    double wall_s;
+    double cpu_s;
+    uint64_t sends;                 // Zero-copy send calls
+    uint64_t copied;                // Of those, completed as copies by the kernel
+};
+
+// Helper function declarations
+int parse_sink(const char *arg, struct sockaddr_in *address);
+pid_t start_local_sink(struct sockaddr_in *address);
+void run_sink(int listen_socket);
+void drain(int client_socket);
+int run_send_pass(const struct sockaddr_in *address, struct send_pass *pass, const char *buffer,
+                  size_t chunk, uint64_t total);
+int run_codec(const char *text_path, uint64_t total);
+int run_ring(const char *socket_path, size_t msg_len, uint64_t total);
+char* load_text(const char *text_path, size_t len);
+double cpu_seconds(void);
+double wall_seconds(void);
+
+// Words the synthetic codec benchmark text is built from
+static const char *const common_words[] = {
+    "THE", "OF", "AND", "TO", "A", "IN", "IS", "IT", "THAT", "WAS", "FOR", "ON", "ARE", "WITH",
+    "AS", "HIS", "THEY", "BE", "AT", "ONE", "HAVE", "THIS", "FROM", "OR", "HAD", "BY", "WORD",
+    "BUT", "WHAT", "SOME", "WE", "CAN", "OUT", "OTHER", "WERE", "ALL", "THERE", "WHEN", "UP",
+    "USE", "YOUR", "HOW", "SAID", "AN", "EACH", "SHE", "WHICH", "DO", "THEIR", "TIME", "IF",
+    "WILL", "WAY", "ABOUT", "MANY", "THEN", "THEM", "WRITE", "WOULD", "LIKE", "SO", "THESE",
+    "HER", "LONG", "MAKE", "THING", "SEE", "HIM", "TWO", "HAS", "LOOK", "MORE", "DAY", "COULD",
+    "GO", "COME", "DID", "NUMBER", "SOUND", "NO", "MOST", "PEOPLE", "MY", "OVER", "KNOW", "WATER",
+    "THAN", "CALL", "FIRST", "WHO", "MAY", "DOWN", "SIDE", "BEEN", "NOW", "FIND", "MESSAGE",
+    "SECRET", "KEY", "PAD", "SERVER", "CLIENT", "REQUEST", "QUICK", "JUMPS", "LAZY", "ZERO",
+};
+
+int main(int argc, char *argv[]) {
+    double gigabytes = 0;
+    size_t chunk = 1048576;
+    int option;
+
+    // Validate input
+    while ((option = getopt(argc, argv, "g:c:")) != -1) {
+        switch (option) {
+            case 'g':
+                gigabytes = atof(optarg);
+                break;
+            case 'c':
+                chunk = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc || gigabytes < 0 || chunk == 0) {
+        fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+    const char *mode = argv[optind];
+    struct sockaddr_in address;
+    signal(SIGPIPE, SIG_IGN);
+    if (strcmp(mode, "sink") == 0) {
+        if (argc - optind != 2 || parse_sink(argv[optind + 1], &address) < 0) {
+            fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+        int listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+        address.sin_addr.s_addr = INADDR_ANY;
+        if (listen_socket < 0 || bind(listen_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+            perror("Error: could not bind sink to socket address");
+            exit(1);
+        }
+        listen(listen_socket, CONNECT_COUNT);
+        run_sink(listen_socket);
+        return 0;
+    }
+    if (strcmp(mode, "codec") == 0) {
+        if (argc - optind > 2) {
+            fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+        uint64_t total = (uint64_t)((gigabytes > 0 ? gigabytes : 0.1) * 1e9);
+        return (run_codec(argc - optind == 2 ? argv[optind + 1] : NULL, total) == 0) ? 0 : 1;
+    }
+    if (strcmp(mode, "ring") == 0) {
+        size_t msg_len = (argc - optind == 3) ? strtoull(argv[optind + 2], NULL, 10) : RING_MSG_LEN;
+        if (argc - optind < 2 || argc - optind > 3 || msg_len == 0 || 2 * msg_len > RING_SLOT_DATA) {
+            fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+        uint64_t total = (uint64_t)((gigabytes > 0 ? gigabytes : 0.01) * 1e9);
+        return (run_ring(argv[optind + 1], msg_len, total) == 0) ? 0 : 1;
+    }
+    if (strcmp(mode, "zerocopy") != 0 || argc - optind > 2) {
+        fprintf(stderr, BENCH_USAGE, argv[0], argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+    pid_t sink_pid = -1;
+    if (argc - optind == 2) {
+        if (parse_sink(argv[optind + 1], &address) < 0) {
+            fprintf(stderr, "Error: invalid sink '%s'\n", argv[optind + 1]);
+            exit(1);
+        }
+    } else {
+        sink_pid = start_local_sink(&address);
+    }
+    // The buffer is never changed while sends may still read it
+    char *buffer = malloc(chunk);
+    if (!buffer) {
+        perror("Error: failed to allocate memory for send buffer");
+        exit(1);
+    }
+    for (size_t i = 0; i < chunk; i++) {
+        buffer[i] = 'A' + i % 26;
+    }
+    uint64_t total = (uint64_t)((gigabytes > 0 ? gigabytes : 4) * 1e9);
+    struct send_pass passes[2] = {
+        { .name = "copy", .zerocopy = false },
+        { .name = "zerocopy", .zerocopy = true },
+    };
+    for (int i = 0; i < 2; i++) {
+        if (run_send_pass(&address, &passes[i], buffer, chunk, total) < 0) {
+            exit(1);
+        }
+        double gb = total / 1e9;
+        printf("%s: bytes=%" PRIu64 " wall=%.3fs cpu=%.3fs cpu_per_gb=%.4fs throughput=%.2fGB/s",
+               passes[i].name, total, passes[i].wall_s, passes[i].cpu_s, passes[i].cpu_s / gb,
+               passes[i].wall_s > 0 ? gb / passes[i].wall_s : 0.0);
+        if (passes[i].zerocopy) {
+            printf(" sends=%" PRIu64 " copied=%" PRIu64, passes[i].sends, passes[i].copied);
+        }
+        printf("\n");
+    }
+    double saved = (passes[0].cpu_s - passes[1].cpu_s) / (total / 1e9);
+    printf("saved: cpu_per_gb=%.4fs (%.1f%%)\n", saved,
+           passes[0].cpu_s > 0 ? 100 * (passes[0].cpu_s - passes[1].cpu_s) / passes[0].cpu_s : 0.0);
+    if (passes[1].copied > 0) {
+        printf("note: the kernel copied %" PRIu64 " of %" PRIu64 " zero-copy sends (loopback or a device "
+               "without scatter-gather); use a remote sink to measure a network device\n",
+               passes[1].copied, passes[1].sends);
+    }
+    free(buffer);
+    if (sink_pid > 0) {
+        kill(sink_pid, SIGTERM);
+        waitpid(sink_pid, NULL, 0);
+    }
+    return 0;
+}
+
+/*
+* Function: parse_sink()
+*   Parses "port" (this host) or "ipv4_address:port" into a sink address.
+*   :param const char *arg: sink argument
+*   :param struct sockaddr_in *address: address to fill in
+*   :return int: 0 on success, -1 if invalid
+*/
+int parse_sink(const char *arg, struct sockaddr_in *address) {
+    char host[32] = "127.0.0.1";
+    const char *port_text = arg;
+    const char *colon = strchr(arg, ':');
+
+    if (colon) {
+        size_t host_len = colon - arg;
+        if (host_len == 0 || host_len >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, arg, host_len);
+        host[host_len] = '\0';
+        port_text = colon + 1;
+    }
+    int port_num = atoi(port_text);
+    if (port_num <= 0 || port_num > 65535) {
+        return -1;
+    }
+    memset(address, '\0', sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port_num);
+    return (inet_pton(AF_INET, host, &address->sin_addr) == 1) ? 0 : -1;
+}
+
+/*
+* Function: start_local_sink()
+*   Forks a sink listening on a free loopback port. Its CPU time is not counted
+*   in the passes, which only measure this process.
+*   :param struct sockaddr_in *address: set to the sink address
+*   :return pid_t: sink process
+*/
+pid_t start_local_sink(struct sockaddr_in *address) {
+    socklen_t address_size = sizeof(*address);
+
+    int listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    memset(address, '\0', sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_socket < 0 || bind(listen_socket, (struct sockaddr *)address, sizeof(*address)) < 0 ||
+            getsockname(listen_socket, (struct sockaddr *)address, &address_size) < 0) {
+        perror("Error: could not open local sink");
+        exit(1);
+    }
+    listen(listen_socket, CONNECT_COUNT);
+    pid_t sink_pid = fork();
+    if (sink_pid < 0) {
+        perror("Error: fork() failed");
+        exit(1);
+    }
+    if (sink_pid == 0) {
+        run_sink(listen_socket);
+        exit(0);
+    }
+    close(listen_socket);
+    return sink_pid;
+}
+
+/*
+* Function: run_sink()
+*   Accepts connections forever and discards everything sent on them, one
+*   forked child per connection.
+*   :param int listen_socket: listening socket
+*/
+void run_sink(int listen_socket) {
+    signal(SIGCHLD, SIG_IGN);
+    while (1) {
+        int client_socket = accept(listen_socket, NULL, NULL);
+        if (client_socket < 0) {
+            if (errno != EINTR) {
+                perror("Error: could not accept connection from socket");
+            }
+            continue;
+        }
+        if (fork() == 0) {
+            close(listen_socket);
+            drain(client_socket);
+            exit(0);
+        }
+        close(client_socket);
+    }
+}
+
+/*
+* Function: drain()
+*   Reads a connection until the sender closes it, then closes it too.
+*   :param int client_socket: connected socket
+*/
+void drain(int client_socket) {
+    char *buffer = malloc(SINK_BUFFER);
+
+    while (buffer && recv(client_socket, buffer, SINK_BUFFER, 0) > 0);
+    free(buffer);
+    close(client_socket);
+}
+
+/*
+* Function: run_send_pass()
+*   Sends total bytes over a new connection in chunk sized calls and records the
+*   wall and CPU time taken. A zero-copy pass includes waiting for the last
+*   completion, as the server does before it frees a response.
+*   :param const struct sockaddr_in *address: sink address
+*   :param struct send_pass *pass: pass to run, receives the measurements
+*   :param const char *buffer: chunk bytes to send repeatedly
+*   :param size_t chunk: bytes per send call
+*   :param uint64_t total: bytes to send
+*   :return int: 0 or -1 if error (message printed)
+*/
+int run_send_pass(const struct sockaddr_in *address, struct send_pass *pass, const char *buffer,
+                  size_t chunk, uint64_t total) {
+    struct zc_state zerocopy;
+    uint64_t sent = 0;
+
+    int sink_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (sink_socket < 0 || connect(sink_socket, (const struct sockaddr *)address, sizeof(*address)) < 0) {
+        perror("Error: could not connect to sink");
+        return -1;
+    }
+    memset(&zerocopy, '\0', sizeof(zerocopy));
+    if (pass->zerocopy && !zc_enable(&zerocopy, sink_socket)) {
+        perror("Error: SO_ZEROCOPY not supported");
+        close(sink_socket);
+        return -1;
+    }
+    double wall_start = wall_seconds();
+    double cpu_start = cpu_seconds();
+    while (sent < total) {
+        size_t offset = sent % chunk;
+        size_t want = (total - sent < chunk - offset) ? total - sent : chunk - offset;
+        ssize_t bytes = zc_send(&zerocopy, sink_socket, buffer + offset, want, 0);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error: could not write to sink");
+            close(sink_socket);
+            return -1;
+        }
+        sent += bytes;
+        // Keep the error queue short, as the server's send loop does
+        zc_reap(&zerocopy, sink_socket);
+    }
+    zc_wait(&zerocopy, sink_socket, -1);
+    pass->cpu_s = cpu_seconds() - cpu_start;
+    pass->wall_s = wall_seconds() - wall_start;
+    pass->sends = zerocopy.next;
+    pass->copied = zerocopy.copied;
+    close(sink_socket);
+    return 0;
+}
+
+/*
+* Function: run_codec()
+*   Compresses total characters of text in CODEC_BLOCK messages, restores them
+*   and checks the result, then runs the cipher over the same text for
+*   comparison. Prints sizes and speeds.
+*   :param const char *text_path: text file, or NULL for synthetic English text
+*   :param uint64_t total: characters to code
+*   :return int: 0 or -1 if error (message printed)
+*/
+int run_codec(const char *text_path, uint64_t total) {
+    size_t block = (total < CODEC_BLOCK) ? total : CODEC_BLOCK;
+    uint64_t blocks = (total + block - 1) / block;
+    uint64_t coded_total = 0;
+    double encode_s = 0;
+    double decode_s = 0;
+
+    char *text = load_text(text_path, block);
+    char *cipher = malloc(block + 1);
+    if (!text || !cipher) {
+        free(text);
+        free(cipher);
+        return -1;
+    }
+    for (uint64_t i = 0; i < blocks; i++) {
+        char *coded;
+        char *restored;
+        size_t coded_len;
+        size_t restored_len;
+        double start = wall_seconds();
+        int status = codec_encode(text, block, &coded, &coded_len);
+        double middle = wall_seconds();
+        if (status == OTP_OK) {
+            status = codec_decode(coded, coded_len, &restored, &restored_len);
+            free(coded);
+        }
+        decode_s += wall_seconds() - middle;
+        encode_s += middle - start;
+        if (status != OTP_OK || restored_len != block || memcmp(restored, text, block) != 0) {
+            fprintf(stderr, "Error: codec round trip failed (%s)\n", otp_strerror(status));
+            free(text);
+            free(cipher);
+            return -1;
+        }
+        free(restored);
+        coded_total += coded_len;
+    }
+    // Reference: the cipher's work per character, on the text with itself as key
+    volatile char sink = 0;
+    double start = wall_seconds();
+    for (uint64_t i = 0; i < blocks; i++) {
+        for (size_t j = 0; j < block; j++) {
+            int sum = (text[j] == ' ' ? 26 : text[j] - 'A') * 2;
+            sum = (sum > 26) ? sum - 27 : sum;
+            cipher[j] = (sum == 26) ? ' ' : 'A' + sum;
+        }
+        sink ^= cipher[i % block];
+    }
+    double cipher_s = wall_seconds() - start;
+    double megabytes = (double)blocks * block / 1e6;
+    printf("codec: chars=%" PRIu64 " coded=%" PRIu64 " ratio=%.3f bits_per_char=%.3f pad_saved=%.1f%%\n",
+           blocks * block, coded_total, (double)coded_total / (blocks * block),
+           4.7549 * coded_total / (blocks * block), 100.0 * (1 - (double)coded_total / (blocks * block)));
+    printf("speed: encode=%.1fMB/s decode=%.1fMB/s cipher=%.1fMB/s\n", megabytes / encode_s,
+           megabytes / decode_s, megabytes / cipher_s);
+    free(text);
+    free(cipher);
+    return 0;
+}
+
+/*
+* Function: run_ring()
+*   Encrypts total characters as msg_len character requests over a ring, with
+*   up to a ring's worth of requests in flight, and checks each result against
+*   the cipher computed here. Prints the request rate.
+*   :param const char *socket_path: enc_server UNIX-domain socket
+*   :param size_t msg_len: characters per message (and key)
+*   :param uint64_t total: message characters to send
+*   :return int: 0 or -1 if error (message printed)
+*/
+int run_ring(const char *socket_path, size_t msg_len, uint64_t total) {
+    uint64_t requests = (total + msg_len - 1) / msg_len;
+    uint64_t submitted = 0;
+    uint64_t collected = 0;
+    uint64_t mismatched = 0;
+    char result[RING_SLOT_DATA];
+    char expected[RING_SLOT_DATA];
+    size_t result_len;
+    uint64_t id;
+
+    // Messages and keys are windows into one buffer of benchmark text
+    size_t text_len = RING_SLOT_COUNT + 2 * msg_len;
+    char *text = load_text(NULL, text_len);
+    if (!text) {
+        return -1;
+    }
+    struct otp_ring *ring = ring_connect(socket_path, ENC_CLIENT_CODE, ENC_ACCEPT_REPLY);
+    if (!ring) {
+        free(text);
+        return -1;
+    }
+    double start = wall_seconds();
+    while (collected < requests) {
+        // Only submit while a response slot is sure to be free
+        if (submitted < requests && submitted - collected < RING_SLOT_COUNT) {
+            const char *msg = text + submitted % RING_SLOT_COUNT;
+            if (ring_submit(ring, submitted, msg + msg_len, msg_len, msg, msg_len) < 0) {
+                break;
+            }
+            submitted++;
+            continue;
+        }
+        int status = ring_collect(ring, &id, result, &result_len);
+        if (status < 0) {
+            break;
+        }
+        const char *msg = text + id % RING_SLOT_COUNT;
+        const char *key = msg + msg_len;
+        for (size_t j = 0; j < msg_len; j++) {
+            int sum = (msg[j] == ' ' ? 26 : msg[j] - 'A') + (key[j] == ' ' ? 26 : key[j] - 'A');
+            sum = (sum > 26) ? sum - 27 : sum;
+            expected[j] = (sum == 26) ? ' ' : 'A' + sum;
+        }
+        if (status != UNIX_STATUS_OK || result_len != msg_len || memcmp(result, expected, msg_len) != 0) {
+            mismatched++;
+        }
+        collected++;
+    }
+    double elapsed = wall_seconds() - start;
+    ring_close(ring);
+    free(text);
+    if (collected < requests) {
+        fprintf(stderr, "Error: server closed the ring after %" PRIu64 " of %" PRIu64 " requests\n",
+                collected, requests);
+        return -1;
+    }
+    printf("ring: requests=%" PRIu64 " msg_len=%zu elapsed=%.3fs rate=%.0freq/s throughput=%.1fMB/s "
+           "mismatched=%" PRIu64 "\n", requests, msg_len, elapsed, requests / elapsed,
+           requests * msg_len / elapsed / 1e6, mismatched);
+    return (mismatched == 0) ? 0 : -1;
+}
+
+/*
+* Function: load_text()
+*   Fills a buffer with len characters of benchmark text: a text file, repeated
+*   as needed, or common English words in random order.
+*   :param const char *text_path: text file (A-Z/ space up to its first newline) or NULL
+*   :param size_t len: characters wanted
+*   :return char*: text (caller frees) or NULL if error (message printed)
+*/
+char* load_text(const char *text_path, size_t len) {
+    char *text = malloc(len + 1);
+    size_t have = 0;
+
+    if (!text) {
+        perror("Error: failed to allocate memory for text");
+        return NULL;
+    }
+    if (text_path) {
+        char *file_text;
+        size_t file_len;
+        if (otp_read_file(text_path, &file_text, &file_len) != OTP_OK || file_len == 0) {
+            fprintf(stderr, "Error: could not read text file '%s'\n", text_path);
+            free(text);
+            return NULL;
+        }
+        for (; have < len; have++) {
+            text[have] = file_text[have % file_len];
+        }
+        free(file_text);
+        return text;
+    }
+    uint32_t seed = 1;
+    size_t word_count = sizeof(common_words) / sizeof(common_words[0]);
+    while (have < len) {
+        seed = seed * 1103515245 + 12345;
+        const char *word = common_words[(seed >> 16) % word_count];
+        for (size_t i = 0; word[i] && have < len; i++) {
+            text[have++] = word[i];
+        }
+        if (have < len) {
+            text[have++] = ' ';
+        }
+    }
+    return text;
+}
+
+/*
+* Function: cpu_seconds()
+*   :return double: user plus system CPU time of this process
+*/
+double cpu_seconds(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+* Function: wall_seconds()
+*   :return double: monotonic clock time
+*/
+double wall_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE                 // O_DIRECT
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <fcntl.h>          // File control options
+#include <sys/types.h>      // Size functions
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <unistd.h>         // File operations
+#include <time.h>           // Clock functions
+#include "otp_cipher.h"     // Encryption/ decryption transforms
+#include "otp_pool.h"       // Cipher thread pool
+
+#define DIRECT_ALIGN 4096                       // O_DIRECT buffer, offset and length alignment
+#define DIRECT_WINDOW (64 * POOL_BLOCK_SIZE)    // Characters transformed per O_DIRECT window
+#define BULK_USAGE "USAGE: %s [-d] [-t threads] [-D] input key output\n"
+
+/*
+Program Name: Offline Bulk Cipher
+Author: Jose Bianchi
+Description: Program is part of encryption/ decryption prgram for converting
+    plaintext data into ciphertext, using a key via the one-time pad-like approach.
+    This specific program encrypts (or with -d decrypts) a file locally, without any
+    server, for archive jobs too large to send through one. The input file and the key
+    are memory mapped; the text up to the first newline is transformed with the
+    servers' cipher by a pool of -t threads (default: number of online CPUs), each taking
+    256KB blocks in turn and checking their characters as they go. The result and a
+    newline are written, like enc_client output, to the output file through a shared
+    mapping, or with -D through O_DIRECT writes of each finished block while later ones
+    are still being transformed, which keeps multi-GB results out of the page cache.
+    Reports characters, elapsed time and throughput in GB/s on stdout.
+*/
+
+static transform_fn cipher;         // encrypt_msg() or decrypt_msg()
+static bool bad_input;              // Set by any thread that finds an invalid character
+
+// Helper function declarations
+int map_text(const char *path, char **map, size_t *map_size, size_t *text_len);
+void checked_transform(char *out, const char *text, size_t len, const char *key_seq);
+int write_mapped(struct cipher_pool *pool, int out_fd, const char *text, const char *key, size_t len);
+int write_direct(struct cipher_pool *pool, int out_fd, const char *text, const char *key, size_t len);
+int write_tail(int out_fd, const char *buffer, size_t len, off_t file_offset);
+int pwrite_all(int fd, const char *buffer, size_t len, off_t file_offset);
+double wall_seconds(void);
+
+int main(int argc, char *argv[]) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool direct = false;
+    int option;
+
+    // Validate input
+    cipher = encrypt_msg;
+    while ((option = getopt(argc, argv, "dt:D")) != -1) {
+        switch (option) {
+            case 'd':
+                cipher = decrypt_msg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'D':
+                direct = true;
+                break;
+            default:
+                fprintf(stderr, BULK_USAGE, argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 3 || threads < 1) {
+        fprintf(stderr, BULK_USAGE, argv[0]);
+        exit(1);
+    }
+    const char *output_path = argv[optind + 2];
+    char *text;
+    char *key;
+    size_t text_map_size;
+    size_t key_map_size;
+    size_t text_len;
+    size_t key_len;
+    if (map_text(argv[optind], &text, &text_map_size, &text_len) < 0 ||
+            map_text(argv[optind + 1], &key, &key_map_size, &key_len) < 0) {
+        exit(1);
+    }
+    // Key sequence must cover the whole message
+    if (key_len < text_len) {
+        fprintf(stderr, "Error: key shorter than message\n");
+        exit(1);
+    }
+    int out_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+    if (out_fd < 0) {
+        perror(errno == EINVAL ? "Error: output file system does not support O_DIRECT"
+                               : "Error: could not create/ open output file");
+        exit(1);
+    }
+    struct cipher_pool *pool = pool_create(threads);
+    if (!pool) {
+        exit(1);
+    }
+    double start = wall_seconds();
+    int status = direct ? write_direct(pool, out_fd, text, key, text_len)
+                        : write_mapped(pool, out_fd, text, key, text_len);
+    if (close(out_fd) < 0) {
+        perror("Error: could not write output file");
+        status = -1;
+    }
+    double elapsed = wall_seconds() - start;
+    pool_destroy(pool);
+    if (status < 0 || bad_input) {
+        if (bad_input) {
+            fprintf(stderr, "Error: input contains bad characters\n");
+        }
+        unlink(output_path);
+        exit(1);
+    }
+    printf("bulk: mode=%s chars=%zu threads=%d output=%s elapsed=%.3fs throughput=%.2fGB/s\n",
+           cipher == encrypt_msg ? "encrypt" : "decrypt", text_len, threads, direct ? "direct" : "mmap",
+           elapsed, elapsed > 0 ? text_len / elapsed / 1e9 : 0.0);
+    munmap(text, text_map_size);
+    munmap(key, key_map_size);
+    return 0;
+}
+
+/*
+* Function: map_text()
+*   Memory maps a text file; its text ends at the first newline or end of file.
+*   Characters are checked later, in parallel, by checked_transform().
+*   :param const char *path: file to map
+*   :param char **map: set to start of mapping
+*   :param size_t *map_size: set to size of mapping
+*   :param size_t *text_len: set to number of text characters before newline
+*   :return int: 0 on success, -1 on error
+*/
+int map_text(const char *path, char **map, size_t *map_size, size_t *text_len) {
+    struct stat file_info;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open file '%s'\n", path);
+        return -1;
+    }
+    if (fstat(fd, &file_info) < 0 || !S_ISREG(file_info.st_mode) || file_info.st_size < 1) {
+        fprintf(stderr, "Error: '%s' is not a non-empty file\n", path);
+        close(fd);
+        return -1;
+    }
+    *map_size = file_info.st_size;
+    *map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*map == MAP_FAILED) {
+        perror("Error: failed to map input file");
+        return -1;
+    }
+    madvise(*map, *map_size, MADV_SEQUENTIAL);
+    char *newline = memchr(*map, '\n', *map_size);
+    *text_len = newline ? (size_t)(newline - *map) : *map_size;
+    return 0;
+}
+
+/*
+* Function: checked_transform()
+*   Pool transform: checks one block of text and key characters, then applies the
+*   cipher. An invalid character is reported through bad_input.
+*   :param char *out: buffer receiving len result characters
+*   :param const char *text: text characters of the block
+*   :param size_t len: number of characters in the block
+*   :param const char *key_seq: key characters of the block
+*/
+void checked_transform(char *out, const char *text, size_t len, const char *key_seq) {
+    if (!cipher_valid(text, len) || !cipher_valid(key_seq, len)) {
+        __atomic_store_n(&bad_input, true, __ATOMIC_RELAXED);
+    }
+    cipher(out, text, len, key_seq);
+}
+
+/*
+* Function: write_mapped()
+*   Transforms the whole text straight into a shared mapping of the output file.
+*   :param struct cipher_pool *pool: idle pool
+*   :param int out_fd: empty output file
+*   :param const char *text: text characters
+*   :param const char *key: key characters (at least len)
+*   :param size_t len: number of text characters
+*   :return int: 0 on success, -1 on error
+*/
+int write_mapped(struct cipher_pool *pool, int out_fd, const char *text, const char *key, size_t len) {
+    size_t offset;
+    size_t block_len;
+
+    if (ftruncate(out_fd, len + 1) < 0) {
+        perror("Error: could not size output file");
+        return -1;
+    }
+    char *out = mmap(NULL, len + 1, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if (out == MAP_FAILED) {
+        perror("Error: failed to map output file");
+        return -1;
+    }
+    // Every thread of the pool works on the file
+    pool_start(pool, POOL_MAX_THREADS, checked_transform, out, text, len, key);
+    while (!__atomic_load_n(&bad_input, __ATOMIC_RELAXED) && pool_next_block(pool, &offset, &block_len));
+    pool_finish(pool);
+    out[len] = '\n';
+    munmap(out, len + 1);
+    return 0;
+}
+
+/*
+* Function: write_direct()
+*   Transforms the text one DIRECT_WINDOW at a time into an aligned buffer and
+*   writes each block with O_DIRECT as soon as it and the blocks before it are
+*   finished, while the pool transforms the rest of the window.
+*   :param struct cipher_pool *pool: idle pool
+*   :param int out_fd: empty output file opened with O_DIRECT
+*   :param const char *text: text characters
+*   :param const char *key: key characters (at least len)
+*   :param size_t len: number of text characters
+*   :return int: 0 on success, -1 on error
+*/
+int write_direct(struct cipher_pool *pool, int out_fd, const char *text, const char *key, size_t len) {
+    void *window;
+    size_t offset;
+    size_t block_len;
+    size_t window_len = 0;
+    int status = 0;
+
+    // Room for the newline after the last block
+    if (posix_memalign(&window, DIRECT_ALIGN, DIRECT_WINDOW + DIRECT_ALIGN) != 0) {
+        perror("Error: failed to allocate output window");
+        return -1;
+    }
+    size_t done = 0;
+    do {
+        window_len = (len - done < DIRECT_WINDOW) ? len - done : DIRECT_WINDOW;
+        pool_start(pool, POOL_MAX_THREADS, checked_transform, window, text + done, window_len, key + done);
+        while (status == 0 && !__atomic_load_n(&bad_input, __ATOMIC_RELAXED) &&
+                pool_next_block(pool, &offset, &block_len)) {
+            // Blocks are aligned except the very last one, written below with the newline
+            if (done + offset + block_len == len) {
+                break;
+            }
+            status = pwrite_all(out_fd, (char *)window + offset, block_len, done + offset);
+        }
+        pool_finish(pool);
+        done += window_len;
+    } while (status == 0 && !__atomic_load_n(&bad_input, __ATOMIC_RELAXED) && done < len);
+    if (status == 0 && !bad_input) {
+        // Last block (or nothing, for empty text) is at offset of the window
+        size_t tail_offset = (len == 0) ? 0 : offset;
+        size_t tail_len = (len == 0) ? 0 : block_len;
+        ((char *)window)[tail_offset + tail_len] = '\n';
+        status = write_tail(out_fd, (char *)window + tail_offset, tail_len + 1, len - tail_len);
+    }
+    free(window);
+    return status;
+}
+
+/*
+* Function: write_tail()
+*   Writes the end of the output: the aligned part with O_DIRECT, the rest (which
+*   O_DIRECT cannot write) with O_DIRECT turned off.
+*   :param int out_fd: output file opened with O_DIRECT
+*   :param const char *buffer: aligned buffer holding the bytes
+*   :param size_t len: number of bytes
+*   :param off_t file_offset: aligned offset of buffer in the file
+*   :return int: 0 on success, -1 on error
+*/
+int write_tail(int out_fd, const char *buffer, size_t len, off_t file_offset) {
+    size_t aligned_len = len & ~(size_t)(DIRECT_ALIGN - 1);
+
+    if (aligned_len > 0 && pwrite_all(out_fd, buffer, aligned_len, file_offset) < 0) {
+        return -1;
+    }
+    if (fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) & ~O_DIRECT) < 0) {
+        perror("Error: could not turn off O_DIRECT");
+        return -1;
+    }
+    return pwrite_all(out_fd, buffer + aligned_len, len - aligned_len, file_offset + aligned_len);
+}
+
+/*
+* Function: pwrite_all()
+*   Writes the whole buffer at file_offset, retrying short writes.
+*   :param int fd: descriptor to write
+*   :param const char *buffer: data to write
+*   :param size_t len: number of bytes to write
+*   :param off_t file_offset: offset in the file
+*   :return int: 0 on success, -1 on error
+*/
+int pwrite_all(int fd, const char *buffer, size_t len, off_t file_offset) {
+    size_t total_written = 0;
+    while (total_written < len) {
+        ssize_t bytes_written = pwrite(fd, buffer + total_written, len - total_written,
+                                       file_offset + total_written);
+        if (bytes_written <= 0) {
+            perror("Error: could not write output file");
+            return -1;
+        }
+        total_written += bytes_written;
+    }
+    return 0;
+}
+
+/*
+* Function: wall_seconds()
+*   :return double: monotonic clock in seconds
+*/
+double wall_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
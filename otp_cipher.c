@@ -0,0 +1,176 @@
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+#include <string.h>         // String functions
+#include <ctype.h>          // Character functions
+#include "otp_cipher.h"
+
+// Cipher characters transformed per vector step
+#define CIPHER_VECTOR 16
+typedef unsigned char cipher_vector __attribute__((vector_size(CIPHER_VECTOR)));
+
+/*
+* Function: encrypt_msg()
+*   Encrypts message using assigned character values and key sequence. Whole blocks
+*   of CIPHER_VECTOR characters are encrypted at once without branches (any character
+*   that is not a capital letter counts as a space, which only differs from the
+*   character loop for text no server accepts), the rest one character at a time.
+*   :param char *cipher_msg: buffer receiving message_len cipher characters
+*   :param const char *message: plaintext message characters
+*   :param size_t message_len: length of message and cipher
+*   :param const char *key_seq: key sequence characters
+*/
+void encrypt_msg(char *cipher_msg, const char *message, size_t message_len, const char *key_seq) {
+    char msg_char;
+    int msg_val;
+    char key_char;
+    int key_val;
+    int cipher_val;
+    char cipher_char;
+    size_t i = 0;
+    for (; i + CIPHER_VECTOR <= message_len; i += CIPHER_VECTOR) {
+        cipher_vector msg_vals;
+        cipher_vector key_vals;
+        memcpy(&msg_vals, message + i, CIPHER_VECTOR);
+        memcpy(&key_vals, key_seq + i, CIPHER_VECTOR);
+        // Capital letters become 0-25, everything else (spaces) 26
+        msg_vals -= 'A';
+        key_vals -= 'A';
+        cipher_vector letters = (cipher_vector)(msg_vals < 26);
+        msg_vals = (msg_vals & letters) | (26 & ~letters);
+        letters = (cipher_vector)(key_vals < 26);
+        key_vals = (key_vals & letters) | (26 & ~letters);
+        // Sum modulo 27, then 26 back to a space
+        cipher_vector cipher_vals = msg_vals + key_vals;
+        cipher_vals -= 27 & (cipher_vector)(cipher_vals > 26);
+        cipher_vector spaces = (cipher_vector)(cipher_vals == 26);
+        cipher_vals = ((cipher_vals + 'A') & ~spaces) | (' ' & spaces);
+        memcpy(cipher_msg + i, &cipher_vals, CIPHER_VECTOR);
+    }
+    for (; i < message_len; i++) { 
+        // Convert message character to int
+        msg_char = message[i];
+        if (isspace(msg_char)) {
+            msg_val = 26;
+        } else {
+            msg_val = msg_char - 'A';
+        }
+        // Convert key_seq character to int
+        key_char = key_seq[i];
+        if (isspace(key_char)) {
+            key_val = 26;
+        } else {
+            key_val = key_char - 'A';
+        }
+        // Sum integer values and get resulting char
+        cipher_val = msg_val + key_val;
+        if (cipher_val > 26) {
+            cipher_val -= 27;
+        }
+        if (cipher_val == 26) {
+            cipher_char = ' ';
+        } else {
+            cipher_char = 'A' + cipher_val;
+        }
+        cipher_msg[i] = cipher_char;
+    }
+}
+
+/*
+* Function: decrypt_msg()
+*   Decrypts message using assigned character values and key sequence. Whole blocks
+*   of CIPHER_VECTOR characters are decrypted at once without branches (any character
+*   that is not a capital letter counts as a space, which only differs from the
+*   character loop for text no server accepts), the rest one character at a time.
+*   :param char *message: buffer receiving cipher_len plaintext characters
+*   :param const char *cipher: cipher message characters
+*   :param size_t cipher_len: length of message and cipher
+*   :param const char *key_seq: key sequence characters
+*/
+void decrypt_msg(char *message, const char *cipher, size_t cipher_len, const char *key_seq) {
+    char msg_char;
+    int msg_val;
+    char key_char;
+    int key_val;
+    int cipher_val;
+    char cipher_char;
+    size_t i = 0;
+    for (; i + CIPHER_VECTOR <= cipher_len; i += CIPHER_VECTOR) {
+        cipher_vector cipher_vals;
+        cipher_vector key_vals;
+        memcpy(&cipher_vals, cipher + i, CIPHER_VECTOR);
+        memcpy(&key_vals, key_seq + i, CIPHER_VECTOR);
+        // Capital letters become 0-25, everything else (spaces) 26
+        cipher_vals -= 'A';
+        key_vals -= 'A';
+        cipher_vector letters = (cipher_vector)(cipher_vals < 26);
+        cipher_vals = (cipher_vals & letters) | (26 & ~letters);
+        letters = (cipher_vector)(key_vals < 26);
+        key_vals = (key_vals & letters) | (26 & ~letters);
+        // Difference modulo 27 (kept unsigned by adding 27 first), then 26 back to a space
+        cipher_vector msg_vals = cipher_vals + 27 - key_vals;
+        msg_vals -= 27 & (cipher_vector)(msg_vals > 26);
+        cipher_vector spaces = (cipher_vector)(msg_vals == 26);
+        msg_vals = ((msg_vals + 'A') & ~spaces) | (' ' & spaces);
+        memcpy(message + i, &msg_vals, CIPHER_VECTOR);
+    }
+    for (; i < cipher_len; i++) { 
+        // Convert cipher character to int
+        cipher_char = cipher[i];
+        if (isspace(cipher_char)) {
+            cipher_val = 26;
+        } else {
+            cipher_val = cipher_char - 'A';
+        }
+        // Convert key_seq character to int
+        key_char = key_seq[i];
+        if (isspace(key_char)) {
+            key_val = 26;
+        } else {
+            key_val = key_char - 'A';
+        }
+        // Subtract integer values and get plaintext char
+        msg_val = cipher_val - key_val;
+        if (msg_val < 0) {
+            msg_val += 27;
+        }
+        if (msg_val == 26) {
+            msg_char = ' ';
+        } else {
+            msg_char = 'A' + msg_val;
+        }
+        message[i] = msg_char;
+    }
+}
+
+/*
+* Function: cipher_valid()
+*   Verifies text contains only valid characters (uppercase letters and whitespace),
+*   like the servers' and clients' checks. Whole blocks of CIPHER_VECTOR characters
+*   are checked at once, with one branch per block.
+*   :param const char *text: characters to check
+*   :param size_t len: number of characters
+*   :return bool: true if every character is valid
+*/
+bool cipher_valid(const char *text, size_t len) {
+    size_t i = 0;
+    for (; i + CIPHER_VECTOR <= len; i += CIPHER_VECTOR) {
+        cipher_vector chars;
+        memcpy(&chars, text + i, CIPHER_VECTOR);
+        // Capital letters, space, or '\t' to '\r' (the other isspace() characters)
+        cipher_vector valid = (cipher_vector)((cipher_vector)(chars - 'A') < 26) |
+                              (cipher_vector)(chars == ' ') |
+                              (cipher_vector)((cipher_vector)(chars - '\t') < 5);
+        uint64_t halves[2];
+        memcpy(halves, &valid, sizeof(halves));
+        if ((halves[0] & halves[1]) != UINT64_MAX) {
+            return false;
+        }
+    }
+    for (; i < len; i++) {
+        if (!(isupper(text[i]) || isspace(text[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+#ifndef OTP_CIPHER_H
+#define OTP_CIPHER_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+
+/*
+Module Name: Cipher
+Author: Jose Bianchi
+Description: The one-time pad transforms over the 27 character alphabet (A-Z and space),
+    shared by the encryption and decryption servers and the offline bulk tool. Both
+    have the signature of a server transform (transform_fn): len result characters are
+    written to out, no terminating character, any whitespace counts as a space.
+*/
+
+void encrypt_msg(char *cipher_msg, const char *message, size_t message_len, const char *key_seq);
+void decrypt_msg(char *message, const char *cipher, size_t cipher_len, const char *key_seq);
+bool cipher_valid(const char *text, size_t len);
+
+#endif
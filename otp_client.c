@@ -0,0 +1,1251 @@
+#define _GNU_SOURCE                 // memfd_create()/ htobe64()
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdarg.h>         // Variable arguments
+#include <stdbool.h>        // Boolean values
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <netinet/in.h>     // Internet/ socket functions
+#include <netinet/tcp.h>    // TCP socket options
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+#include <sys/uio.h>        // Vectored I/O
+#include <fcntl.h>          // File control/ splice functions
+#include <arpa/inet.h>      // Internet functions
+#include <sys/types.h>      // Size functions
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <unistd.h>         // Process management/ file operations
+#include <ctype.h>          // Character functions
+#include <endian.h>         // Byte order conversion
+#include <time.h>           // Sleep/ clock functions
+#include "otp_client.h"
+#include "otp_protocol.h"
+#include "otp_unix.h"
+
+#define STREAM_CHUNK 65536          // Result bytes moved per splice()/ recv() when streaming
+#define RESUME_BACKOFF_MS 100       // First wait before reconnecting a resumable session
+#define RESUME_BACKOFF_MAX_MS 5000
+
+// Helper function declarations
+static void setup_socket(struct sockaddr_in* address, int port_num);
+static int send_all(int socket_fd, const char *buffer, size_t len);
+static int sendv_all(int socket_fd, struct iovec *parts, int part_count);
+static int recv_all(int socket_fd, char *buffer, size_t len);
+static int recv_result(int socket_fd, char *out, size_t len);
+static int send_request(struct otp_conn *conn, const char *key, size_t key_len,
+                        const char *text, size_t text_len);
+static int connect_server(struct otp_conn *conn, enum otp_service service, const char *target,
+                          const char *suffix, struct otp_timing *timing);
+static int connect_keep_alive(struct otp_conn *conn, enum otp_service service, const char *target,
+                              struct otp_timing *timing);
+static int request_buffer(struct otp_conn *conn, const char *key, size_t key_len,
+                          const char *text, size_t text_len, char *out);
+static int request_stream(struct otp_conn *conn, const char *key, size_t key_len,
+                          const char *text, size_t text_len, int out_fd);
+static int session_transfer(struct otp_conn *conn, char *token, const char *key, const char *text,
+                            size_t text_len, int out_fd, size_t *acked, size_t *result_have);
+static int stream_result(int socket_fd, int out_fd, size_t *remaining, struct otp_timing *timing);
+static int splice_result(int socket_fd, int out_fd, size_t *remaining);
+static int write_all_fd(int fd, const char *buffer, size_t len);
+static int request_fds_unix(struct otp_conn *conn, int text_fd, int key_fd, int out_fd);
+static int request_unix_buffers(struct otp_conn *conn, const char *key, size_t key_len,
+                         const char *text, size_t text_len, char *out, int out_fd);
+static void begin_request(struct otp_conn *conn);
+static void json_append(char *buffer, size_t size, size_t *used, const char *format, ...);
+
+/*
+* Function: otp_connect()
+*   Connects to enc_server or dec_server and completes the client ID handshake.
+*   Connection stays open for any number of requests until otp_close().
+*   :param struct otp_conn *conn: connection handle to fill in
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path (contains '/')
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_connect(struct otp_conn *conn, enum otp_service service, const char *target) {
+    return connect_keep_alive(conn, service, target, NULL);
+}
+
+/*
+* Function: otp_connect_timed()
+*   Connects like otp_connect() and records in timing when each stage of the
+*   connection, and later of each request, finished (see enum otp_stage). Each
+*   request clears the stages of the one before, so timing describes the last.
+*   :param struct otp_conn *conn: connection handle to fill in
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path (contains '/')
+*   :param struct otp_timing *timing: started with otp_timing_begin(), filled in until otp_close()
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_connect_timed(struct otp_conn *conn, enum otp_service service, const char *target,
+                      struct otp_timing *timing) {
+    return connect_keep_alive(conn, service, target, timing);
+}
+
+/*
+* Function: connect_keep_alive()
+*   Connects asking the server to keep the connection alive. A TCP server that
+*   predates keep-alive rejects the suffix, so the plain client ID code is sent on
+*   a new connection instead; that server closes it after one request.
+*   :param struct otp_conn *conn: connection handle to fill in
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path (contains '/')
+*   :param struct otp_timing *timing: stages recorded here, or NULL
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int connect_keep_alive(struct otp_conn *conn, enum otp_service service, const char *target,
+                              struct otp_timing *timing) {
+    int result = connect_server(conn, service, target, KEEP_ALIVE_SUFFIX, timing);
+    if (result == OTP_ERR_REJECTED && !conn->is_unix) {
+        result = connect_server(conn, service, target, "", timing);
+    }
+    return result;
+}
+
+/*
+* Function: connect_server()
+*   Connects and completes the client ID handshake, asking a TCP server to keep
+*   the connection alive, to open a resumable session, or (no suffix) for one request.
+*   :param struct otp_conn *conn: connection handle to fill in
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path (contains '/')
+*   :param const char *suffix: KEEP_ALIVE_SUFFIX, RESUME_SUFFIX or "" (TCP only)
+*   :param struct otp_timing *timing: stages recorded here, or NULL
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int connect_server(struct otp_conn *conn, enum otp_service service, const char *target,
+                          const char *suffix, struct otp_timing *timing) {
+    const char *code = (service == OTP_ENCRYPT) ? ENC_CLIENT_CODE : DEC_CLIENT_CODE;
+    const char *reply = (service == OTP_ENCRYPT) ? ENC_ACCEPT_REPLY : DEC_ACCEPT_REPLY;
+    char permitted_code[16];
+    char access_response[10];
+    int result;
+
+    conn->socket_fd = -1;
+    conn->service = service;
+    conn->is_unix = (strchr(target, '/') != NULL);
+    conn->timing = timing;
+    conn->keep_alive = true;
+    if (conn->is_unix) {
+        struct sockaddr_un unix_address;
+        if (setup_unix_socket(&unix_address, target) < 0) {
+            return OTP_ERR_CONNECT;
+        }
+        conn->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (conn->socket_fd < 0) {
+            return OTP_ERR_CONNECT;
+        }
+        result = connect(conn->socket_fd, (struct sockaddr*)&unix_address, sizeof(unix_address));
+        // UNIX listener serves requests until the client closes the connection
+        snprintf(permitted_code, sizeof(permitted_code), "%s", code);
+    } else {
+        struct sockaddr_in server_address;
+        int port_num = atoi(target);
+        if (port_num <= 0) {
+            return OTP_ERR_CONNECT;
+        }
+        conn->socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (conn->socket_fd < 0) {
+            return OTP_ERR_CONNECT;
+        }
+        setup_socket(&server_address, port_num);
+        result = connect(conn->socket_fd, (struct sockaddr*)&server_address, sizeof(server_address));
+        // Requests are written whole, do not hold back the tail waiting for ACKs
+        int no_delay = 1;
+        setsockopt(conn->socket_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        snprintf(permitted_code, sizeof(permitted_code), "%s%s", code, suffix);
+        conn->keep_alive = (strcmp(suffix, KEEP_ALIVE_SUFFIX) == 0);
+    }
+    if (result < 0) {
+        otp_close(conn);
+        return OTP_ERR_CONNECT;
+    }
+    otp_timing_mark(timing, OTP_STAGE_CONNECTED);
+    // Identify self to server and determine if correct server contacted
+    result = send_all(conn->socket_fd, permitted_code, strlen(permitted_code));
+    if (result != OTP_OK) {
+        otp_close(conn);
+        return result;
+    }
+    memset(access_response, '\0', sizeof(access_response));
+    if (recv(conn->socket_fd, access_response, sizeof(access_response) - 1, 0) < 0) {
+        otp_close(conn);
+        return OTP_ERR_IO;
+    }
+    if (strcmp(access_response, reply) != 0) {
+        otp_close(conn);
+        return otp_reply_status(access_response, strlen(access_response));
+    }
+    otp_timing_mark(timing, OTP_STAGE_HANDSHAKE);
+    return OTP_OK;
+}
+
+/*
+* Function: otp_request()
+*   Sends one request (key sequence size, key sequence, text size, text) and
+*   receives text_len result characters into out. Connection can be reused for
+*   further requests when this returns OTP_OK.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param char *out: buffer of at least text_len characters for the result
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_request(struct otp_conn *conn, const char *key, size_t key_len,
+                const char *text, size_t text_len, char *out) {
+    begin_request(conn);
+    if (!otp_valid_text(key, key_len) || !otp_valid_text(text, text_len)) {
+        return OTP_ERR_INPUT;
+    }
+    return request_buffer(conn, key, key_len, text, text_len, out);
+}
+
+/*
+* Function: request_buffer()
+*   Sends one request for otp_request() or otp_request_checked(), after the
+*   caller started its timing and checked its characters.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param char *out: buffer of at least text_len characters for the result
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int request_buffer(struct otp_conn *conn, const char *key, size_t key_len,
+                          const char *text, size_t text_len, char *out) {
+    int result;
+
+    if (key_len < text_len) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    if (conn->is_unix) {
+        result = request_unix_buffers(conn, key, key_len, text, text_len, out, -1);
+        otp_timing_mark(conn->timing, OTP_STAGE_DONE);
+        return result;
+    }
+    result = send_request(conn, key, key_len, text, text_len);
+    // Read response from socket
+    if (result == OTP_OK) {
+        result = recv_result(conn->socket_fd, out, text_len);
+    } else if (result == OTP_ERR_CLOSED) {
+        // Server may have refused the request part way and closed
+        result = recv_result(conn->socket_fd, out, text_len);
+        if (result == OTP_OK) {
+            result = OTP_ERR_CLOSED;
+        }
+    }
+    otp_timing_mark(conn->timing, OTP_STAGE_DONE);
+    return result;
+}
+
+/*
+* Function: otp_request_stream()
+*   Sends one request like otp_request() but writes the result, followed by a
+*   newline, to out_fd as it arrives instead of collecting it in memory. Bytes
+*   are spliced from the socket to out_fd when it is a pipe or regular file, so
+*   memory use does not depend on the result size.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result
+*   :return int: OTP_OK or OTP_ERR_* status (out_fd may hold part of the result on error)
+*/
+int otp_request_stream(struct otp_conn *conn, const char *key, size_t key_len,
+                       const char *text, size_t text_len, int out_fd) {
+    begin_request(conn);
+    if (!otp_valid_text(key, key_len) || !otp_valid_text(text, text_len)) {
+        return OTP_ERR_INPUT;
+    }
+    return request_stream(conn, key, key_len, text, text_len, out_fd);
+}
+
+/*
+* Function: otp_request_checked()
+*   Sends one request like otp_request() (out given) or otp_request_stream()
+*   (out NULL, result to out_fd) for key and text the caller already checked,
+*   e.g. with otp_map_file(), so large inputs are not scanned a second time.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param char *out: buffer of at least text_len characters for the result, or NULL
+*   :param int out_fd: descriptor receiving the result and a newline when out is NULL
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_request_checked(struct otp_conn *conn, const char *key, size_t key_len,
+                        const char *text, size_t text_len, char *out, int out_fd) {
+    begin_request(conn);
+    return out ? request_buffer(conn, key, key_len, text, text_len, out)
+               : request_stream(conn, key, key_len, text, text_len, out_fd);
+}
+
+/*
+* Function: request_stream()
+*   Streams one request for otp_request_stream(), otp_request_checked() and
+*   otp_request_fds(), after the caller started its timing and checked its characters.
+*   :param struct otp_conn *conn: connected handle
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int request_stream(struct otp_conn *conn, const char *key, size_t key_len,
+                          const char *text, size_t text_len, int out_fd) {
+    int result;
+
+    if (key_len < text_len) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    if (conn->is_unix) {
+        // Server writes straight to out_fd, newline included
+        result = request_unix_buffers(conn, key, key_len, text, text_len, NULL, out_fd);
+        otp_timing_mark(conn->timing, OTP_STAGE_DONE);
+        return result;
+    }
+    result = send_request(conn, key, key_len, text, text_len);
+    if (result == OTP_OK || result == OTP_ERR_CLOSED) {
+        size_t remaining = text_len;
+        int stream_status = stream_result(conn->socket_fd, out_fd, &remaining, conn->timing);
+        result = (result == OTP_OK || stream_status != OTP_OK) ? stream_status : result;
+        if (conn->timing) {
+            conn->timing->result_bytes = text_len - remaining;
+        }
+    }
+    if (result == OTP_OK) {
+        result = write_all_fd(out_fd, "\n", 1);
+    }
+    otp_timing_mark(conn->timing, OTP_STAGE_DONE);
+    return result;
+}
+
+/*
+* Function: otp_request_resumable()
+*   Streams one request like otp_request_stream() over its own resumable session
+*   (see otp_protocol.h). When the connection drops, it reconnects and continues
+*   from the input the server has stored and the result already written to
+*   out_fd, so only the bytes in flight are sent again. Waits between attempts
+*   double from RESUME_BACKOFF_MS; attempts that make progress do not count
+*   against max_retries. Only the key characters the text uses are sent. Over a
+*   UNIX socket the request is a plain otp_request_stream(): nothing drops there.
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters (at least text_len)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result and a newline
+*   :param int max_retries: reconnections allowed without progress
+*   :return int: OTP_OK or OTP_ERR_* status of the last attempt
+*/
+int otp_request_resumable(enum otp_service service, const char *target, const char *key, size_t key_len,
+                          const char *text, size_t text_len, int out_fd, int max_retries) {
+    struct otp_conn conn;
+    char token[SESSION_TOKEN_LEN];
+    size_t acked = 0;               // Input characters the server had stored at the last connect
+    size_t last_acked = 0;
+    size_t result_have = 0;
+    long backoff_ms = RESUME_BACKOFF_MS;
+    int result;
+
+    if (!otp_valid_text(key, key_len) || !otp_valid_text(text, text_len)) {
+        return OTP_ERR_INPUT;
+    }
+    if (key_len < text_len) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    if (strchr(target, '/') != NULL) {
+        result = otp_connect(&conn, service, target);
+        if (result == OTP_OK) {
+            result = otp_request_stream(&conn, key, key_len, text, text_len, out_fd);
+            otp_close(&conn);
+        }
+        return result;
+    }
+    memset(token, '0', sizeof(token));
+    for (int retries = 0; ; retries++) {
+        size_t had = result_have;
+        result = connect_server(&conn, service, target, RESUME_SUFFIX, NULL);
+        if (result == OTP_OK) {
+            result = session_transfer(&conn, token, key, text, text_len, out_fd, &acked, &result_have);
+            otp_close(&conn);
+        }
+        if (result == OTP_OK) {
+            return write_all_fd(out_fd, "\n", 1);
+        }
+        if (result == OTP_ERR_SESSION && result_have == 0) {
+            // Session expired before any result arrived: start a new one
+            memset(token, '0', sizeof(token));
+        } else if (result != OTP_ERR_CONNECT && result != OTP_ERR_IO && result != OTP_ERR_CLOSED &&
+                   result != OTP_ERR_TIMEOUT && result != OTP_ERR_BUSY) {
+            return result;
+        }
+        if (result_have > had || acked > last_acked) {
+            last_acked = acked;
+            retries = -1;
+            backoff_ms = RESUME_BACKOFF_MS;
+            continue;
+        }
+        if (retries >= max_retries) {
+            return result;
+        }
+        struct timespec wait = { .tv_sec = backoff_ms / 1000, .tv_nsec = (backoff_ms % 1000) * 1000000L };
+        nanosleep(&wait, NULL);
+        backoff_ms = (backoff_ms * 2 < RESUME_BACKOFF_MAX_MS) ? backoff_ms * 2 : RESUME_BACKOFF_MAX_MS;
+    }
+}
+
+/*
+* Function: otp_request_fds()
+*   Sends one request read from open text and key files and writes the result,
+*   followed by a newline, to out_fd. Files are expected to end with a newline.
+*   Over a UNIX socket connection the descriptors are passed to the server and
+*   no file contents are copied through the socket.
+*   :param struct otp_conn *conn: connected handle
+*   :param int text_fd: descriptor of plaintext or ciphertext file
+*   :param int key_fd: descriptor of key file
+*   :param int out_fd: descriptor receiving the result
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_request_fds(struct otp_conn *conn, int text_fd, int key_fd, int out_fd) {
+    char *key_map;
+    char *text_map;
+    size_t key_map_size;
+    size_t text_map_size;
+    size_t key_len;
+    size_t text_len;
+    int result;
+
+    begin_request(conn);
+    if (conn->is_unix) {
+        // Server reads the files itself: nothing to parse or upload here
+        result = request_fds_unix(conn, text_fd, key_fd, out_fd);
+        otp_timing_mark(conn->timing, OTP_STAGE_DONE);
+        return result;
+    }
+    result = otp_map_file(key_fd, &key_map, &key_map_size, &key_len);
+    if (result != OTP_OK) {
+        return result;
+    }
+    result = otp_map_file(text_fd, &text_map, &text_map_size, &text_len);
+    if (result != OTP_OK) {
+        munmap(key_map, key_map_size);
+        return result;
+    }
+    result = request_stream(conn, key_map, key_len, text_map, text_len, out_fd);
+    munmap(key_map, key_map_size);
+    munmap(text_map, text_map_size);
+    return result;
+}
+
+/*
+* Function: otp_close()
+*   Closes the connection; server ends the client process on its side.
+*   :param struct otp_conn *conn: connection handle
+*/
+void otp_close(struct otp_conn *conn) {
+    if (conn->socket_fd >= 0) {
+        close(conn->socket_fd);
+    }
+    conn->socket_fd = -1;
+}
+
+/*
+* Function: otp_read_file()
+*   Allocates memory for file text and verifies file contains only valid
+*   characters (uppercase letters and space) up to the first newline.
+*   :param const char *filepath: filepath for reading
+*   :param char **buffer: set to text string in memory (caller frees)
+*   :param size_t *len: set to number of text characters
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_read_file(const char *filepath, char **buffer, size_t *len) {
+    FILE *file = fopen(filepath, "r");
+    if (!file) {
+        return OTP_ERR_FILE;
+    }
+    // Get file size
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    if (file_size < 1) {
+        fclose(file);
+        return OTP_ERR_FILE;
+    }
+    rewind(file);
+    // Allocate memory for file text
+    *buffer = malloc(file_size + 1);
+    if (!*buffer) {
+        fclose(file);
+        return OTP_ERR_NOMEM;
+    }
+    // Store file contents
+    size_t file_bytes_read = fread(*buffer, 1, file_size, file);
+    fclose(file);
+    if (file_bytes_read < 1) {
+        free(*buffer);
+        return OTP_ERR_FILE;
+    }
+    (*buffer)[file_bytes_read] = '\0';
+    // Remove the trailing \n
+    *len = strcspn(*buffer, "\n");
+    (*buffer)[*len] = '\0';
+    if (!otp_valid_text(*buffer, *len)) {
+        free(*buffer);
+        return OTP_ERR_INPUT;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: otp_map_file()
+*   Memory maps a text file and verifies it contains only valid characters
+*   up to the first newline character. Caller releases it with munmap(map, map_size).
+*   :param int fd: descriptor of file to map
+*   :param char **map: set to start of mapping
+*   :param size_t *map_size: set to size of mapping
+*   :param size_t *text_len: set to number of text characters before newline
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int otp_map_file(int fd, char **map, size_t *map_size, size_t *text_len) {
+    struct stat file_info;
+
+    if (fstat(fd, &file_info) < 0 || file_info.st_size < 1) {
+        return OTP_ERR_FILE;
+    }
+    *map_size = file_info.st_size;
+    *map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*map == MAP_FAILED) {
+        return OTP_ERR_FILE;
+    }
+    char *newline = memchr(*map, '\n', *map_size);
+    *text_len = newline ? (size_t)(newline - *map) : *map_size;
+    if (!otp_valid_text(*map, *text_len)) {
+        munmap(*map, *map_size);
+        return OTP_ERR_INPUT;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: otp_valid_text()
+*   Verifies text contains only valid characters (uppercase letters and space).
+*   :param const char *text: characters to check
+*   :param size_t len: number of characters
+*   :return bool: true if every character is valid
+*/
+bool otp_valid_text(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!(isupper(text[i]) || isspace(text[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+* Function: otp_strerror()
+*   Describes a status code returned by the library.
+*   :param int status: OTP_OK or OTP_ERR_* status
+*   :return const char*: static description
+*/
+const char* otp_strerror(int status) {
+    switch (status) {
+        case OTP_OK:
+            return "success";
+        case OTP_ERR_INPUT:
+            return "input contains bad characters";
+        case OTP_ERR_KEY_SHORT:
+            return "key is too short";
+        case OTP_ERR_FILE:
+            return "failed to open/ read file";
+        case OTP_ERR_NOMEM:
+            return "failed to allocate memory";
+        case OTP_ERR_CONNECT:
+            return "failed to connect to server";
+        case OTP_ERR_REJECTED:
+            return "server rejected client (wrong server?)";
+        case OTP_ERR_IO:
+            return "failed to read/ write socket";
+        case OTP_ERR_CLOSED:
+            return "server may have closed connection";
+        case OTP_ERR_SERVER:
+            return "server failed to write response";
+        case OTP_ERR_BUSY:
+            return "server busy, request refused";
+        case OTP_ERR_TOO_BIG:
+            return "request over server size limit";
+        case OTP_ERR_TIMEOUT:
+            return "request too slow, cut off by server";
+        case OTP_ERR_FORMAT:
+            return "not a container file or container damaged";
+        case OTP_ERR_RANGE:
+            return "no such record";
+        case OTP_ERR_SESSION:
+            return "session unknown or expired on server";
+        case OTP_ERR_LEDGER:
+            return "pad ledger damaged or made for another key file";
+        case OTP_ERR_CODEC:
+            return "compressed text damaged or not compressed";
+        default:
+            return "unknown error";
+    }
+}
+
+/*
+* Function: otp_reply_status()
+*   Maps a status word sent by the server in place of an access response or
+*   result to a status code. A truncated word (len shorter than the word, as
+*   when the expected result is very short) still matches.
+*   :param const char *reply: reply bytes from the server
+*   :param size_t len: number of reply bytes
+*   :return int: OTP_ERR_* status
+*/
+int otp_reply_status(const char *reply, size_t len) {
+    if (len > 0 && strncmp(reply, BUSY_REPLY, len) == 0) {
+        return OTP_ERR_BUSY;
+    }
+    if (len > 0 && strncmp(reply, TOO_BIG_REPLY, len) == 0) {
+        return OTP_ERR_TOO_BIG;
+    }
+    if (len > 0 && strncmp(reply, KEY_SHORT_REPLY, len) == 0) {
+        return OTP_ERR_KEY_SHORT;
+    }
+    if (len > 0 && strncmp(reply, TIMEOUT_REPLY, len) == 0) {
+        return OTP_ERR_TIMEOUT;
+    }
+    if (len > 0 && strncmp(reply, NO_SESSION_REPLY, len) == 0) {
+        return OTP_ERR_SESSION;
+    }
+    if (len > 0 && strncmp(reply, REJECT_REPLY, len) == 0) {
+        return OTP_ERR_REJECTED;
+    }
+    return (len == 0) ? OTP_ERR_CLOSED : OTP_ERR_REJECTED;
+}
+
+/*
+* Function: otp_server_name()
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :return const char*: name of the server program for the service
+*/
+const char* otp_server_name(enum otp_service service) {
+    return (service == OTP_ENCRYPT) ? "enc_server" : "dec_server";
+}
+
+/*
+* Function: otp_timing_json()
+*   Formats the stages of a timed connection as one line of JSON: how long each
+*   stage took since the stage before it that was reached (in microseconds, null
+*   if not reached), the bytes moved and the upload and receive throughput (MB/s).
+*   The time between the handshake and the request is not part of any stage.
+*   :param const struct otp_timing *timing: stages from otp_connect_timed()
+*   :param int status: OTP_OK or OTP_ERR_* status of the request
+*   :param char *buffer: receives the JSON text (no newline)
+*   :param size_t size: size of buffer
+*   :return int: length of the full JSON text (truncated if not less than size)
+*/
+int otp_timing_json(const struct otp_timing *timing, int status, char *buffer, size_t size) {
+    static const char *stage_names[OTP_STAGE_COUNT] = {
+        [OTP_STAGE_PARSED] = "parse",
+        [OTP_STAGE_CONNECTED] = "connect",
+        [OTP_STAGE_HANDSHAKE] = "handshake",
+        [OTP_STAGE_KEY_SENT] = "upload_key",
+        [OTP_STAGE_TEXT_SENT] = "upload_text",
+        [OTP_STAGE_FIRST_REPLY] = "wait_reply",
+        [OTP_STAGE_DONE] = "receive",
+    };
+    double stage_us[OTP_STAGE_COUNT];
+    uint64_t last_ns = timing->stamp_ns[OTP_STAGE_START];
+    size_t used = 0;
+
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+    // A stage skipped on this path (e.g. the key upload over a UNIX socket) adds to the next one
+    for (int stage = OTP_STAGE_START + 1; stage < OTP_STAGE_COUNT; stage++) {
+        stage_us[stage] = -1;
+        if (timing->stamp_ns[stage] == 0 || stage == OTP_STAGE_REQUEST) {
+            continue;
+        }
+        int previous = stage - 1;
+        while (previous > OTP_STAGE_START && timing->stamp_ns[previous] == 0) {
+            previous--;
+        }
+        if (timing->stamp_ns[previous] != 0) {
+            stage_us[stage] = (timing->stamp_ns[stage] - timing->stamp_ns[previous]) / 1000.0;
+        }
+        if (timing->stamp_ns[stage] > last_ns) {
+            last_ns = timing->stamp_ns[stage];
+        }
+    }
+    json_append(buffer, size, &used, "{\"server\":\"%s\",\"transport\":\"%s\",\"status\":%d,\"error\":\"%s\","
+                "\"key_bytes\":%zu,\"text_bytes\":%zu,\"result_bytes\":%zu,\"stages_us\":{",
+                otp_server_name(timing->service), timing->is_unix ? "unix" : "tcp", status,
+                (status == OTP_OK) ? "" : otp_strerror(status),
+                timing->key_bytes, timing->text_bytes, timing->result_bytes);
+    for (int stage = OTP_STAGE_START + 1; stage < OTP_STAGE_COUNT; stage++) {
+        if (!stage_names[stage]) {
+            continue;
+        }
+        json_append(buffer, size, &used, (stage_us[stage] < 0) ? "%s\"%s\":null" : "%s\"%s\":%.1f",
+                    (stage == OTP_STAGE_START + 1) ? "" : ",", stage_names[stage], stage_us[stage]);
+    }
+    json_append(buffer, size, &used, "},\"total_us\":%.1f,\"throughput_mb_s\":{",
+                (timing->stamp_ns[OTP_STAGE_START] != 0) ? (last_ns - timing->stamp_ns[OTP_STAGE_START]) / 1000.0 : 0.0);
+    // Bytes per microsecond is MB/s
+    const int rate_stages[3] = { OTP_STAGE_KEY_SENT, OTP_STAGE_TEXT_SENT, OTP_STAGE_DONE };
+    const size_t rate_bytes[3] = { timing->key_bytes, timing->text_bytes, timing->result_bytes };
+    for (int i = 0; i < 3; i++) {
+        double us = stage_us[rate_stages[i]];
+        json_append(buffer, size, &used, (us > 0 && rate_bytes[i] > 0) ? "%s\"%s\":%.1f" : "%s\"%s\":null",
+                    (i == 0) ? "" : ",", stage_names[rate_stages[i]], rate_bytes[i] / us);
+    }
+    json_append(buffer, size, &used, "}}");
+    return (int)used;
+}
+
+/*
+* Function: request_fds_unix()
+*   Passes text, key and output descriptors to the server and waits for the
+*   4 byte status code once the server has written the result.
+*   :param struct otp_conn *conn: handle connected over a UNIX socket
+*   :param int text_fd: descriptor of plaintext or ciphertext file
+*   :param int key_fd: descriptor of key file
+*   :param int out_fd: descriptor receiving the result
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int request_fds_unix(struct otp_conn *conn, int text_fd, int key_fd, int out_fd) {
+    int fds[UNIX_FILE_FD_COUNT] = { text_fd, key_fd, out_fd };
+    int nbo_status;
+
+    if (send_fds(conn->socket_fd, UNIX_MODE_FILES, fds, UNIX_FILE_FD_COUNT) < 0) {
+        return OTP_ERR_IO;
+    }
+    // Key and text go together as descriptors
+    otp_timing_mark(conn->timing, OTP_STAGE_TEXT_SENT);
+    // Wait for server to finish writing response
+    int result = recv_all(conn->socket_fd, (char*)&nbo_status, sizeof(nbo_status));
+    if (result != OTP_OK) {
+        return result;
+    }
+    otp_timing_mark(conn->timing, OTP_STAGE_FIRST_REPLY);
+    switch (ntohl(nbo_status)) {
+        case UNIX_STATUS_OK:
+            return OTP_OK;
+        case UNIX_STATUS_BAD_INPUT:
+            return OTP_ERR_INPUT;
+        case UNIX_STATUS_KEY_SHORT:
+            return OTP_ERR_KEY_SHORT;
+        case UNIX_STATUS_TOO_BIG:
+            return OTP_ERR_TOO_BIG;
+        case UNIX_STATUS_BUSY:
+            return OTP_ERR_BUSY;
+        case UNIX_STATUS_TIMEOUT:
+            return OTP_ERR_TIMEOUT;
+        default:
+            return OTP_ERR_SERVER;
+    }
+}
+
+/*
+* Function: request_unix_buffers()
+*   Serves an in-memory request over a UNIX socket connection by placing the
+*   buffers in anonymous memory files, since that listener only takes descriptors.
+*   :param struct otp_conn *conn: handle connected over a UNIX socket
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param char *out: buffer of at least text_len characters for the result (if out_fd < 0)
+*   :param int out_fd: descriptor the server writes the result and newline to, or -1
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int request_unix_buffers(struct otp_conn *conn, const char *key, size_t key_len,
+                         const char *text, size_t text_len, char *out, int out_fd) {
+    int text_fd = memfd_create("otp_text", MFD_CLOEXEC);
+    int key_fd = memfd_create("otp_key", MFD_CLOEXEC);
+    int result_fd = (out_fd >= 0) ? out_fd : memfd_create("otp_out", MFD_CLOEXEC);
+    int result = OTP_ERR_NOMEM;
+
+    if (text_fd >= 0 && key_fd >= 0 && result_fd >= 0 &&
+            write_all_fd(text_fd, text, text_len) == OTP_OK &&
+            write_all_fd(key_fd, key, key_len) == OTP_OK) {
+        result = request_fds_unix(conn, text_fd, key_fd, result_fd);
+        if (result == OTP_OK && out_fd < 0 && pread(result_fd, out, text_len, 0) != (ssize_t)text_len) {
+            result = OTP_ERR_SERVER;
+        }
+    }
+    if (text_fd >= 0) {
+        close(text_fd);
+    }
+    if (key_fd >= 0) {
+        close(key_fd);
+    }
+    if (result_fd >= 0 && out_fd < 0) {
+        close(result_fd);
+    }
+    return result;
+}
+
+/*
+* Function: send_all()
+*   Loops send() until the whole buffer is written to the socket.
+*   :param int socket_fd: connected socket
+*   :param const char *buffer: data to send
+*   :param size_t len: number of bytes to send
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int send_all(int socket_fd, const char *buffer, size_t len) {
+    size_t total_written = 0;
+    while (total_written < len) {
+        ssize_t bytes_written = send(socket_fd, buffer + total_written, len - total_written, MSG_NOSIGNAL);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EPIPE || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+        } else if (bytes_written == 0) {
+            return OTP_ERR_CLOSED;
+        }
+        total_written += bytes_written;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: sendv_all()
+*   Loops sendmsg() until every part is written to the socket, so a request
+*   made of several buffers leaves in as few segments as possible.
+*   :param int socket_fd: connected socket
+*   :param struct iovec *parts: buffers to send (advanced in place)
+*   :param int part_count: number of buffers
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int sendv_all(int socket_fd, struct iovec *parts, int part_count) {
+    struct msghdr header;
+
+    memset(&header, '\0', sizeof(header));
+    header.msg_iov = parts;
+    header.msg_iovlen = part_count;
+    while (header.msg_iovlen > 0) {
+        ssize_t bytes_written = sendmsg(socket_fd, &header, MSG_NOSIGNAL);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EPIPE || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+        } else if (bytes_written == 0) {
+            return OTP_ERR_CLOSED;
+        }
+        // Skip fully written parts and advance into a partly written one
+        while (header.msg_iovlen > 0 && (size_t)bytes_written >= header.msg_iov->iov_len) {
+            bytes_written -= header.msg_iov->iov_len;
+            header.msg_iov++;
+            header.msg_iovlen--;
+        }
+        if (header.msg_iovlen > 0) {
+            header.msg_iov->iov_base = (char*)header.msg_iov->iov_base + bytes_written;
+            header.msg_iov->iov_len -= bytes_written;
+        }
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: recv_all()
+*   Loops recv() until len bytes are read from the socket.
+*   :param int socket_fd: connected socket
+*   :param char *buffer: buffer of at least len bytes
+*   :param size_t len: number of bytes to read
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int recv_all(int socket_fd, char *buffer, size_t len) {
+    size_t total_read = 0;
+    while (total_read < len) {
+        ssize_t bytes_read = recv(socket_fd, buffer + total_read, len - total_read, 0);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+        } else if (bytes_read == 0) {
+            return OTP_ERR_CLOSED;
+        }
+        total_read += bytes_read;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: recv_result()
+*   Reads len result characters. Results only hold uppercase letters and spaces,
+*   so a lowercase first byte is a status word from a server refusing the request;
+*   it is read up to the server closing the connection and mapped to a status.
+*   :param int socket_fd: connected socket
+*   :param char *out: buffer of at least len bytes
+*   :param size_t len: number of result characters expected
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int recv_result(int socket_fd, char *out, size_t len) {
+    char reply[16];
+    size_t reply_len = 0;
+
+    if (len == 0) {
+        return OTP_OK;
+    }
+    ssize_t bytes_read;
+    do {
+        bytes_read = recv(socket_fd, out, 1, 0);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0) {
+        return (bytes_read == 0 || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+    }
+    if (!islower(out[0])) {
+        return recv_all(socket_fd, out + 1, len - 1);
+    }
+    reply[reply_len++] = out[0];
+    while (reply_len < sizeof(reply) - 1 &&
+           (bytes_read = recv(socket_fd, reply + reply_len, sizeof(reply) - 1 - reply_len, 0)) > 0) {
+        reply_len += bytes_read;
+    }
+    return otp_reply_status(reply, reply_len);
+}
+
+/*
+* Function: send_request()
+*   Sends key sequence size, key sequence, text size and text in one call, or
+*   in two (key, then text) on a timed connection so each upload is measured.
+*   :param struct otp_conn *conn: handle connected over TCP
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int send_request(struct otp_conn *conn, const char *key, size_t key_len,
+                        const char *text, size_t text_len) {
+    int nbo_key_len = htonl(key_len);
+    int nbo_text_len = htonl(text_len);
+    struct iovec parts[4] = {
+        { .iov_base = &nbo_key_len, .iov_len = sizeof(nbo_key_len) },
+        { .iov_base = (char*)key, .iov_len = key_len },
+        { .iov_base = &nbo_text_len, .iov_len = sizeof(nbo_text_len) },
+        { .iov_base = (char*)text, .iov_len = text_len },
+    };
+    if (!conn->timing) {
+        return sendv_all(conn->socket_fd, parts, 4);
+    }
+    int result = sendv_all(conn->socket_fd, parts, 2);
+    if (result == OTP_OK) {
+        otp_timing_mark(conn->timing, OTP_STAGE_KEY_SENT);
+        conn->timing->key_bytes = key_len;
+        result = sendv_all(conn->socket_fd, parts + 2, 2);
+    }
+    if (result == OTP_OK) {
+        otp_timing_mark(conn->timing, OTP_STAGE_TEXT_SENT);
+        conn->timing->text_bytes = text_len;
+    }
+    return result;
+}
+
+/*
+* Function: session_transfer()
+*   One connection of a resumable session: sends the session header, then the
+*   input from the offset the server acknowledges, and streams the result from
+*   the offset already written. A new session's token is stored in token.
+*   :param struct otp_conn *conn: handle connected with RESUME_SUFFIX
+*   :param char *token: session token (all '0' for a new session)
+*   :param const char *key: key characters (text_len are sent)
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t text_len: number of text characters
+*   :param int out_fd: descriptor receiving the result
+*   :param size_t *acked: set to the input characters the server had stored
+*   :param size_t *result_have: result characters written so far, advanced as more arrive
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int session_transfer(struct otp_conn *conn, char *token, const char *key, const char *text,
+                            size_t text_len, int out_fd, size_t *acked, size_t *result_have) {
+    char header[SESSION_HEADER_SIZE];
+    uint64_t fields[3] = { htobe64(text_len), htobe64(text_len), htobe64(*result_have) };
+    uint64_t field;
+
+    memcpy(header, token, SESSION_TOKEN_LEN);
+    memcpy(header + SESSION_TOKEN_LEN, fields, sizeof(fields));
+    int result = send_all(conn->socket_fd, header, sizeof(header));
+    if (result != OTP_OK) {
+        return result;
+    }
+    // Reply: token and input stored so far, or a status word
+    result = recv_result(conn->socket_fd, header, SESSION_REPLY_SIZE);
+    if (result != OTP_OK) {
+        return result;
+    }
+    memcpy(&field, header + SESSION_TOKEN_LEN, sizeof(field));
+    uint64_t stored = be64toh(field);
+    if (stored > 2 * (uint64_t)text_len) {
+        return OTP_ERR_SESSION;
+    }
+    memcpy(token, header, SESSION_TOKEN_LEN);
+    *acked = stored;
+    // Input is the key slice followed by the text
+    struct iovec parts[2] = {
+        { .iov_base = (char*)key, .iov_len = text_len },
+        { .iov_base = (char*)text, .iov_len = text_len },
+    };
+    int first_part = 0;
+    if (stored >= text_len) {
+        first_part = 1;
+        stored -= text_len;
+    }
+    parts[first_part].iov_base = (char*)parts[first_part].iov_base + stored;
+    parts[first_part].iov_len -= stored;
+    if (*acked < 2 * (uint64_t)text_len) {
+        result = sendv_all(conn->socket_fd, parts + first_part, 2 - first_part);
+        if (result != OTP_OK) {
+            return result;
+        }
+    }
+    size_t remaining = text_len - *result_have;
+    result = stream_result(conn->socket_fd, out_fd, &remaining, NULL);
+    *result_have = text_len - remaining;
+    return result;
+}
+
+/*
+* Function: stream_result()
+*   Moves len result characters from the socket to out_fd as they arrive. The
+*   first byte is peeked so a status word from a refusing server is never written
+*   out. Uses splice_result() when the kernel can move the bytes without copying
+*   them through user space, otherwise a fixed size buffer.
+*   :param int socket_fd: connected socket
+*   :param int out_fd: descriptor receiving the result
+*   :param size_t *remaining: result characters expected, reduced as they are written
+*   :param struct otp_timing *timing: first reply stage recorded here, or NULL
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int stream_result(int socket_fd, int out_fd, size_t *remaining, struct otp_timing *timing) {
+    char first;
+    ssize_t bytes_read;
+
+    if (*remaining == 0) {
+        return OTP_OK;
+    }
+    do {
+        bytes_read = recv(socket_fd, &first, 1, MSG_PEEK);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0) {
+        return (bytes_read == 0 || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+    }
+    otp_timing_mark(timing, OTP_STAGE_FIRST_REPLY);
+    if (islower(first)) {
+        char reply[16];
+        return recv_result(socket_fd, reply, sizeof(reply));
+    }
+    int result = splice_result(socket_fd, out_fd, remaining);
+    if (result != OTP_OK || *remaining == 0) {
+        return result;
+    }
+    // out_fd cannot take spliced data (terminal, append-only file): copy through a buffer
+    char *chunk = malloc(STREAM_CHUNK);
+    if (!chunk) {
+        return OTP_ERR_NOMEM;
+    }
+    while (*remaining > 0 && result == OTP_OK) {
+        bytes_read = recv(socket_fd, chunk, *remaining < STREAM_CHUNK ? *remaining : STREAM_CHUNK, 0);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes_read <= 0) {
+            result = (bytes_read == 0 || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+        } else {
+            result = write_all_fd(out_fd, chunk, bytes_read);
+            *remaining -= bytes_read;
+        }
+    }
+    free(chunk);
+    return result;
+}
+
+/*
+* Function: splice_result()
+*   Splices result bytes from the socket to out_fd: directly when out_fd is a
+*   pipe, through an intermediate pipe when it is a regular file. Stops without
+*   error, leaving *remaining unchanged, if out_fd does not support splice.
+*   :param int socket_fd: connected socket
+*   :param int out_fd: descriptor receiving the result
+*   :param size_t *remaining: result bytes still expected, reduced as bytes move
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int splice_result(int socket_fd, int out_fd, size_t *remaining) {
+    struct stat out_info;
+    int pipe_fds[2] = { -1, -1 };
+    int result = OTP_OK;
+
+    if (fstat(out_fd, &out_info) < 0) {
+        return OTP_ERR_IO;
+    }
+    bool out_is_pipe = S_ISFIFO(out_info.st_mode);
+    if (!out_is_pipe && (!S_ISREG(out_info.st_mode) || (fcntl(out_fd, F_GETFL) & O_APPEND))) {
+        return OTP_OK;
+    }
+    if (!out_is_pipe && pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        return OTP_OK;
+    }
+    int target = out_is_pipe ? out_fd : pipe_fds[1];
+    while (*remaining > 0 && result == OTP_OK) {
+        size_t want = (*remaining < STREAM_CHUNK) ? *remaining : STREAM_CHUNK;
+        ssize_t moved = splice(socket_fd, NULL, target, NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        } else if (moved < 0 && errno == EINVAL) {
+            // Not supported for these descriptors, nothing was moved
+            break;
+        } else if (moved <= 0) {
+            result = (moved == 0 || errno == ECONNRESET) ? OTP_ERR_CLOSED : OTP_ERR_IO;
+            break;
+        }
+        *remaining -= moved;
+        // Empty the intermediate pipe into the file before the next read
+        while (!out_is_pipe && moved > 0) {
+            ssize_t written = splice(pipe_fds[0], NULL, out_fd, NULL, moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            } else if (written < 0 && errno == EINVAL) {
+                // File system cannot splice: copy what is left in the pipe
+                char chunk[4096];
+                ssize_t bytes_read = read(pipe_fds[0], chunk, sizeof(chunk));
+                if (bytes_read <= 0 || write_all_fd(out_fd, chunk, bytes_read) != OTP_OK) {
+                    result = OTP_ERR_IO;
+                    break;
+                }
+                written = bytes_read;
+            } else if (written <= 0) {
+                result = OTP_ERR_IO;
+                break;
+            }
+            moved -= written;
+        }
+    }
+    if (!out_is_pipe) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+    return result;
+}
+
+/*
+* Function: write_all_fd()
+*   Writes the whole buffer to a descriptor, retrying short writes.
+*   :param int fd: descriptor to write
+*   :param const char *buffer: data to write
+*   :param size_t len: number of bytes to write
+*   :return int: OTP_OK or OTP_ERR_IO
+*/
+static int write_all_fd(int fd, const char *buffer, size_t len) {
+    size_t total_written = 0;
+    while (total_written < len) {
+        ssize_t bytes_written = write(fd, buffer + total_written, len - total_written);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes_written <= 0) {
+            return OTP_ERR_IO;
+        }
+        total_written += bytes_written;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: begin_request()
+*   Starts timing a request on a timed connection, clearing the stages of the
+*   request before it.
+*   :param struct otp_conn *conn: connected handle
+*/
+static void begin_request(struct otp_conn *conn) {
+    if (!conn->timing) {
+        return;
+    }
+    for (int stage = OTP_STAGE_REQUEST; stage < OTP_STAGE_COUNT; stage++) {
+        conn->timing->stamp_ns[stage] = 0;
+    }
+    conn->timing->key_bytes = 0;
+    conn->timing->text_bytes = 0;
+    conn->timing->result_bytes = 0;
+    otp_timing_mark(conn->timing, OTP_STAGE_REQUEST);
+}
+
+/*
+* Function: otp_timing_begin()
+*   Clears timing and records the start of a timed request, before the caller
+*   reads its input and connects with otp_connect_timed().
+*   :param struct otp_timing *timing: stages to fill in
+*   :param enum otp_service service: OTP_ENCRYPT or OTP_DECRYPT
+*   :param const char *target: port number on this host, or UNIX socket path (contains '/')
+*/
+void otp_timing_begin(struct otp_timing *timing, enum otp_service service, const char *target) {
+    memset(timing, '\0', sizeof(struct otp_timing));
+    timing->service = service;
+    timing->is_unix = (strchr(target, '/') != NULL);
+    otp_timing_mark(timing, OTP_STAGE_START);
+}
+
+/*
+* Function: otp_timing_mark()
+*   Records that a stage finished now.
+*   :param struct otp_timing *timing: stages of a timed connection, or NULL (no-op)
+*   :param enum otp_stage stage: stage that finished
+*/
+void otp_timing_mark(struct otp_timing *timing, enum otp_stage stage) {
+    struct timespec now;
+
+    if (!timing) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timing->stamp_ns[stage] = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+* Function: json_append()
+*   Appends formatted text to a buffer, counting the full length even when the
+*   buffer is too small, like snprintf().
+*   :param char *buffer: buffer being filled
+*   :param size_t size: size of buffer
+*   :param size_t *used: length formatted so far, advanced
+*   :param const char *format: printf() format
+*/
+static void json_append(char *buffer, size_t size, size_t *used, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    int written = vsnprintf(buffer + (*used < size ? *used : size),
+                            *used < size ? size - *used : 0, format, args);
+    va_end(args);
+    if (written > 0) {
+        *used += written;
+    }
+}
+
+/*
+* Function: setup_socket()
+*   Sets up a socket address with port_num value.
+*   :param struct sockaddr_in* address: structure for socket address
+*   :param int port_num: port number for socket address
+*/
+static void setup_socket(struct sockaddr_in* address, int port_num) {
+    // Clear out the address struct
+    memset((char*) address, '\0', sizeof(*address));
+
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Convert and store the port number in network byte order
+    address->sin_port = htons(port_num);
+    // Server runs on this host
+    address->sin_addr.s_addr = inet_addr("127.0.0.1");
+}
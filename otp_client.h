@@ -0,0 +1,103 @@
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Client Library (libotpclient)
+Author: Jose Bianchi
+Description: Connection, handshake, send and receive logic for enc_server and
+    dec_server requests, usable in-process on memory buffers. Connection handles
+    are kept open between requests (the server is asked to keep the connection
+    alive), so a caller pays for connect and handshake once; a server that predates
+    keep-alive gets the plain client ID code and serves one request per connection. Functions never exit
+    or print; they return OTP_OK or a negative OTP_ERR_* status code that
+    otp_strerror() describes. A connection opened with otp_connect_timed() records
+    when each stage of the connection and of its last request finished; otp_timing_json() formats the stages.
+    Callers that read and check their input before connecting mark that stage with
+    otp_timing_mark() and send it with otp_request_checked(), so it is not scanned twice.
+*/
+
+// Status codes
+#define OTP_OK 0
+#define OTP_ERR_INPUT -1            // Text or key contains bad characters
+#define OTP_ERR_KEY_SHORT -2        // Key shorter than text
+#define OTP_ERR_FILE -3             // Could not open/ read file
+#define OTP_ERR_NOMEM -4            // Memory allocation failed
+#define OTP_ERR_CONNECT -5          // Could not create socket/ connect
+#define OTP_ERR_REJECTED -6         // Server refused client ID code (wrong server)
+#define OTP_ERR_IO -7               // Socket read/ write failed
+#define OTP_ERR_CLOSED -8           // Server closed connection early
+#define OTP_ERR_SERVER -9           // Server failed to complete descriptor request
+#define OTP_ERR_BUSY -10            // Server refused request: no worker/ memory budget free
+#define OTP_ERR_TOO_BIG -11         // Server refused request: key or text over its size limit
+#define OTP_ERR_TIMEOUT -12         // Server cut request off: a stage missed its deadline
+#define OTP_ERR_FORMAT -13          // File is not a valid ciphertext container
+#define OTP_ERR_RANGE -14           // Record number or key offset out of range
+#define OTP_ERR_SESSION -15         // Resumable session unknown or expired on the server
+#define OTP_ERR_LEDGER -16          // Pad ledger damaged or made for another key file
+#define OTP_ERR_CODEC -17           // Compressed text damaged (or not compressed)
+
+enum otp_service {
+    OTP_ENCRYPT,                    // enc_server
+    OTP_DECRYPT,                    // dec_server
+};
+
+// Stages recorded by a timed connection, in order
+enum otp_stage {
+    OTP_STAGE_START,                // otp_timing_begin() called
+    OTP_STAGE_PARSED,               // Key and text read and checked by the caller, before connecting
+    OTP_STAGE_CONNECTED,            // connect() returned
+    OTP_STAGE_HANDSHAKE,            // Server accepted the client ID code
+    OTP_STAGE_REQUEST,              // Request started
+    OTP_STAGE_KEY_SENT,             // Key size and key written to the socket
+    OTP_STAGE_TEXT_SENT,            // Text size and text written to the socket
+    OTP_STAGE_FIRST_REPLY,          // First result byte (or descriptor status) arrived
+    OTP_STAGE_DONE,                 // Whole result written to the output
+    OTP_STAGE_COUNT,
+};
+
+struct otp_timing {
+    uint64_t stamp_ns[OTP_STAGE_COUNT];  // CLOCK_MONOTONIC time of each stage, 0 if not reached
+    size_t key_bytes;               // Key characters sent through the socket
+    size_t text_bytes;              // Text characters sent through the socket
+    size_t result_bytes;            // Result characters received through the socket
+    enum otp_service service;
+    bool is_unix;
+};
+
+struct otp_conn {
+    int socket_fd;
+    enum otp_service service;
+    bool is_unix;                   // Connected to the server UNIX-domain socket
+    bool keep_alive;                // False if the server closes after one request (older server)
+    struct otp_timing *timing;      // Stages recorded here, NULL if not timed
+};
+
+int otp_connect(struct otp_conn *conn, enum otp_service service, const char *target);
+int otp_connect_timed(struct otp_conn *conn, enum otp_service service, const char *target,
+                      struct otp_timing *timing);
+int otp_request(struct otp_conn *conn, const char *key, size_t key_len,
+                const char *text, size_t text_len, char *out);
+int otp_request_stream(struct otp_conn *conn, const char *key, size_t key_len,
+                       const char *text, size_t text_len, int out_fd);
+int otp_request_checked(struct otp_conn *conn, const char *key, size_t key_len,
+                        const char *text, size_t text_len, char *out, int out_fd);
+int otp_request_resumable(enum otp_service service, const char *target, const char *key, size_t key_len,
+                          const char *text, size_t text_len, int out_fd, int max_retries);
+int otp_request_fds(struct otp_conn *conn, int text_fd, int key_fd, int out_fd);
+void otp_close(struct otp_conn *conn);
+
+int otp_read_file(const char *filepath, char **buffer, size_t *len);
+int otp_map_file(int fd, char **map, size_t *map_size, size_t *text_len);
+bool otp_valid_text(const char *text, size_t len);
+const char* otp_strerror(int status);
+int otp_reply_status(const char *reply, size_t len);
+const char* otp_server_name(enum otp_service service);
+void otp_timing_begin(struct otp_timing *timing, enum otp_service service, const char *target);
+void otp_timing_mark(struct otp_timing *timing, enum otp_stage stage);
+int otp_timing_json(const struct otp_timing *timing, int status, char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,405 @@
+#include <stdlib.h>         // Memory management
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <string.h>         // String functions
+#include <ctype.h>          // Character functions
+#include "otp_codec.h"
+#include "otp_client.h"     // Status codes
+
+#define RADIX 27                    // Output digits are the 27 text characters
+#define CODER_DIGITS 6              // Digits of precision held by the coder (fits 32 bits)
+#define CODER_TOP 387420489U        // RADIX^CODER_DIGITS
+#define CODER_BOTTOM 14348907U      // RADIX^(CODER_DIGITS - 1): range never drops below it
+#define SYMBOLS 28                  // 27 characters and the end-of-text symbol
+#define END_SYMBOL 27
+#define CONTEXTS 27                 // Previous character
+#define START_CONTEXT 26            // Text starts as if after a space
+#define MODEL_STEP 32               // Added to a symbol's count each time it is seen
+#define MODEL_LIMIT 65536           // Counts of a context are halved above this total
+#define PROB_BITS 12                // Coded probabilities are in units of 1/2^PROB_BITS
+#define PROB_SCALE (1 << PROB_BITS)
+#define REBUILD_FIRST 16            // Symbols seen in a context before its first rebuild
+#define REBUILD_MAX 1024            // Longest interval between rebuilds of a context
+
+// English letter/ space frequencies per 1000 characters, A-Z then space
+static const uint16_t english[RADIX] = {
+    65, 12, 22, 33, 102, 18, 16, 49, 57, 1, 6, 33, 20,
+    57, 62, 15, 1, 50, 53, 73, 22, 8, 19, 1, 16, 1, 182,
+};
+
+// Counts adapt on every symbol; coding uses tables rebuilt from them now and then,
+// scaled to PROB_SCALE so coding needs no division and decoding looks symbols up
+struct text_model {
+    uint32_t counts[CONTEXTS][SYMBOLS];
+    uint32_t totals[CONTEXTS];
+    uint32_t until_rebuild[CONTEXTS];
+    uint32_t rebuild_interval[CONTEXTS];
+    uint16_t freqs[CONTEXTS][SYMBOLS];
+    uint16_t starts[CONTEXTS][SYMBOLS + 1];     // Cumulative freqs
+    uint8_t lookup[CONTEXTS][PROB_SCALE];       // Symbol owning each probability unit
+};
+
+struct range_encoder {
+    uint32_t low;
+    uint32_t range;
+    unsigned char *digits;          // Digit values 0-26
+    size_t len;
+    size_t capacity;                // Digits allowed before coding stops paying off
+};
+
+struct range_decoder {
+    uint32_t value;                 // Code value minus low end of the range
+    uint32_t range;
+    const char *digits;
+    size_t len;
+    size_t pos;
+    bool bad;                       // Invalid digit or stream ran past its end
+};
+
+// Helper function declarations
+static struct text_model* model_create(void);
+static void model_update(struct text_model *model, int context, int symbol);
+static void model_rebuild(struct text_model *model, int context);
+static int symbol_of(char c);
+static bool encode_symbol(struct range_encoder *encoder, const struct text_model *model, int context, int symbol);
+static bool put_digit(struct range_encoder *encoder, uint32_t digit);
+static void carry(struct range_encoder *encoder);
+static int decode_symbol(struct range_decoder *decoder, const struct text_model *model, int context);
+static uint32_t next_digit(struct range_decoder *decoder);
+
+/*
+* Function: codec_encode()
+*   Compresses text into coded text (see otp_codec.h). Coded text is at most one
+*   character longer than the text.
+*   :param const char *text: A-Z/ space characters
+*   :param size_t text_len: number of characters
+*   :param char **coded: set to the coded characters (caller frees)
+*   :param size_t *coded_len: set to the number of coded characters
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int codec_encode(const char *text, size_t text_len, char **coded, size_t *coded_len) {
+    struct range_encoder encoder;
+
+    if (!otp_valid_text(text, text_len)) {
+        return OTP_ERR_INPUT;
+    }
+    *coded = malloc(text_len + 1);
+    struct text_model *model = model_create();
+    if (!*coded || !model) {
+        free(*coded);
+        free(model);
+        return OTP_ERR_NOMEM;
+    }
+    // Digits are written after the mode character, and must end up fewer than the text
+    encoder.low = 0;
+    encoder.range = CODER_TOP;
+    encoder.digits = (unsigned char *)*coded + 1;
+    encoder.len = 0;
+    encoder.capacity = (text_len > 0) ? text_len - 1 : 0;
+    bool fits = true;
+    int context = START_CONTEXT;
+    for (size_t i = 0; fits && i < text_len; i++) {
+        int symbol = symbol_of(text[i]);
+        fits = encode_symbol(&encoder, model, context, symbol);
+        model_update(model, context, symbol);
+        context = symbol;
+    }
+    if (fits) {
+        fits = encode_symbol(&encoder, model, context, END_SYMBOL);
+    }
+    free(model);
+    if (fits) {
+        // Shortest ending: one digit picks a value inside the final range, the
+        // decoder reads zeros past the end
+        uint32_t digit = (encoder.low + CODER_BOTTOM - 1) / CODER_BOTTOM;
+        if (digit == RADIX) {
+            carry(&encoder);
+            digit = 0;
+        }
+        fits = put_digit(&encoder, digit);
+    }
+    if (!fits) {
+        (*coded)[0] = CODEC_STORED;
+        for (size_t i = 0; i < text_len; i++) {
+            (*coded)[i + 1] = isspace(text[i]) ? ' ' : text[i];
+        }
+        *coded_len = text_len + 1;
+        return OTP_OK;
+    }
+    (*coded)[0] = CODEC_CODED;
+    for (size_t i = 0; i < encoder.len; i++) {
+        encoder.digits[i] = (encoder.digits[i] == 26) ? ' ' : 'A' + encoder.digits[i];
+    }
+    *coded_len = encoder.len + 1;
+    return OTP_OK;
+}
+
+/*
+* Function: codec_decode()
+*   Restores the text of coded text made by codec_encode().
+*   :param const char *coded: coded characters
+*   :param size_t coded_len: number of coded characters
+*   :param char **text: set to the text characters (caller frees)
+*   :param size_t *text_len: set to the number of text characters
+*   :return int: OTP_OK or OTP_ERR_* status (OTP_ERR_CODEC for damaged coded text)
+*/
+int codec_decode(const char *coded, size_t coded_len, char **text, size_t *text_len) {
+    struct range_decoder decoder;
+
+    if (coded_len == 0 || (coded[0] != CODEC_CODED && coded[0] != CODEC_STORED)) {
+        return OTP_ERR_CODEC;
+    }
+    if (coded[0] == CODEC_STORED) {
+        *text = malloc(coded_len);
+        if (!*text) {
+            return OTP_ERR_NOMEM;
+        }
+        *text_len = coded_len - 1;
+        memcpy(*text, coded + 1, *text_len);
+        return OTP_OK;
+    }
+    size_t capacity = 2 * coded_len + 64;
+    *text = malloc(capacity);
+    struct text_model *model = model_create();
+    if (!*text || !model) {
+        free(*text);
+        free(model);
+        return OTP_ERR_NOMEM;
+    }
+    decoder.digits = coded + 1;
+    decoder.len = coded_len - 1;
+    decoder.pos = 0;
+    decoder.bad = false;
+    decoder.range = CODER_TOP;
+    decoder.value = 0;
+    for (int i = 0; i < CODER_DIGITS; i++) {
+        decoder.value = decoder.value * RADIX + next_digit(&decoder);
+    }
+    size_t len = 0;
+    int context = START_CONTEXT;
+    while (!decoder.bad) {
+        int symbol = decode_symbol(&decoder, model, context);
+        if (symbol == END_SYMBOL) {
+            break;
+        }
+        if (len == capacity) {
+            capacity *= 2;
+            char *grown = realloc(*text, capacity);
+            if (!grown) {
+                free(*text);
+                free(model);
+                return OTP_ERR_NOMEM;
+            }
+            *text = grown;
+        }
+        (*text)[len++] = (symbol == 26) ? ' ' : 'A' + symbol;
+        model_update(model, context, symbol);
+        context = symbol;
+    }
+    free(model);
+    if (decoder.bad) {
+        free(*text);
+        return OTP_ERR_CODEC;
+    }
+    *text_len = len;
+    return OTP_OK;
+}
+
+/*
+* Function: model_create()
+*   Starts every context from English letter frequencies, so short messages
+*   already code well. The end-of-text symbol keeps the smallest count.
+*   :return struct text_model*: new model (caller frees) or NULL if out of memory
+*/
+static struct text_model* model_create(void) {
+    struct text_model *model = malloc(sizeof(struct text_model));
+
+    for (int context = 0; model && context < CONTEXTS; context++) {
+        model->totals[context] = 1;
+        model->counts[context][END_SYMBOL] = 1;
+        for (int symbol = 0; symbol < RADIX; symbol++) {
+            model->counts[context][symbol] = 1 + english[symbol] / 8;
+            model->totals[context] += model->counts[context][symbol];
+        }
+        model->rebuild_interval[context] = REBUILD_FIRST;
+        model_rebuild(model, context);
+    }
+    return model;
+}
+
+/*
+* Function: model_update()
+*   Counts a symbol seen in a context, halving the context's counts when their
+*   total gets too large, so the model follows changes in the text.
+*   :param struct text_model *model: model to update
+*   :param int context: previous symbol
+*   :param int symbol: symbol seen
+*/
+static void model_update(struct text_model *model, int context, int symbol) {
+    uint32_t *counts = model->counts[context];
+
+    counts[symbol] += MODEL_STEP;
+    model->totals[context] += MODEL_STEP;
+    if (model->totals[context] > MODEL_LIMIT) {
+        model->totals[context] = counts[END_SYMBOL];
+        for (int i = 0; i < RADIX; i++) {
+            counts[i] = (counts[i] + 1) / 2;
+            model->totals[context] += counts[i];
+        }
+    }
+    // Rebuilds get rarer as the context's statistics settle
+    if (--model->until_rebuild[context] == 0) {
+        if (model->rebuild_interval[context] < REBUILD_MAX) {
+            model->rebuild_interval[context] *= 2;
+        }
+        model_rebuild(model, context);
+    }
+}
+
+/*
+* Function: model_rebuild()
+*   Scales a context's counts to coding frequencies summing to PROB_SCALE, every
+*   symbol keeping at least 1, and refills its decoding lookup table.
+*   :param struct text_model *model: model to update
+*   :param int context: context to rebuild
+*/
+static void model_rebuild(struct text_model *model, int context) {
+    const uint32_t *counts = model->counts[context];
+    uint16_t *freqs = model->freqs[context];
+    uint16_t *starts = model->starts[context];
+    uint32_t sum = 0;
+    int largest = 0;
+
+    for (int i = 0; i < SYMBOLS; i++) {
+        freqs[i] = 1 + (uint64_t)counts[i] * (PROB_SCALE - SYMBOLS) / model->totals[context];
+        sum += freqs[i];
+        largest = (counts[i] > counts[largest]) ? i : largest;
+    }
+    // Rounding leftovers go to the most likely symbol
+    freqs[largest] += PROB_SCALE - sum;
+    starts[0] = 0;
+    for (int i = 0; i < SYMBOLS; i++) {
+        starts[i + 1] = starts[i] + freqs[i];
+        memset(&model->lookup[context][starts[i]], i, freqs[i]);
+    }
+    model->until_rebuild[context] = model->rebuild_interval[context];
+}
+
+/*
+* Function: symbol_of()
+*   :param char c: A-Z or whitespace character
+*   :return int: symbol value 0-26
+*/
+static int symbol_of(char c) {
+    return isspace(c) ? 26 : c - 'A';
+}
+
+/*
+* Function: encode_symbol()
+*   Narrows the coder range to the symbol's share and writes the digits that
+*   can no longer change.
+*   :param struct range_encoder *encoder: coder state
+*   :param const struct text_model *model: current model
+*   :param int context: previous symbol
+*   :param int symbol: symbol to code
+*   :return bool: false once the digits would not fit in the capacity
+*/
+static bool encode_symbol(struct range_encoder *encoder, const struct text_model *model, int context, int symbol) {
+    uint32_t step = encoder->range >> PROB_BITS;
+
+    encoder->low += step * model->starts[context][symbol];
+    encoder->range = step * model->freqs[context][symbol];
+    if (encoder->low >= CODER_TOP) {
+        encoder->low -= CODER_TOP;
+        carry(encoder);
+    }
+    while (encoder->range < CODER_BOTTOM) {
+        if (!put_digit(encoder, encoder->low / CODER_BOTTOM)) {
+            return false;
+        }
+        encoder->low = (encoder->low % CODER_BOTTOM) * RADIX;
+        encoder->range *= RADIX;
+    }
+    return true;
+}
+
+/*
+* Function: put_digit()
+*   :param struct range_encoder *encoder: coder state
+*   :param uint32_t digit: digit value 0-26
+*   :return bool: false if the capacity is used up
+*/
+static bool put_digit(struct range_encoder *encoder, uint32_t digit) {
+    if (encoder->len == encoder->capacity) {
+        return false;
+    }
+    encoder->digits[encoder->len++] = (unsigned char)digit;
+    return true;
+}
+
+/*
+* Function: carry()
+*   Adds one to the digits already written (low end of the range overflowed).
+*   :param struct range_encoder *encoder: coder state
+*/
+static void carry(struct range_encoder *encoder) {
+    for (size_t i = encoder->len; i > 0; i--) {
+        if (encoder->digits[i - 1] < RADIX - 1) {
+            encoder->digits[i - 1]++;
+            return;
+        }
+        encoder->digits[i - 1] = 0;
+    }
+}
+
+/*
+* Function: decode_symbol()
+*   Finds the symbol whose share of the range holds the code value and narrows
+*   the range to it, as encode_symbol() did.
+*   :param struct range_decoder *decoder: decoder state
+*   :param const struct text_model *model: current model
+*   :param int context: previous symbol
+*   :return int: symbol, END_SYMBOL also when the stream is damaged
+*/
+static int decode_symbol(struct range_decoder *decoder, const struct text_model *model, int context) {
+    uint32_t step = decoder->range >> PROB_BITS;
+    uint32_t target = decoder->value / step;
+
+    if (target >= PROB_SCALE) {
+        decoder->bad = true;
+        return END_SYMBOL;
+    }
+    int symbol = model->lookup[context][target];
+    decoder->value -= step * model->starts[context][symbol];
+    decoder->range = step * model->freqs[context][symbol];
+    while (decoder->range < CODER_BOTTOM) {
+        decoder->value = decoder->value * RADIX + next_digit(decoder);
+        decoder->range *= RADIX;
+    }
+    return symbol;
+}
+
+/*
+* Function: next_digit()
+*   Reads the next digit; past the end of the stream digits are zero. A stream
+*   read far past its end never had an end-of-text symbol.
+*   :param struct range_decoder *decoder: decoder state
+*   :return uint32_t: digit value 0-26
+*/
+static uint32_t next_digit(struct range_decoder *decoder) {
+    size_t pos = decoder->pos++;
+
+    if (pos >= decoder->len) {
+        decoder->bad |= (pos > decoder->len + CODER_DIGITS);
+        return 0;
+    }
+    char c = decoder->digits[pos];
+    if (c == ' ') {
+        return 26;
+    }
+    if (c < 'A' || c > 'Z') {
+        decoder->bad = true;
+        return 0;
+    }
+    return c - 'A';
+}
@@ -0,0 +1,27 @@
+#ifndef OTP_CODEC_H
+#define OTP_CODEC_H
+
+#include <stddef.h>         // Size types
+
+/*
+Module Name: Text Compression (libotpclient)
+Author: Jose Bianchi
+Description: Entropy coder for A-Z/ space text whose output is again A-Z/ space text,
+    so a message can be compressed before encryption and every character saved is a
+    pad character not used and a byte not sent. An arithmetic (range) coder writes
+    base-27 digits; its model is adaptive order-1 (the previous character predicts the
+    next), starting from English letter frequencies, so English-like text codes at
+    roughly 3.3 bits per character instead of 4.75 while any other text adapts. The
+    first character of coded text tells how the rest is stored:
+        CODEC_CODED  range coder digits, ending in a coded end-of-text symbol
+        CODEC_STORED the text unchanged, used when coding would not make it shorter
+    Any whitespace character codes as a space, as in the cipher.
+*/
+
+#define CODEC_CODED 'C'
+#define CODEC_STORED 'S'
+
+int codec_encode(const char *text, size_t text_len, char **coded, size_t *coded_len);
+int codec_decode(const char *coded, size_t coded_len, char **text, size_t *text_len);
+
+#endif
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE                 // be64toh()/ htobe64()
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <endian.h>         // Byte order conversion
+#include <fcntl.h>          // File control functions
+#include <sys/file.h>       // File locking
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <unistd.h>         // Process management/ file operations
+#include "otp_container.h"
+#include "otp_client.h"     // Status codes
+
+#define INDEX_ENTRY_SIZE 24         // Three uint64 per record
+#define TRAILER_SIZE (16 + CONTAINER_MAGIC_LEN)
+
+// Helper function declarations
+static int read_index(struct otp_container *container, int fd, uint64_t size, bool journal);
+static int write_index(struct otp_container *container, int fd, uint64_t position);
+static int recover_journal(struct otp_container *container, int result, uint64_t file_size);
+static int sync_parent(const char *path);
+
+/*
+* Function: container_open()
+*   Opens a container and loads its index. Opened writable, a missing or empty
+*   file becomes an empty container and an exclusive lock is held until
+*   container_close(), so appends from several clients do not interleave. An
+*   append left unfinished is rolled back through its journal.
+*   :param struct otp_container *container: handle to fill in
+*   :param const char *path: container file path
+*   :param bool writable: open for appending
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int container_open(struct otp_container *container, const char *path, bool writable) {
+    struct stat file_info;
+
+    memset(container, '\0', sizeof(*container));
+    container->fd = -1;
+    container->writable = writable;
+    container->journal_path = malloc(strlen(path) + sizeof(CONTAINER_JOURNAL_SUFFIX));
+    if (!container->journal_path) {
+        return OTP_ERR_NOMEM;
+    }
+    sprintf(container->journal_path, "%s%s", path, CONTAINER_JOURNAL_SUFFIX);
+    container->fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (container->fd < 0) {
+        container_close(container);
+        return OTP_ERR_FILE;
+    }
+    if (flock(container->fd, writable ? LOCK_EX : LOCK_SH) < 0 || fstat(container->fd, &file_info) < 0) {
+        container_close(container);
+        return OTP_ERR_FILE;
+    }
+    int result;
+    if (file_info.st_size == 0 && writable) {
+        // New container: header and an empty index
+        container->index_offset = CONTAINER_MAGIC_LEN;
+        result = (pwrite(container->fd, CONTAINER_MAGIC, CONTAINER_MAGIC_LEN, 0) == CONTAINER_MAGIC_LEN)
+                 ? write_index(container, container->fd, container->index_offset) : OTP_ERR_FILE;
+    } else {
+        result = read_index(container, container->fd, file_info.st_size, false);
+    }
+    result = recover_journal(container, result, file_info.st_size);
+    if (result != OTP_OK) {
+        container_close(container);
+    }
+    return result;
+}
+
+/*
+* Function: container_map()
+*   Maps the record area read-only so records can be read by pointer.
+*   :param struct otp_container *container: open container
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int container_map(struct otp_container *container) {
+    container->map_size = container->index_offset;
+    container->map = mmap(NULL, container->map_size, PROT_READ, MAP_SHARED, container->fd, 0);
+    if (container->map == MAP_FAILED) {
+        container->map = NULL;
+        return OTP_ERR_FILE;
+    }
+    // Records are usually read front to back by one or more connections
+    madvise(container->map, container->map_size, MADV_WILLNEED);
+    return OTP_OK;
+}
+
+/*
+* Function: container_record_text()
+*   :param const struct otp_container *container: mapped container
+*   :param uint64_t record: record number (0 = first)
+*   :return const char*: first ciphertext character of the record
+*/
+const char* container_record_text(const struct otp_container *container, uint64_t record) {
+    return container->map + container->records[record].offset;
+}
+
+/*
+* Function: container_next_key_offset()
+*   First key character not used by any record in the container.
+*   :param const struct otp_container *container: open container
+*   :return uint64_t: key offset for the next record
+*/
+uint64_t container_next_key_offset(const struct otp_container *container) {
+    uint64_t next = 0;
+    for (uint64_t i = 0; i < container->record_count; i++) {
+        uint64_t end = container->records[i].key_offset + container->records[i].length;
+        if (end > next) {
+            next = end;
+        }
+    }
+    return next;
+}
+
+/*
+* Function: container_append_begin()
+*   Saves the index to the journal, then positions the container descriptor where
+*   the next record goes (over the old index). The caller writes the ciphertext and
+*   a newline to container->fd, then calls container_append_end(), or
+*   container_append_abort() on failure.
+*   :param struct otp_container *container: container opened writable
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int container_append_begin(struct otp_container *container) {
+    if (!container->writable) {
+        return OTP_ERR_FILE;
+    }
+    // Journal must be on disk before the index it saves is overwritten
+    int journal_fd = open(container->journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (journal_fd < 0) {
+        return OTP_ERR_FILE;
+    }
+    int result = write_index(container, journal_fd, 0);
+    if (result == OTP_OK && fsync(journal_fd) < 0) {
+        result = OTP_ERR_FILE;
+    }
+    close(journal_fd);
+    if (result == OTP_OK) {
+        result = sync_parent(container->journal_path);
+    }
+    if (result != OTP_OK) {
+        unlink(container->journal_path);
+        return result;
+    }
+    if (ftruncate(container->fd, container->index_offset) < 0 ||
+            lseek(container->fd, container->index_offset, SEEK_SET) < 0) {
+        return OTP_ERR_FILE;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: container_append_end()
+*   Adds the record just written to the index, writes index and trailer and
+*   removes the journal once they are synced.
+*   :param struct otp_container *container: container with a record written
+*   :param uint64_t length: ciphertext characters in the record
+*   :param uint64_t key_offset: offset of the record's first key character
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int container_append_end(struct otp_container *container, uint64_t length, uint64_t key_offset) {
+    struct stat file_info;
+
+    // Record must be exactly the ciphertext and its newline
+    if (fstat(container->fd, &file_info) < 0 ||
+            (uint64_t)file_info.st_size != container->index_offset + length + 1) {
+        container_append_abort(container);
+        return OTP_ERR_FILE;
+    }
+    // Record must be on disk before an index points at it
+    if (fdatasync(container->fd) < 0) {
+        container_append_abort(container);
+        return OTP_ERR_FILE;
+    }
+    struct container_record *records = realloc(container->records,
+                                               (container->record_count + 1) * sizeof(struct container_record));
+    if (!records) {
+        container_append_abort(container);
+        return OTP_ERR_NOMEM;
+    }
+    container->records = records;
+    records[container->record_count].offset = container->index_offset;
+    records[container->record_count].length = length;
+    records[container->record_count].key_offset = key_offset;
+    container->record_count++;
+    container->index_offset += length + 1;
+    int result = write_index(container, container->fd, container->index_offset);
+    if (result == OTP_OK && fdatasync(container->fd) < 0) {
+        result = OTP_ERR_FILE;
+    }
+    if (result == OTP_OK) {
+        unlink(container->journal_path);
+    }
+    return result;
+}
+
+/*
+* Function: container_append_abort()
+*   Drops a partly written record and restores the previous index. The journal
+*   is kept if that fails, so the next open can restore it.
+*   :param struct otp_container *container: container an append failed on
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int container_append_abort(struct otp_container *container) {
+    if (ftruncate(container->fd, container->index_offset) < 0) {
+        return OTP_ERR_FILE;
+    }
+    int result = write_index(container, container->fd, container->index_offset);
+    if (result == OTP_OK && fdatasync(container->fd) < 0) {
+        result = OTP_ERR_FILE;
+    }
+    if (result == OTP_OK) {
+        unlink(container->journal_path);
+    }
+    return result;
+}
+
+/*
+* Function: container_close()
+*   Unmaps records, releases the lock and closes the file.
+*   :param struct otp_container *container: open container
+*/
+void container_close(struct otp_container *container) {
+    if (container->map) {
+        munmap(container->map, container->map_size);
+        container->map = NULL;
+    }
+    free(container->records);
+    container->records = NULL;
+    if (container->fd >= 0) {
+        close(container->fd);
+        container->fd = -1;
+    }
+    free(container->journal_path);
+    container->journal_path = NULL;
+}
+
+/*
+* Function: read_index()
+*   Validates header and trailer and loads the index into host byte order, from
+*   the container or from its journal (which holds only index and trailer).
+*   :param struct otp_container *container: container with fd open
+*   :param int fd: container or journal descriptor
+*   :param uint64_t size: size of that file
+*   :param bool journal: true if fd is the journal
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int read_index(struct otp_container *container, int fd, uint64_t size, bool journal) {
+    char magic[CONTAINER_MAGIC_LEN];
+    unsigned char trailer[TRAILER_SIZE];
+    uint64_t field;
+
+    if (pread(container->fd, magic, CONTAINER_MAGIC_LEN, 0) != CONTAINER_MAGIC_LEN ||
+            memcmp(magic, CONTAINER_MAGIC, CONTAINER_MAGIC_LEN) != 0 ||
+            size < (journal ? 0 : CONTAINER_MAGIC_LEN) + TRAILER_SIZE ||
+            pread(fd, trailer, TRAILER_SIZE, size - TRAILER_SIZE) != TRAILER_SIZE ||
+            memcmp(trailer + 16, CONTAINER_INDEX_MAGIC, CONTAINER_MAGIC_LEN) != 0) {
+        return OTP_ERR_FORMAT;
+    }
+    memcpy(&field, trailer, sizeof(field));
+    container->index_offset = be64toh(field);
+    memcpy(&field, trailer + 8, sizeof(field));
+    container->record_count = be64toh(field);
+    // Index must fill the space between records (or journal start) and trailer exactly
+    uint64_t index_start = journal ? 0 : container->index_offset;
+    if (container->index_offset < CONTAINER_MAGIC_LEN ||
+            container->record_count > (size - TRAILER_SIZE) / INDEX_ENTRY_SIZE ||
+            index_start + container->record_count * INDEX_ENTRY_SIZE + TRAILER_SIZE != size) {
+        return OTP_ERR_FORMAT;
+    }
+    size_t index_size = container->record_count * INDEX_ENTRY_SIZE;
+    uint64_t *entries = malloc(index_size + 1);
+    container->records = malloc(container->record_count * sizeof(struct container_record) + 1);
+    if (!entries || !container->records) {
+        free(entries);
+        return OTP_ERR_NOMEM;
+    }
+    if (pread(fd, entries, index_size, index_start) != (ssize_t)index_size) {
+        free(entries);
+        return OTP_ERR_FILE;
+    }
+    for (uint64_t i = 0; i < container->record_count; i++) {
+        struct container_record *record = &container->records[i];
+        record->offset = be64toh(entries[i * 3]);
+        record->length = be64toh(entries[i * 3 + 1]);
+        record->key_offset = be64toh(entries[i * 3 + 2]);
+        if (record->offset < CONTAINER_MAGIC_LEN || record->length > container->index_offset ||
+                record->offset > container->index_offset - record->length) {
+            free(entries);
+            return OTP_ERR_FORMAT;
+        }
+    }
+    free(entries);
+    return OTP_OK;
+}
+
+/*
+* Function: write_index()
+*   Writes index and trailer at position and cuts the file after them.
+*   :param struct otp_container *container: container opened writable
+*   :param int fd: container (position = index_offset) or journal (position = 0)
+*   :param uint64_t position: where the index goes in that file
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int write_index(struct otp_container *container, int fd, uint64_t position) {
+    size_t index_size = container->record_count * INDEX_ENTRY_SIZE;
+    unsigned char *buffer = malloc(index_size + TRAILER_SIZE);
+    if (!buffer) {
+        return OTP_ERR_NOMEM;
+    }
+    uint64_t *entries = (uint64_t *)buffer;
+    for (uint64_t i = 0; i < container->record_count; i++) {
+        entries[i * 3] = htobe64(container->records[i].offset);
+        entries[i * 3 + 1] = htobe64(container->records[i].length);
+        entries[i * 3 + 2] = htobe64(container->records[i].key_offset);
+    }
+    uint64_t field = htobe64(container->index_offset);
+    memcpy(buffer + index_size, &field, sizeof(field));
+    field = htobe64(container->record_count);
+    memcpy(buffer + index_size + 8, &field, sizeof(field));
+    memcpy(buffer + index_size + 16, CONTAINER_INDEX_MAGIC, CONTAINER_MAGIC_LEN);
+    size_t total = index_size + TRAILER_SIZE;
+    int result = OTP_OK;
+    if (pwrite(fd, buffer, total, position) != (ssize_t)total || ftruncate(fd, position + total) < 0) {
+        result = OTP_ERR_FILE;
+    }
+    free(buffer);
+    return result;
+}
+
+/*
+* Function: recover_journal()
+*   Deals with a journal left by a writer that died mid-append. If the container
+*   index is intact the append finished and the journal is stale; otherwise the
+*   saved index is used, and written back when the container is writable.
+*   :param struct otp_container *container: container with fd open
+*   :param int result: status of reading the container's own index
+*   :param uint64_t file_size: size of the container file
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int recover_journal(struct otp_container *container, int result, uint64_t file_size) {
+    struct stat journal_info;
+
+    int journal_fd = open(container->journal_path, O_RDONLY | O_CLOEXEC);
+    if (journal_fd < 0) {
+        return result;
+    }
+    if (result != OTP_ERR_FORMAT) {
+        close(journal_fd);
+        if (result == OTP_OK && container->writable) {
+            unlink(container->journal_path);
+        }
+        return result;
+    }
+    free(container->records);
+    container->records = NULL;
+    result = (fstat(journal_fd, &journal_info) < 0) ? OTP_ERR_FILE
+             : read_index(container, journal_fd, journal_info.st_size, true);
+    close(journal_fd);
+    // Records the saved index covers were never overwritten
+    if (result == OTP_OK && container->index_offset > file_size) {
+        result = OTP_ERR_FORMAT;
+    }
+    if (result == OTP_OK && container->writable) {
+        result = write_index(container, container->fd, container->index_offset);
+        if (result == OTP_OK && fdatasync(container->fd) < 0) {
+            result = OTP_ERR_FILE;
+        }
+        if (result == OTP_OK) {
+            unlink(container->journal_path);
+        }
+    }
+    return result;
+}
+
+/*
+* Function: sync_parent()
+*   Syncs the directory holding path, so a file just created there survives a crash.
+*   :param const char *path: file path
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+static int sync_parent(const char *path) {
+    char *dir_path = strdup(path);
+    if (!dir_path) {
+        return OTP_ERR_NOMEM;
+    }
+    char *slash = strrchr(dir_path, '/');
+    if (slash) {
+        slash[slash == dir_path ? 1 : 0] = '\0';
+    }
+    int dir_fd = open(slash ? dir_path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(dir_path);
+    if (dir_fd < 0) {
+        return OTP_ERR_FILE;
+    }
+    int result = (fsync(dir_fd) < 0) ? OTP_ERR_FILE : OTP_OK;
+    close(dir_fd);
+    return result;
+}
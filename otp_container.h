@@ -0,0 +1,59 @@
+#ifndef OTP_CONTAINER_H
+#define OTP_CONTAINER_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Ciphertext Container (libotpclient)
+Author: Jose Bianchi
+Description: File holding many encrypted records with an index, so one record can
+    be decrypted without reading the rest. Layout:
+        header   CONTAINER_MAGIC (8 bytes)
+        records  ciphertext characters of each record followed by a newline
+        index    one entry per record: offset, length, key offset (big-endian uint64)
+        trailer  index offset, record count (big-endian uint64), CONTAINER_INDEX_MAGIC
+    The key offset is where the record's key characters start in the key file.
+    Appending writes the new record over the old index and rewrites index and
+    trailer after it, under an exclusive flock(). The old index and trailer are first
+    saved to a journal file (container path + CONTAINER_JOURNAL_SUFFIX) and synced;
+    the journal is removed once the new index is synced. A container left without a
+    valid trailer by a writer that died mid-append is read through the journal's
+    index, and restored from it by the next writer, so only the unfinished record is
+    lost. By default a record uses the key characters right after those of every
+    earlier record, so records never share pad.
+*/
+
+#define CONTAINER_MAGIC "OTPC0001"
+#define CONTAINER_INDEX_MAGIC "OTPIDX01"
+#define CONTAINER_MAGIC_LEN 8
+#define CONTAINER_JOURNAL_SUFFIX ".journal"
+
+struct container_record {
+    uint64_t offset;                // Offset of first ciphertext character in the file
+    uint64_t length;                // Ciphertext characters (newline not counted)
+    uint64_t key_offset;            // Offset of first key character in the key file
+};
+
+struct otp_container {
+    int fd;
+    bool writable;
+    uint64_t index_offset;          // Where the index (and next appended record) starts
+    uint64_t record_count;
+    struct container_record *records;
+    char *map;                      // Read-only mapping of the records (container_map())
+    size_t map_size;
+    char *journal_path;             // Old index saved here while a record is appended
+};
+
+int container_open(struct otp_container *container, const char *path, bool writable);
+int container_map(struct otp_container *container);
+const char* container_record_text(const struct otp_container *container, uint64_t record);
+uint64_t container_next_key_offset(const struct otp_container *container);
+int container_append_begin(struct otp_container *container);
+int container_append_end(struct otp_container *container, uint64_t length, uint64_t key_offset);
+int container_append_abort(struct otp_container *container);
+void container_close(struct otp_container *container);
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <pthread.h>        // Thread functions
+#include <signal.h>         // Signal masks
+#include <sys/syscall.h>    // Raw system call numbers
+#include <linux/futex.h>    // Futex operations
+#include <unistd.h>         // System calls
+#include "otp_engine.h"
+
+#define DEQUE_MASK (ENGINE_DEQUE_SLOTS - 1)
+
+struct work_deque {
+    // Thieves and the pushing acceptor update their index on separate cache lines
+    int64_t top __attribute__((aligned(64)));       // Next item taken (any worker)
+    int64_t bottom __attribute__((aligned(64)));    // Next free slot (acceptor only)
+    uint64_t items[ENGINE_DEQUE_SLOTS] __attribute__((aligned(64)));
+};
+
+struct engine_worker {
+    struct work_deque deque;
+    struct server_engine *engine;
+    int index;
+    pthread_t thread;
+};
+
+struct server_engine {
+    struct engine_worker *workers;
+    int thread_count;
+    int next_worker;                // Deque the next connection is pushed to (acceptor only)
+    connection_fn serve;
+    const void *context;
+    uint64_t *stolen;               // Counts connections taken from another worker's deque
+    uint32_t work_seq __attribute__((aligned(64)));  // Futex word bumped by every push
+    uint32_t sleepers;              // Workers asleep on work_seq
+    bool stop;                      // Set when engine_create() fails, worker threads exit
+};
+
+// Helper function declarations
+static void* engine_thread(void *arg);
+static bool take_work(struct server_engine *engine, int self, uint64_t *item);
+static bool wait_for_work(struct server_engine *engine, int self, uint64_t *item);
+static void stop_engine(struct server_engine *engine, int started);
+static bool deque_push(struct work_deque *deque, uint64_t item);
+static bool deque_steal(struct work_deque *deque, uint64_t *item);
+
+/*
+* Function: engine_create()
+*   Starts thread_count worker threads, each with an empty deque. Threads are
+*   started with every signal blocked, so signals reach the calling (acceptor) thread.
+*   :param int thread_count: worker threads (at most ENGINE_MAX_THREADS)
+*   :param connection_fn serve: serves one connection on a worker thread
+*   :param const void *context: passed to serve
+*   :param uint64_t *stolen: counter of stolen connections (shared stats)
+*   :return struct server_engine*: engine or NULL if error
+*/
+struct server_engine* engine_create(int thread_count, connection_fn serve, const void *context,
+                                    uint64_t *stolen) {
+    sigset_t all_signals;
+    sigset_t caller_signals;
+
+    if (thread_count > ENGINE_MAX_THREADS) {
+        thread_count = ENGINE_MAX_THREADS;
+    }
+    struct server_engine *engine = calloc(1, sizeof(struct server_engine));
+    void *workers = NULL;
+    if (!engine || posix_memalign(&workers, 64, thread_count * sizeof(struct engine_worker)) != 0) {
+        perror("Error: failed to allocate worker threads");
+        free(engine);
+        return NULL;
+    }
+    memset(workers, '\0', thread_count * sizeof(struct engine_worker));
+    engine->workers = workers;
+    engine->thread_count = thread_count;
+    engine->serve = serve;
+    engine->context = context;
+    engine->stolen = stolen;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &caller_signals);
+    for (int i = 0; i < thread_count; i++) {
+        engine->workers[i].engine = engine;
+        engine->workers[i].index = i;
+        int error = pthread_create(&engine->workers[i].thread, NULL, engine_thread, &engine->workers[i]);
+        if (error != 0) {
+            errno = error;
+            perror("Error: failed to start worker thread");
+            pthread_sigmask(SIG_SETMASK, &caller_signals, NULL);
+            stop_engine(engine, i);
+            return NULL;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &caller_signals, NULL);
+    return engine;
+}
+
+/*
+* Function: engine_submit()
+*   Queues an accepted connection on the next worker's deque, or the one after
+*   if that is full, and wakes a sleeping worker. Acceptor thread only.
+*   :param struct server_engine *engine: running engine
+*   :param int client_socket: accepted client socket
+*   :param bool is_unix: true for a UNIX-domain connection
+*   :param uint32_t connection: connection number (for traces)
+*   :return bool: false if every deque is full (caller refuses the connection)
+*/
+bool engine_submit(struct server_engine *engine, int client_socket, bool is_unix, uint32_t connection) {
+    uint64_t item = ((uint64_t)connection << 32) | ((uint64_t)is_unix << 31) | (uint32_t)client_socket;
+    bool queued = false;
+
+    for (int i = 0; i < engine->thread_count && !queued; i++) {
+        int target = (engine->next_worker + i) % engine->thread_count;
+        queued = deque_push(&engine->workers[target].deque, item);
+    }
+    engine->next_worker = (engine->next_worker + 1) % engine->thread_count;
+    if (!queued) {
+        return false;
+    }
+    // Pairs with wait_for_work(): either the sleeper sees the item or we see the sleeper
+    __atomic_add_fetch(&engine->work_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&engine->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &engine->work_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    return true;
+}
+
+/*
+* Function: engine_thread()
+*   Worker thread: serves connections from its own deque, then stolen ones,
+*   and sleeps when every deque is empty.
+*   :param void *arg: this worker's struct engine_worker
+*   :return void*: NULL once the engine is stopped
+*/
+static void* engine_thread(void *arg) {
+    struct engine_worker *worker = arg;
+    struct server_engine *engine = worker->engine;
+    uint64_t item;
+
+    while (!__atomic_load_n(&engine->stop, __ATOMIC_SEQ_CST)) {
+        if (take_work(engine, worker->index, &item) || wait_for_work(engine, worker->index, &item)) {
+            engine->serve(engine->context, (int)(item & 0x7fffffff), (item >> 31) & 1, (uint32_t)(item >> 32));
+        }
+    }
+    return NULL;
+}
+
+/*
+* Function: take_work()
+*   Takes the oldest connection from the worker's own deque, or else steals one
+*   from the other workers, starting with the next so thieves spread out.
+*   :param struct server_engine *engine: running engine
+*   :param int self: index of the calling worker
+*   :param uint64_t *item: set to the connection taken
+*   :return bool: false if every deque was empty
+*/
+static bool take_work(struct server_engine *engine, int self, uint64_t *item) {
+    for (int i = 0; i < engine->thread_count; i++) {
+        int victim = (self + i) % engine->thread_count;
+        if (deque_steal(&engine->workers[victim].deque, item)) {
+            if (i > 0) {
+                __atomic_add_fetch(engine->stolen, 1, __ATOMIC_RELAXED);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+* Function: wait_for_work()
+*   Sleeps until a connection is pushed. The worker is counted as a sleeper before
+*   the deques are checked one last time, so a push in between is never missed.
+*   :param struct server_engine *engine: running engine
+*   :param int self: index of the calling worker
+*   :param uint64_t *item: set to the connection taken
+*   :return bool: true if the last check found a connection, false after a wake-up
+*/
+static bool wait_for_work(struct server_engine *engine, int self, uint64_t *item) {
+    uint32_t seq = __atomic_load_n(&engine->work_seq, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&engine->sleepers, 1, __ATOMIC_SEQ_CST);
+    bool found = take_work(engine, self, item);
+    // stop is set before work_seq is bumped, so a stopping engine is seen here or wakes us
+    if (!found && !__atomic_load_n(&engine->stop, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &engine->work_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    __atomic_sub_fetch(&engine->sleepers, 1, __ATOMIC_SEQ_CST);
+    return found;
+}
+
+/*
+* Function: stop_engine()
+*   Stops and joins the worker threads started so far and frees the engine.
+*   Only used while no connection has been submitted.
+*   :param struct server_engine *engine: engine being created
+*   :param int started: worker threads started
+*/
+static void stop_engine(struct server_engine *engine, int started) {
+    __atomic_store_n(&engine->stop, true, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&engine->work_seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &engine->work_seq, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+    for (int i = 0; i < started; i++) {
+        pthread_join(engine->workers[i].thread, NULL);
+    }
+    free(engine->workers);
+    free(engine);
+}
+
+/*
+* Function: deque_push()
+*   Adds an item at the bottom of a deque. Only the acceptor pushes, so bottom
+*   needs no compare-and-swap; a slot is only reused once top has moved past it.
+*   :param struct work_deque *deque: worker's deque
+*   :param uint64_t item: packed connection
+*   :return bool: false if the deque is full
+*/
+static bool deque_push(struct work_deque *deque, uint64_t item) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= ENGINE_DEQUE_SLOTS) {
+        return false;
+    }
+    __atomic_store_n(&deque->items[bottom & DEQUE_MASK], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+/*
+* Function: deque_steal()
+*   Takes the item at the top of a deque; the owner and thieves all take this way
+*   and race only on the compare-and-swap of top. A thief that read a slot the
+*   acceptor has since refilled loses that race, since top moved on first.
+*   :param struct work_deque *deque: any worker's deque
+*   :param uint64_t *item: set to the item taken
+*   :return bool: false if the deque is empty
+*/
+static bool deque_steal(struct work_deque *deque, uint64_t *item) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    while (top < __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST)) {
+        uint64_t value = __atomic_load_n(&deque->items[top & DEQUE_MASK], __ATOMIC_RELAXED);
+        // On failure top is reloaded and the next item is tried
+        if (__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+            *item = value;
+            return true;
+        }
+    }
+    return false;
+}
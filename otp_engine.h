@@ -0,0 +1,37 @@
+#ifndef OTP_ENGINE_H
+#define OTP_ENGINE_H
+
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Threaded Server Engine
+Author: Jose Bianchi
+Description: Serves accepted connections on a fixed set of worker threads instead of a
+    forked process each, so a connection costs a queue slot and a thread's time rather
+    than a process, and buffers a worker keeps stay warm between connections. Every
+    worker owns a bounded deque (Chase-Lev layout, lock-free). The acceptor is the only
+    thread pushing, round robin onto the workers' deques; a worker takes from the top of
+    its own deque and, once that is empty, steals from the top of the others, so a worker
+    stuck on a long request does not hold up connections queued behind it. Deques are
+    taken oldest first, connections are served in arrival order. Idle workers sleep on a
+    futex that every push bumps. Worker threads block all signals; they are handled by
+    the acceptor thread.
+*/
+
+#define ENGINE_MAX_THREADS 256
+#define ENGINE_DEQUE_SLOTS 256      // Connections queued per worker (power of two)
+
+/*
+* Type: connection_fn
+*   Serves one accepted connection on a worker thread and closes it.
+*/
+typedef void (*connection_fn)(const void *context, int client_socket, bool is_unix, uint32_t connection);
+
+struct server_engine;
+
+struct server_engine* engine_create(int thread_count, connection_fn serve, const void *context,
+                                    uint64_t *stolen);
+bool engine_submit(struct server_engine *engine, int client_socket, bool is_unix, uint32_t connection);
+
+#endif
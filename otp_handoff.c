@@ -0,0 +1,132 @@
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+#include <sys/time.h>       // Time value structures
+#include <unistd.h>         // Process management/ file operations
+#include "otp_unix.h"
+#include "otp_handoff.h"
+
+/*
+* Function: handoff_listen()
+*   Listens on the handoff path for the next server, replacing the socket file of
+*   the server this one took over from.
+*   :param const char *path: handoff socket path
+*   :return int: listening socket, -1 on error
+*/
+int handoff_listen(const char *path) {
+    struct sockaddr_un address;
+
+    if (setup_unix_socket(&address, path) < 0) {
+        return -1;
+    }
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (handoff_socket < 0) {
+        perror("Error: could not create/ open handoff socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(handoff_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("Error: could not bind server to handoff path");
+        close(handoff_socket);
+        return -1;
+    }
+    listen(handoff_socket, 1);
+    return handoff_socket;
+}
+
+/*
+* Function: handoff_receive()
+*   Asks the server listening on the handoff path for its listening sockets.
+*   :param const char *path: handoff socket path
+*   :param int *control_fd: set to the connection to confirm on (handoff_confirm())
+*   :param int *fds: array receiving the listeners, TCP first
+*   :param int max_fds: capacity of fds
+*   :return int: number of listeners received, 0 if no server is running, -1 on error
+*/
+int handoff_receive(const char *path, int *control_fd, int *fds, int max_fds) {
+    struct sockaddr_un address;
+    char mode;
+
+    if (setup_unix_socket(&address, path) < 0) {
+        return -1;
+    }
+    int control = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control < 0) {
+        perror("Error: could not create/ open handoff socket");
+        return -1;
+    }
+    if (connect(control, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(control);
+        // No socket file, or one left behind by a server that is gone
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            return 0;
+        }
+        perror("Error: could not connect to running server");
+        return -1;
+    }
+    // The running server answers between accepts
+    struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT_MS / 1000, .tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(control, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int fd_count = recv_fds(control, &mode, fds, max_fds);
+    if (fd_count < 0 || mode != HANDOFF_MODE) {
+        fprintf(stderr, "Error: running server did not hand off its listeners\n");
+        for (int i = 0; i < fd_count; i++) {
+            close(fds[i]);
+        }
+        close(control);
+        return -1;
+    }
+    *control_fd = control;
+    return fd_count;
+}
+
+/*
+* Function: handoff_confirm()
+*   Tells the old server this one is accepting on the listeners and the handoff path,
+*   so it can stop accepting and drain.
+*   :param int control_fd: connection from handoff_receive()
+*/
+void handoff_confirm(int control_fd) {
+    char ready = HANDOFF_READY;
+
+    send(control_fd, &ready, 1, MSG_NOSIGNAL);
+    close(control_fd);
+}
+
+/*
+* Function: handoff_send()
+*   Accepts a new server on the handoff socket and passes it the listeners. The
+*   caller keeps accepting unless the new server confirms it took over.
+*   :param int handoff_socket: listening handoff socket with a pending connection
+*   :param const int *fds: listening sockets, TCP first
+*   :param int fd_count: number of listening sockets
+*   :return bool: true if the new server took over
+*/
+bool handoff_send(int handoff_socket, const int *fds, int fd_count) {
+    char ready = '\0';
+
+    int control = accept(handoff_socket, NULL, NULL);
+    if (control < 0) {
+        return false;
+    }
+    if (send_fds(control, HANDOFF_MODE, fds, fd_count) < 0) {
+        perror("Error: could not hand off listeners");
+        close(control);
+        return false;
+    }
+    // Exiting workers (SIGCHLD) must not cut the wait short
+    struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT_MS / 1000, .tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(control, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t received;
+    while ((received = recv(control, &ready, 1, 0)) < 0 && errno == EINTR);
+    if (received != 1 || ready != HANDOFF_READY) {
+        fprintf(stderr, "Error: new server did not take over, still serving\n");
+        close(control);
+        return false;
+    }
+    close(control);
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef OTP_HANDOFF_H
+#define OTP_HANDOFF_H
+
+#include <stdbool.h>        // Boolean values
+
+/*
+Module Name: Listener Handoff
+Author: Jose Bianchi
+Description: Passes a running server's listening sockets to a new server process, so
+    a server can be upgraded without a moment where its port refuses connections.
+    Each server started with a handoff path listens on it. A new server first connects
+    to the path; the running server answers with its listeners (TCP first, then the
+    UNIX-domain listener if it has one) in one SCM_RIGHTS message, and keeps accepting
+    until the new server confirms it is listening on the handoff path itself. Only then
+    does the old server stop accepting and drain. Connections arriving meanwhile wait
+    in the shared listen queue for whichever process accepts first.
+*/
+
+#define HANDOFF_MODE 'H'            // Mode byte sent with the listeners
+#define HANDOFF_READY 'A'           // New server took over
+#define HANDOFF_MAX_FDS 2
+#define HANDOFF_TIMEOUT_MS 10000    // Longest either side waits for the other
+
+int handoff_listen(const char *path);
+int handoff_receive(const char *path, int *control_fd, int *fds, int max_fds);
+void handoff_confirm(int control_fd);
+bool handoff_send(int handoff_socket, const int *fds, int fd_count);
+
+#endif
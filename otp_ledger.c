@@ -0,0 +1,109 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <fcntl.h>          // File control functions
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <unistd.h>         // Process management/ file operations
+#include "otp_ledger.h"
+#include "otp_client.h"     // Status codes
+
+/*
+* Function: ledger_open()
+*   Opens (or creates) the ledger of a key file and maps it. Clients creating
+*   the same ledger at once agree on it: every field is set by compare-and-swap
+*   from zero, so the first one wins and the others check against it.
+*   :param struct otp_ledger *ledger: handle to fill in
+*   :param const char *key_path: key file the ledger belongs to
+*   :param uint64_t key_len: key characters in the key file
+*   :return int: OTP_OK or OTP_ERR_* status
+*/
+int ledger_open(struct otp_ledger *ledger, const char *key_path, uint64_t key_len) {
+    struct stat file_info;
+
+    memset(ledger, '\0', sizeof(*ledger));
+    size_t path_len = strlen(key_path) + sizeof(LEDGER_SUFFIX);
+    char *path = malloc(path_len);
+    if (!path) {
+        return OTP_ERR_NOMEM;
+    }
+    snprintf(path, path_len, "%s%s", key_path, LEDGER_SUFFIX);
+    ledger->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(path);
+    if (ledger->fd < 0) {
+        return OTP_ERR_FILE;
+    }
+    // Growing a new (empty) file to the same size twice keeps it zero filled
+    if (fstat(ledger->fd, &file_info) < 0 ||
+            (file_info.st_size < LEDGER_SIZE && ftruncate(ledger->fd, LEDGER_SIZE) < 0)) {
+        ledger_close(ledger);
+        return OTP_ERR_FILE;
+    }
+    ledger->file = mmap(NULL, LEDGER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ledger->fd, 0);
+    if (ledger->file == MAP_FAILED) {
+        ledger->file = NULL;
+        ledger_close(ledger);
+        return OTP_ERR_FILE;
+    }
+    // Key length first: a ledger carrying the magic always has it set
+    uint64_t expected = 0;
+    __atomic_compare_exchange_n(&ledger->file->key_len, &expected, key_len, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    uint64_t magic = 0;
+    __atomic_compare_exchange_n(&ledger->file->magic, &magic, LEDGER_MAGIC, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    // A different length means the key file was replaced since the ledger was made
+    if (__atomic_load_n(&ledger->file->magic, __ATOMIC_ACQUIRE) != LEDGER_MAGIC ||
+            __atomic_load_n(&ledger->file->key_len, __ATOMIC_ACQUIRE) != key_len) {
+        ledger_close(ledger);
+        return OTP_ERR_LEDGER;
+    }
+    return OTP_OK;
+}
+
+/*
+* Function: ledger_claim()
+*   Claims the next len key characters. Lock free: concurrent claims retry the
+*   compare-and-swap until each gets its own range. The moved cursor is synced to
+*   disk before the range is returned, so a crash cannot hand it out again.
+*   :param struct otp_ledger *ledger: open ledger
+*   :param uint64_t len: key characters needed
+*   :param uint64_t *offset: set to the first claimed key character
+*   :return int: OTP_OK, OTP_ERR_KEY_SHORT if the rest of the pad is too short, or
+*                OTP_ERR_FILE if the claim could not be synced (the range stays claimed)
+*/
+int ledger_claim(struct otp_ledger *ledger, uint64_t len, uint64_t *offset) {
+    struct ledger_file *file = ledger->file;
+    uint64_t cursor = __atomic_load_n(&file->cursor, __ATOMIC_RELAXED);
+
+    do {
+        // Never move the cursor past the pad: a claim that does not fit takes nothing
+        if (len > file->key_len || cursor > file->key_len - len) {
+            return OTP_ERR_KEY_SHORT;
+        }
+    } while (!__atomic_compare_exchange_n(&file->cursor, &cursor, cursor + len, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&file->claims, 1, __ATOMIC_RELAXED);
+    // Key characters must not be used until the claim survives a crash
+    if (msync(file, LEDGER_SIZE, MS_SYNC) < 0) {
+        return OTP_ERR_FILE;
+    }
+    *offset = cursor;
+    return OTP_OK;
+}
+
+/*
+* Function: ledger_close()
+*   Unmaps and closes a ledger. Claims are already in the file.
+*   :param struct otp_ledger *ledger: ledger to close
+*/
+void ledger_close(struct otp_ledger *ledger) {
+    if (ledger->file) {
+        munmap(ledger->file, LEDGER_SIZE);
+        ledger->file = NULL;
+    }
+    if (ledger->fd >= 0) {
+        close(ledger->fd);
+        ledger->fd = -1;
+    }
+}
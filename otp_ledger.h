@@ -0,0 +1,43 @@
+#ifndef OTP_LEDGER_H
+#define OTP_LEDGER_H
+
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Pad Ledger (libotpclient)
+Author: Jose Bianchi
+Description: Hands out disjoint ranges of one large key file to any number of
+    clients on the same host, so a single pre-generated pad serves many messages
+    without ever reusing key characters. The ledger is a small file next to the key
+    file (key_path LEDGER_SUFFIX) that every client maps shared; claiming a range is
+    one compare-and-swap on the cursor in it, no lock is taken. Claims only move the
+    cursor forward: a range whose request later fails is never handed out again.
+    Fields are in host byte order (the ledger is only used on the host that owns it):
+        magic       LEDGER_MAGIC
+        key_len     key characters of the pad the ledger was made for
+        cursor      first key character not claimed yet
+        claims      ranges handed out
+*/
+
+#define LEDGER_SUFFIX ".ledger"
+#define LEDGER_MAGIC 0x313047444c50544fULL  // "OTPLDG01" read as a little-endian word
+#define LEDGER_SIZE 64                      // File size: one cache line
+
+struct ledger_file {
+    uint64_t magic;
+    uint64_t key_len;
+    uint64_t cursor;
+    uint64_t claims;
+};
+
+struct otp_ledger {
+    int fd;
+    struct ledger_file *file;       // Shared mapping of the ledger file
+};
+
+int ledger_open(struct otp_ledger *ledger, const char *key_path, uint64_t key_len);
+int ledger_claim(struct otp_ledger *ledger, uint64_t len, uint64_t *offset);
+void ledger_close(struct otp_ledger *ledger);
+
+#endif
@@ -0,0 +1,299 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <sys/syscall.h>    // Raw system call numbers
+#include <linux/futex.h>    // Futex operations
+#include <unistd.h>         // Process management/ file operations
+#include <time.h>           // Clock functions
+#include <inttypes.h>       // Fixed width format macros
+#include "otp_limits.h"
+
+#define BULK_BURST_MS 100           // Unused bulk bandwidth that carries over
+
+// Helper function declarations
+static void note_peak(struct server_stats *stats, uint64_t inflight);
+
+/*
+* Function: stats_create()
+*   Maps zeroed accounting shared with every process forked afterwards.
+*   :return struct server_stats*: shared stats or NULL if error
+*/
+struct server_stats* stats_create(void) {
+    struct server_stats *stats = mmap(NULL, sizeof(struct server_stats), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        perror("Error: failed to map server stats");
+        return NULL;
+    }
+    return stats;
+}
+
+/*
+* Function: stats_print()
+*   Writes one line of counters (key=value pairs) to stream.
+*   :param const struct server_stats *stats: shared stats
+*   :param FILE *stream: output stream
+*/
+void stats_print(const struct server_stats *stats, FILE *stream) {
+    fprintf(stream, "stats: accepted=%" PRIu64 " completed=%" PRIu64 " workers=%" PRIu32
+            " inflight_bytes=%" PRIu64 " peak_inflight_bytes=%" PRIu64 " spooled_bytes=%" PRIu64
+            " rejected_size=%" PRIu64
+            " rejected_key_short=%" PRIu64 " rejected_budget=%" PRIu64 " rejected_busy=%" PRIu64 " timeout_stage=%" PRIu64
+            " timeout_rate=%" PRIu64 " timeout_request=%" PRIu64 " idle_closed=%" PRIu64
+            " sessions_started=%" PRIu64 " sessions_resumed=%" PRIu64 " bulk_requests=%" PRIu64
+            " bulk_lane=%" PRIu32 " rejected_bulk=%" PRIu64 " zerocopy_replies=%" PRIu64
+            " zerocopy_copied=%" PRIu64 " ring_batches=%" PRIu64 " ring_batched=%" PRIu64
+            " stolen=%" PRIu64 "\n",
+            __atomic_load_n(&stats->accepted, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->completed, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->workers, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->inflight_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->peak_inflight_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->spooled_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->rejected_size, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->rejected_key_short, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->rejected_budget, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->rejected_busy, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->timeout_stage, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->timeout_rate, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->timeout_request, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->idle_closed, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->sessions_started, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->sessions_resumed, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->bulk_requests, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->bulk_lane, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->rejected_bulk, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->zerocopy_replies, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->zerocopy_copied, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->ring_batches, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->ring_batched, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats->engine_stolen, __ATOMIC_RELAXED));
+    fflush(stream);
+}
+
+/*
+* Function: stats_add()
+*   Atomically adds to a shared counter.
+*   :param uint64_t *counter: counter in shared stats
+*   :param uint64_t amount: value to add
+*/
+void stats_add(uint64_t *counter, uint64_t amount) {
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+/*
+* Function: budget_acquire()
+*   Charges bytes to the global budget, waiting up to limits->queue_ms for other
+*   workers to return budget. A request larger than the whole budget fails at once.
+*   :param struct server_stats *stats: shared stats holding the in-flight total
+*   :param const struct server_limits *limits: configured budget and queue time
+*   :param uint64_t bytes: bytes this request is about to allocate
+*   :return bool: true if charged (caller must budget_release()), false if over budget
+*/
+bool budget_acquire(struct server_stats *stats, const struct server_limits *limits, uint64_t bytes) {
+    struct timespec start;
+    struct timespec now;
+
+    if (limits->byte_budget == 0) {
+        note_peak(stats, __atomic_add_fetch(&stats->inflight_bytes, bytes, __ATOMIC_RELAXED));
+        return true;
+    }
+    if (bytes > limits->byte_budget) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        // Sample the wake counter first so a release after the check is not missed
+        uint32_t seq = __atomic_load_n(&stats->budget_seq, __ATOMIC_ACQUIRE);
+        uint64_t inflight = __atomic_load_n(&stats->inflight_bytes, __ATOMIC_RELAXED);
+        while (inflight + bytes <= limits->byte_budget) {
+            if (__atomic_compare_exchange_n(&stats->inflight_bytes, &inflight, inflight + bytes,
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                note_peak(stats, inflight + bytes);
+                return true;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long waited_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (waited_ms >= limits->queue_ms) {
+            return false;
+        }
+        long remaining_ms = limits->queue_ms - waited_ms;
+        struct timespec timeout = { .tv_sec = remaining_ms / 1000, .tv_nsec = (remaining_ms % 1000) * 1000000L };
+        __atomic_add_fetch(&stats->budget_waiters, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &stats->budget_seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+        __atomic_sub_fetch(&stats->budget_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+* Function: budget_release()
+*   Returns bytes to the global budget and wakes workers waiting for it.
+*   :param struct server_stats *stats: shared stats holding the in-flight total
+*   :param uint64_t bytes: bytes charged by budget_acquire()
+*/
+void budget_release(struct server_stats *stats, uint64_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    __atomic_sub_fetch(&stats->inflight_bytes, bytes, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&stats->budget_seq, 1, __ATOMIC_SEQ_CST);
+    // Only pay for the wake when someone is queued for budget
+    if (__atomic_load_n(&stats->budget_waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &stats->budget_seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+* Function: budget_rebase_spool()
+*   Sets the budget held for session spools to the bytes the spool directory
+*   declares, charging spools left by an earlier server and returning the charge
+*   of spools swept or finished by another server. The caller holds spool_lock().
+*   :param struct server_stats *stats: shared stats holding the in-flight total
+*   :param uint64_t spooled: bytes counted by spool_usage()
+*/
+void budget_rebase_spool(struct server_stats *stats, uint64_t spooled) {
+    uint64_t charged = __atomic_exchange_n(&stats->spooled_bytes, spooled, __ATOMIC_SEQ_CST);
+    if (spooled > charged) {
+        note_peak(stats, __atomic_add_fetch(&stats->inflight_bytes, spooled - charged, __ATOMIC_RELAXED));
+    } else {
+        budget_release(stats, charged - spooled);
+    }
+}
+
+/*
+* Function: lane_acquire()
+*   Takes one of the limits->bulk_workers bulk slots, waiting up to timeout_ms
+*   for a running bulk request to return one.
+*   :param struct server_stats *stats: shared stats holding the bulk slots
+*   :param const struct server_limits *limits: configured bulk slots
+*   :param long timeout_ms: longest wait (-1 = no limit)
+*   :return bool: true if a slot was taken (caller must lane_release()), false on timeout
+*/
+bool lane_acquire(struct server_stats *stats, const struct server_limits *limits, long timeout_ms) {
+    struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        // Sample the wake counter first so a release after the check is not missed
+        uint32_t seq = __atomic_load_n(&stats->bulk_seq, __ATOMIC_ACQUIRE);
+        uint32_t running = __atomic_load_n(&stats->bulk_running, __ATOMIC_RELAXED);
+        while (running < (uint32_t)limits->bulk_workers) {
+            if (__atomic_compare_exchange_n(&stats->bulk_running, &running, running + 1,
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                return true;
+            }
+        }
+        struct timespec timeout;
+        struct timespec *timeout_arg = NULL;
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long remaining_ms = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 +
+                                              (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (remaining_ms <= 0) {
+                return false;
+            }
+            timeout.tv_sec = remaining_ms / 1000;
+            timeout.tv_nsec = (remaining_ms % 1000) * 1000000L;
+            timeout_arg = &timeout;
+        }
+        __atomic_add_fetch(&stats->bulk_waiters, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &stats->bulk_seq, FUTEX_WAIT, seq, timeout_arg, NULL, 0);
+        __atomic_sub_fetch(&stats->bulk_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+* Function: lane_release()
+*   Returns a bulk slot and wakes one worker waiting for it.
+*   :param struct server_stats *stats: shared stats holding the bulk slots
+*/
+void lane_release(struct server_stats *stats) {
+    __atomic_sub_fetch(&stats->bulk_running, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&stats->bulk_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&stats->bulk_waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &stats->bulk_seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+* Function: helpers_acquire()
+*   Takes up to wanted of the cipher_threads - 1 helper threads all workers share
+*   (the requesting worker is the last thread), without waiting: a request that
+*   finds them taken runs with fewer, or alone.
+*   :param struct server_stats *stats: shared stats holding the helper count
+*   :param const struct server_limits *limits: configured cipher_threads
+*   :param int wanted: helpers the request could use
+*   :return int: helpers taken (caller must helpers_release() them)
+*/
+int helpers_acquire(struct server_stats *stats, const struct server_limits *limits, int wanted) {
+    uint32_t busy = __atomic_load_n(&stats->cipher_helpers, __ATOMIC_RELAXED);
+    int taken;
+
+    do {
+        int free_helpers = limits->cipher_threads - 1 - (int)busy;
+        taken = (wanted < free_helpers) ? wanted : free_helpers;
+        if (taken <= 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&stats->cipher_helpers, &busy, busy + taken,
+                                          false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return taken;
+}
+
+/*
+* Function: helpers_release()
+*   Returns helper threads taken by helpers_acquire().
+*   :param struct server_stats *stats: shared stats holding the helper count
+*   :param int helpers: helpers taken
+*/
+void helpers_release(struct server_stats *stats, int helpers) {
+    if (helpers > 0) {
+        __atomic_sub_fetch(&stats->cipher_helpers, helpers, __ATOMIC_ACQ_REL);
+    }
+}
+
+/*
+* Function: bulk_pace()
+*   Books bytes just moved by a bulk request against the shared bulk bandwidth.
+*   Every bulk worker advances one clock by the time its bytes take at bulk_rate;
+*   a worker ahead of the clock has to wait. Up to BULK_BURST_MS of unused
+*   bandwidth carries over, so short pauses do not lose the allowance.
+*   :param struct server_stats *stats: shared stats holding the bandwidth clock
+*   :param const struct server_limits *limits: configured bulk_rate
+*   :param uint64_t bytes: bytes moved
+*   :return long: microseconds the caller should wait before moving more
+*/
+long bulk_pace(struct server_stats *stats, const struct server_limits *limits, uint64_t bytes) {
+    struct timespec now_time;
+
+    if (limits->bulk_rate == 0) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now_time);
+    uint64_t now = (uint64_t)now_time.tv_sec * 1000000000ULL + now_time.tv_nsec;
+    uint64_t cost = bytes * 1000000000ULL / limits->bulk_rate;
+    uint64_t earliest = now - BULK_BURST_MS * 1000000ULL;
+    uint64_t next = __atomic_load_n(&stats->bulk_next_ns, __ATOMIC_RELAXED);
+    uint64_t start;
+    do {
+        start = (next > earliest) ? next : earliest;
+    } while (!__atomic_compare_exchange_n(&stats->bulk_next_ns, &next, start + cost,
+                                          false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return (start + cost > now) ? (long)((start + cost - now) / 1000) : 0;
+}
+
+/*
+* Function: note_peak()
+*   Raises the recorded peak of in-flight bytes to inflight if it is higher.
+*   :param struct server_stats *stats: shared stats
+*   :param uint64_t inflight: in-flight total just reached
+*/
+static void note_peak(struct server_stats *stats, uint64_t inflight) {
+    uint64_t peak = __atomic_load_n(&stats->peak_inflight_bytes, __ATOMIC_RELAXED);
+    while (inflight > peak &&
+           !__atomic_compare_exchange_n(&stats->peak_inflight_bytes, &peak, inflight,
+                                        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,92 @@
+#ifndef OTP_LIMITS_H
+#define OTP_LIMITS_H
+
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <stdio.h>          // Input/ output
+
+/*
+Module Name: Admission Control and Server Stats
+Author: Jose Bianchi
+Description: Per-request size limits, a global budget of request bytes held in memory,
+    deadlines that cut off stalled or slow clients, and counters describing server activity. Accounting lives in a shared anonymous
+    mapping created before the first fork, so every worker process charges the same
+    budget and updates the same counters. Workers waiting for budget sleep on a futex
+    that is woken whenever budget is returned. Requests whose message is at least
+    bulk_min run in a separate bulk lane: a few slots of their own (waiters sleep on
+    a second futex), a lower CPU priority and a shared bandwidth allowance, so
+    interactive requests keep their workers and CPU while bulk transfers run.
+    Resumable sessions charge their spooled input to the same budget until the
+    session finishes or its spool is swept.
+*/
+
+struct server_limits {
+    uint64_t max_key_len;           // Largest key sequence accepted (0 = no limit)
+    uint64_t max_msg_len;           // Largest message accepted (0 = no limit)
+    uint64_t byte_budget;           // Request bytes all workers may hold at once (0 = no limit)
+    int max_workers;                // Concurrent worker processes/ threaded connections (0 = no limit)
+    int queue_ms;                   // Time a request may wait for budget/ a worker before rejection
+    int stage_ms;                   // Deadline of each protocol stage (0 = none)
+    int idle_ms;                    // Time a keep-alive connection may sit between requests (0 = none)
+    int request_ms;                 // Deadline of a whole request, Part 2 to response (0 = none)
+    uint64_t min_rate;              // Bytes per second key, message and response must move at (0 = none)
+    int cipher_threads;             // Threads transforming large requests, shared by all workers
+    uint64_t parallel_min;          // Smallest message split across cipher threads (0 = never)
+    int session_ttl;                // Seconds an unfinished resumable session is kept (0 = no sessions)
+    const char *spool_dir;          // Directory holding session spool files
+    uint64_t bulk_min;              // Smallest message handled in the bulk lane (0 = one lane)
+    int bulk_workers;               // Bulk requests served at once
+    uint64_t bulk_rate;             // Bytes per second all bulk requests share (0 = no limit)
+    int bulk_nice;                  // Nice value a worker takes on for a bulk request
+    uint64_t zerocopy_min;          // Smallest response sent with MSG_ZEROCOPY (0 = never)
+    long batch_us;                  // Time a ring request may wait for others to batch with
+    uint64_t batch_bytes;           // Message bytes transformed in one ring batch (0 = no batching)
+};
+
+struct server_stats {
+    uint64_t accepted;              // Connections handed to a worker
+    uint64_t completed;             // Requests answered
+    uint64_t rejected_size;         // Requests over a size limit
+    uint64_t rejected_key_short;    // Requests whose key is shorter than the message
+    uint64_t rejected_budget;       // Requests that waited too long for byte budget
+    uint64_t rejected_busy;         // Connections refused while all workers were busy
+    uint64_t timeout_stage;         // Connections cut off for missing a stage deadline
+    uint64_t timeout_rate;          // Connections cut off for moving payload under min_rate
+    uint64_t timeout_request;       // Connections cut off for missing the request deadline
+    uint64_t idle_closed;           // Keep-alive connections closed after idle_ms
+    uint64_t sessions_started;      // Resumable sessions created
+    uint64_t sessions_resumed;      // Reconnections continuing an existing session
+    uint64_t bulk_requests;         // Requests handled in the bulk lane
+    uint64_t rejected_bulk;         // Bulk requests that waited too long for a bulk slot
+    uint64_t zerocopy_replies;      // Responses sent with MSG_ZEROCOPY
+    uint64_t zerocopy_copied;       // Of those, responses the kernel copied anyway
+    uint64_t ring_batches;          // Cipher passes over batched ring requests
+    uint64_t ring_batched;          // Ring requests transformed in those passes
+    uint64_t engine_stolen;         // Connections a worker thread took from another's deque
+    uint64_t bulk_next_ns;          // Bulk bandwidth clock: when the next bulk byte may move
+    uint64_t inflight_bytes;        // Request bytes currently held by workers
+    uint64_t peak_inflight_bytes;
+    uint64_t spooled_bytes;         // Of inflight_bytes, the charge of unfinished session spools
+    uint32_t workers;               // Worker processes running, or connections held by worker threads
+    uint32_t budget_seq;            // Futex word bumped when budget is returned
+    uint32_t budget_waiters;        // Workers asleep on budget_seq
+    uint32_t bulk_lane;             // Workers in a bulk request (waiting for a slot or running)
+    uint32_t bulk_running;          // Bulk slots taken
+    uint32_t bulk_seq;              // Futex word bumped when a bulk slot is returned
+    uint32_t bulk_waiters;          // Workers asleep on bulk_seq
+    uint32_t cipher_helpers;        // Cipher pool threads helping with a request, all workers
+};
+
+struct server_stats* stats_create(void);
+void stats_print(const struct server_stats *stats, FILE *stream);
+void stats_add(uint64_t *counter, uint64_t amount);
+bool budget_acquire(struct server_stats *stats, const struct server_limits *limits, uint64_t bytes);
+void budget_release(struct server_stats *stats, uint64_t bytes);
+void budget_rebase_spool(struct server_stats *stats, uint64_t spooled);
+bool lane_acquire(struct server_stats *stats, const struct server_limits *limits, long timeout_ms);
+void lane_release(struct server_stats *stats);
+int helpers_acquire(struct server_stats *stats, const struct server_limits *limits, int wanted);
+void helpers_release(struct server_stats *stats, int helpers);
+long bulk_pace(struct server_stats *stats, const struct server_limits *limits, uint64_t bytes);
+
+#endif
@@ -0,0 +1,570 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <inttypes.h>       // Fixed width format macros
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <fcntl.h>          // File control functions
+#include <netinet/in.h>     // Internet/ socket functions
+#include <netinet/tcp.h>    // TCP socket options
+#include <sys/socket.h>     // Socket functions
+#include <arpa/inet.h>      // Internet functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <sys/wait.h>       // Process termination functions
+#include <unistd.h>         // Process management/ file operations
+#include <poll.h>           // Descriptor readiness functions
+#include <signal.h>         // Signal handling
+#include <time.h>           // Clock functions
+
+#define CONNECT_COUNT 16
+#define SEGMENT_MAX 16384           // Bytes read into one delayed segment
+#define QUEUE_LIMIT 1048576         // Bytes held per direction before the sender is held back
+#define COMMAND_CHECK_MS 100        // How often the accept loop checks on a benchmark command
+#define NETEM_USAGE "USAGE: %s [-d delay_ms] [-j jitter_ms] [-b bytes_per_s] [-l stalls_per_1000] " \
+                    "[-t stall_ms] [-r seed] port backend [-- command [args...]]\n" \
+                    "  backend: port on this host or ipv4_address:port\n"
+
+/*
+Program Name: Network Impairment Proxy
+Author: Jose Bianchi
+Description: Program is part of encryption/ decryption prgram for converting
+    plaintext data into ciphertext, using a key via the one-time pad-like approach.
+    This specific program sits between clients and an enc_server/ dec_server (or the
+    router) on one host and makes the link between them behave like a WAN link, so
+    protocol changes can be measured offline. Each accepted connection is handed to a
+    forked child that reads each direction in segments and delivers every segment
+    after a one-way delay plus random jitter, at no more than bytes_per_s, with a
+    chance per segment of a stall as long as a TCP retransmission timeout. Segments
+    leave in the order they arrived, as TCP would deliver them, so jitter and stalls
+    also hold back everything behind them. The first client bytes are held for one
+    round trip, as a real connection handshake would. Given a command after "--",
+    the proxy runs it (typically otp_replay or a client loop pointed at port) and
+    appends the link conditions and its own counters to the command's report, then
+    exits with the command's status. Counters live in shared memory and are printed
+    on SIGUSR1.
+*/
+
+struct segment {
+    struct segment *next;
+    uint64_t due_us;                // When the segment has fully crossed the link
+    size_t len;                     // 0 marks the end of the direction (EOF)
+    size_t sent;
+    char data[];
+};
+
+struct direction {
+    int from_fd;
+    int to_fd;
+    struct segment *head;
+    struct segment *tail;
+    size_t queued;                  // Bytes read but not yet delivered
+    uint64_t not_before_us;         // Sender may not send before this (handshake)
+    uint64_t last_due_us;           // Delivery time of the previous segment (keeps order)
+    uint64_t link_free_us;          // When the link has finished the previous segment
+    bool reading;                   // Sender has not closed its side yet
+    bool done;                      // EOF has been delivered
+    uint64_t *bytes;                // Shared byte counter of this direction
+};
+
+struct netem_shared {
+    uint64_t connections;
+    uint64_t failed;                // Connections whose backend could not be reached
+    uint64_t up_bytes;              // Client to backend
+    uint64_t down_bytes;            // Backend to client
+    uint64_t segments;
+    uint64_t stalls;
+};
+
+// Link conditions, fixed for the run
+static uint64_t delay_us;
+static uint64_t jitter_us;
+static uint64_t rate;               // Bytes per second, 0 for no limit
+static uint32_t stall_per_mille;
+static uint64_t stall_us = 200000;
+static uint32_t seed = 1;
+
+// Proxy state (shared counters mapped before the first fork)
+static struct netem_shared *shared;
+static struct sockaddr_in backend_address;
+static uint32_t random_state;
+static volatile sig_atomic_t stats_requested;
+
+// Helper function declarations
+int parse_backend(const char *arg, struct sockaddr_in *address);
+void impair_connection(int client_socket);
+void schedule_segment(struct direction *direction, struct segment *segment, uint64_t now);
+bool read_segment(struct direction *direction, uint64_t now);
+bool deliver_segments(struct direction *direction, uint64_t now);
+uint32_t next_random(void);
+uint64_t now_us(void);
+void print_stats(FILE *out);
+void on_signal(int signal_num);
+void setup_socket(struct sockaddr_in* address, int port_num);
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in server_address;
+    int option;
+
+    // Validate input
+    while ((option = getopt(argc, argv, "+d:j:b:l:t:r:")) != -1) {
+        switch (option) {
+            case 'd':
+                delay_us = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            case 'j':
+                jitter_us = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            case 'b':
+                rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                stall_per_mille = atoi(optarg);
+                if (stall_per_mille > 1000) {
+                    fprintf(stderr, NETEM_USAGE, argv[0]);
+                    exit(1);
+                }
+                break;
+            case 't':
+                stall_us = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            case 'r':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, NETEM_USAGE, argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, NETEM_USAGE, argv[0]);
+        exit(1);
+    }
+    int port_arg = atoi(argv[optind]);
+    if (parse_backend(argv[optind + 1], &backend_address) < 0) {
+        fprintf(stderr, "Error: invalid backend '%s'\n", argv[optind + 1]);
+        exit(1);
+    }
+    char **command = NULL;
+    if (argc - optind > 2) {
+        if (strcmp(argv[optind + 2], "--") != 0 || argc - optind < 4) {
+            fprintf(stderr, NETEM_USAGE, argv[0]);
+            exit(1);
+        }
+        command = &argv[optind + 3];
+    }
+
+    // Counters are shared with every connection child
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Error: could not map proxy counters");
+        exit(1);
+    }
+
+    struct sigaction action;
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    // Connection children are reaped automatically unless a command must be waited for
+    if (!command) {
+        signal(SIGCHLD, SIG_IGN);
+    }
+
+    // Establish IPv4 TCP server (listener) socket
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Error: could not create/ open socket");
+        exit(1);
+    }
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    setup_socket(&server_address, port_arg);
+    if (bind(server_socket, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
+        perror("Error: could not bind proxy to socket address");
+        exit(1);
+    }
+    listen(server_socket, CONNECT_COUNT);
+
+    // The command starts once the port accepts connections
+    pid_t command_pid = -1;
+    if (command) {
+        command_pid = fork();
+        if (command_pid < 0) {
+            perror("Error: fork() failed");
+            exit(1);
+        }
+        if (command_pid == 0) {
+            close(server_socket);
+            execvp(command[0], command);
+            perror("Error: could not run command");
+            _exit(127);
+        }
+    }
+
+    struct pollfd listener = { .fd = server_socket, .events = POLLIN };
+    int command_status = 0;
+    while (1) {
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats(stderr);
+        }
+        if (command) {
+            // Reap finished connection children, stop once the command is done
+            pid_t pid;
+            bool command_done = false;
+            while ((pid = waitpid(-1, &command_status, WNOHANG)) > 0) {
+                if (pid == command_pid) {
+                    command_done = true;
+                    break;
+                }
+            }
+            if (command_done) {
+                break;
+            }
+        }
+        if (poll(&listener, 1, command ? COMMAND_CHECK_MS : -1) <= 0) {
+            continue;
+        }
+        int client_socket = accept(server_socket, NULL, NULL);
+        if (client_socket < 0) {
+            if (errno != EINTR) {
+                perror("Error: could not accept connection from socket");
+            }
+            continue;
+        }
+        uint64_t connection = __atomic_fetch_add(&shared->connections, 1, __ATOMIC_RELAXED);
+        // Use separate process to impair each client connection
+        pid_t spawn_pid = fork();
+        switch (spawn_pid) {
+            case -1:
+                perror("Error: fork() failed");
+                close(client_socket);
+                break;
+            case 0:
+                close(server_socket);
+                // Each connection draws its own repeatable sequence
+                random_state = seed * 2654435761U + (uint32_t)connection + 1;
+                impair_connection(client_socket);
+                exit(0);
+            default:
+                close(client_socket);
+        }
+    }
+    close(server_socket);
+    // The conditions and proxy counters complete the command's report
+    fflush(stdout);
+    print_stats(stdout);
+    if (WIFEXITED(command_status)) {
+        return WEXITSTATUS(command_status);
+    }
+    return 1;
+}
+
+/*
+* Function: impair_connection()
+*   Connects to the backend and passes bytes both ways through the impaired link
+*   until both directions are closed. Runs in a forked child.
+*   :param int client_socket: accepted client socket
+*/
+void impair_connection(int client_socket) {
+    int backend_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (backend_socket < 0 ||
+        connect(backend_socket, (struct sockaddr *)&backend_address, sizeof(backend_address)) < 0) {
+        perror("Error: could not connect to backend");
+        __atomic_add_fetch(&shared->failed, 1, __ATOMIC_RELAXED);
+        close(client_socket);
+        exit(1);
+    }
+    // Segments are released on schedule, the kernel must not hold them back again
+    int no_delay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    setsockopt(backend_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    fcntl(backend_socket, F_SETFL, fcntl(backend_socket, F_GETFL) | O_NONBLOCK);
+
+    uint64_t now = now_us();
+    struct direction up = {
+        .from_fd = client_socket, .to_fd = backend_socket, .reading = true,
+        // A real client sends its first byte one round trip after connect()
+        .not_before_us = now + 2 * delay_us, .bytes = &shared->up_bytes
+    };
+    struct direction down = {
+        .from_fd = backend_socket, .to_fd = client_socket, .reading = true,
+        .not_before_us = now, .bytes = &shared->down_bytes
+    };
+    struct direction *directions[2] = { &up, &down };
+
+    while (!up.done || !down.done) {
+        now = now_us();
+        bool blocked[2];
+        for (int i = 0; i < 2; i++) {
+            blocked[i] = deliver_segments(directions[i], now);
+        }
+        if (up.done && down.done) {
+            break;
+        }
+        // fds[0] is the client socket, fds[1] the backend socket
+        struct pollfd fds[2] = {
+            { .fd = client_socket, .events = 0 },
+            { .fd = backend_socket, .events = 0 },
+        };
+        int64_t wait_us = -1;
+        for (int i = 0; i < 2; i++) {
+            struct direction *direction = directions[i];
+            struct pollfd *from = &fds[i];
+            struct pollfd *to = &fds[1 - i];
+            if (direction->reading && direction->queued < QUEUE_LIMIT) {
+                if (now >= direction->not_before_us) {
+                    from->events |= POLLIN;
+                } else if (wait_us < 0 || direction->not_before_us - now < (uint64_t)wait_us) {
+                    wait_us = direction->not_before_us - now;
+                }
+            }
+            if (blocked[i]) {
+                to->events |= POLLOUT;
+            } else if (direction->head &&
+                       (wait_us < 0 || direction->head->due_us - now < (uint64_t)wait_us)) {
+                wait_us = direction->head->due_us - now;
+            }
+        }
+        // Round up so a segment is never woken for a millisecond early
+        int wait_ms = (wait_us < 0) ? -1 : (int)((wait_us + 999) / 1000);
+        if (poll(fds, 2, wait_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error: poll() failed");
+            exit(1);
+        }
+        now = now_us();
+        for (int i = 0; i < 2; i++) {
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && (fds[i].events & POLLIN)) {
+                if (!read_segment(directions[i], now)) {
+                    exit(1);
+                }
+            }
+        }
+    }
+    close(client_socket);
+    close(backend_socket);
+}
+
+/*
+* Function: read_segment()
+*   Reads what the sender has sent (up to one segment) and schedules it for delivery;
+*   end of stream is scheduled as an empty segment.
+*   :param struct direction *direction: direction to read
+*   :param uint64_t now: current time (microseconds)
+*   :return bool: false if the connection failed
+*/
+bool read_segment(struct direction *direction, uint64_t now) {
+    struct segment *segment = malloc(sizeof(*segment) + SEGMENT_MAX);
+    if (!segment) {
+        fprintf(stderr, "Error: could not allocate segment\n");
+        return false;
+    }
+    ssize_t received = recv(direction->from_fd, segment->data, SEGMENT_MAX, 0);
+    if (received < 0) {
+        free(segment);
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    segment->len = received;
+    if (received == 0) {
+        direction->reading = false;
+    }
+    schedule_segment(direction, segment, now);
+    return true;
+}
+
+/*
+* Function: schedule_segment()
+*   Sets when a segment has crossed the link (delay, jitter, stall, then the time the
+*   bandwidth takes for it) and queues it behind the earlier segments.
+*   :param struct direction *direction: direction of the segment
+*   :param struct segment *segment: segment read at now
+*   :param uint64_t now: current time (microseconds)
+*/
+void schedule_segment(struct direction *direction, struct segment *segment, uint64_t now) {
+    uint64_t due = ((now > direction->not_before_us) ? now : direction->not_before_us) + delay_us;
+
+    if (jitter_us > 0) {
+        // Uniform in [-jitter, +jitter], never before the segment was sent
+        uint64_t offset = next_random() % (2 * jitter_us + 1);
+        due = (due + offset > jitter_us + now) ? due + offset - jitter_us : now;
+    }
+    if (stall_per_mille > 0 && next_random() % 1000 < stall_per_mille) {
+        due += stall_us;
+        __atomic_add_fetch(&shared->stalls, 1, __ATOMIC_RELAXED);
+    }
+    if (rate > 0 && segment->len > 0) {
+        uint64_t start = (due > direction->link_free_us) ? due : direction->link_free_us;
+        direction->link_free_us = start + segment->len * 1000000 / rate;
+        due = direction->link_free_us;
+    }
+    // TCP delivers in order: a held back segment holds back those behind it
+    if (due < direction->last_due_us) {
+        due = direction->last_due_us;
+    }
+    direction->last_due_us = due;
+
+    segment->due_us = due;
+    segment->sent = 0;
+    segment->next = NULL;
+    if (direction->tail) {
+        direction->tail->next = segment;
+    } else {
+        direction->head = segment;
+    }
+    direction->tail = segment;
+    direction->queued += segment->len;
+    if (segment->len > 0) {
+        __atomic_add_fetch(&shared->segments, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+* Function: deliver_segments()
+*   Sends every segment that is due to the receiver; an empty segment shuts down
+*   the receiver's side.
+*   :param struct direction *direction: direction to deliver
+*   :param uint64_t now: current time (microseconds)
+*   :return bool: true if a due segment waits for the receiver's socket buffer
+*/
+bool deliver_segments(struct direction *direction, uint64_t now) {
+    while (direction->head && direction->head->due_us <= now) {
+        struct segment *segment = direction->head;
+        if (segment->len == 0) {
+            shutdown(direction->to_fd, SHUT_WR);
+            direction->done = true;
+        }
+        while (segment->sent < segment->len) {
+            ssize_t sent = send(direction->to_fd, segment->data + segment->sent,
+                                segment->len - segment->sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Receiver is gone, nothing more can be delivered either way
+                exit(1);
+            }
+            segment->sent += sent;
+            __atomic_add_fetch(direction->bytes, sent, __ATOMIC_RELAXED);
+        }
+        direction->queued -= segment->len;
+        direction->head = segment->next;
+        if (!direction->head) {
+            direction->tail = NULL;
+        }
+        free(segment);
+    }
+    return false;
+}
+
+/*
+* Function: next_random()
+*   Advances the connection's xorshift generator.
+*   :return uint32_t: next pseudo-random value
+*/
+uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/*
+* Function: now_us()
+*   :return uint64_t: monotonic clock in microseconds
+*/
+uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+* Function: parse_backend()
+*   Parses "port" (this host) or "ipv4_address:port" into a backend address.
+*   :param const char *arg: backend argument
+*   :param struct sockaddr_in *address: address to fill in
+*   :return int: 0 on success, -1 if invalid
+*/
+int parse_backend(const char *arg, struct sockaddr_in *address) {
+    char host[32] = "127.0.0.1";
+    const char *port_text = arg;
+    const char *colon = strchr(arg, ':');
+
+    if (colon) {
+        size_t host_len = colon - arg;
+        if (host_len == 0 || host_len >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, arg, host_len);
+        host[host_len] = '\0';
+        port_text = colon + 1;
+    }
+    int port_num = atoi(port_text);
+    if (port_num <= 0 || port_num > 65535) {
+        return -1;
+    }
+    memset(address, '\0', sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port_num);
+    if (inet_pton(AF_INET, host, &address->sin_addr) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* Function: print_stats()
+*   Prints the link conditions and the proxy counters on one line.
+*   :param FILE *out: stream to print to
+*/
+void print_stats(FILE *out) {
+    fprintf(out, "netem delay_ms=%" PRIu64 " jitter_ms=%" PRIu64 " rate=%" PRIu64 "B/s "
+            "stalls_per_1000=%u stall_ms=%" PRIu64 " connections=%" PRIu64 " failed=%" PRIu64
+            " up_bytes=%" PRIu64 " down_bytes=%" PRIu64 " segments=%" PRIu64 " stalls=%" PRIu64 "\n",
+            delay_us / 1000, jitter_us / 1000, rate, stall_per_mille, stall_us / 1000,
+            __atomic_load_n(&shared->connections, __ATOMIC_RELAXED),
+            __atomic_load_n(&shared->failed, __ATOMIC_RELAXED),
+            __atomic_load_n(&shared->up_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&shared->down_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&shared->segments, __ATOMIC_RELAXED),
+            __atomic_load_n(&shared->stalls, __ATOMIC_RELAXED));
+    fflush(out);
+}
+
+/*
+* Function: on_signal()
+*   Requests a stats print (SIGUSR1).
+*   :param int signal_num: signal received
+*/
+void on_signal(int signal_num) {
+    if (signal_num == SIGUSR1) {
+        stats_requested = 1;
+    }
+}
+
+/*
+* Function: setup_socket()
+*   Sets up a socket address with port_num value.
+*   :param struct sockaddr_in* address: structure for socket address
+*   :param int port_num: port number for socket address
+*/
+void setup_socket(struct sockaddr_in* address, int port_num) {
+    // Clear out the address struct
+    memset((char*) address, '\0', sizeof(*address));
+
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Convert and store the port number in network byte order
+    address->sin_port = htons(port_num);
+    // Allow a client at any address to connect to this server
+    address->sin_addr.s_addr = INADDR_ANY;
+}
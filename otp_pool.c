@@ -0,0 +1,241 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <pthread.h>        // Thread functions
+#include "otp_pool.h"
+
+struct pool_member {
+    struct cipher_pool *pool;
+    int index;                      // Works on a job only if below the job's helpers
+    pthread_t thread;
+};
+
+struct cipher_pool {
+    struct pool_member members[POOL_MAX_THREADS];
+    int thread_count;               // Threads started (the caller also transforms blocks)
+    int max_threads;                // Threads the pool may start
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      // Signalled when a job starts or the pool stops
+    pthread_cond_t block_done;      // Signalled when a block is finished
+    bool stopping;
+    // Current job (guarded by lock)
+    transform_fn transform;
+    char *out;
+    const char *text;
+    const char *key_seq;
+    size_t len;
+    int helpers;                    // Threads allowed to work on the job
+    size_t block_count;
+    size_t next_claim;              // Next block no thread has started
+    size_t next_collect;            // Next block handed to the caller (caller only)
+    int active;                     // Blocks being transformed right now
+    unsigned char *done;            // Finished flag per block
+    size_t done_cap;
+};
+
+// Helper function declarations
+static void* pool_thread(void *arg);
+static void run_block(struct cipher_pool *pool, size_t block);
+
+/*
+* Function: pool_create()
+*   Creates a pool of up to thread_count - 1 threads (the thread collecting blocks
+*   is the last one). Threads are started by the first job that may use them.
+*   :param int thread_count: threads transforming a request (at least 2)
+*   :return struct cipher_pool*: pool or NULL if error
+*/
+struct cipher_pool* pool_create(int thread_count) {
+    if (thread_count > POOL_MAX_THREADS) {
+        thread_count = POOL_MAX_THREADS;
+    }
+    struct cipher_pool *pool = calloc(1, sizeof(struct cipher_pool));
+    if (!pool) {
+        perror("Error: failed to allocate cipher pool");
+        return NULL;
+    }
+    pool->max_threads = thread_count - 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->block_done, NULL);
+    return pool;
+}
+
+/*
+* Function: pool_start()
+*   Hands a request to the pool. The first helpers threads start on its first blocks
+*   at once; the rest sleep, so callers sharing the machine's cores can give a job
+*   fewer threads than the pool has. Threads missing so far are started here.
+*   Buffers must stay valid until pool_next_block() returns false or pool_finish().
+*   :param struct cipher_pool *pool: idle pool
+*   :param int helpers: threads besides the caller working on the job (0 = caller alone)
+*   :param transform_fn transform: server transform
+*   :param char *out: buffer of at least len characters for the result
+*   :param const char *text: plaintext or ciphertext characters
+*   :param size_t len: number of text characters
+*   :param const char *key_seq: key characters (at least len)
+*/
+void pool_start(struct cipher_pool *pool, int helpers, transform_fn transform, char *out,
+                const char *text, size_t len, const char *key_seq) {
+    size_t block_count = (len + POOL_BLOCK_SIZE - 1) / POOL_BLOCK_SIZE;
+
+    if (helpers > pool->max_threads) {
+        helpers = pool->max_threads;
+    }
+    while (pool->thread_count < helpers) {
+        struct pool_member *member = &pool->members[pool->thread_count];
+        member->pool = pool;
+        member->index = pool->thread_count;
+        if (pthread_create(&member->thread, NULL, pool_thread, member) != 0) {
+            // Run with the threads there are
+            perror("Error: failed to start cipher thread");
+            helpers = pool->thread_count;
+            break;
+        }
+        pool->thread_count++;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (block_count > pool->done_cap) {
+        unsigned char *done = realloc(pool->done, block_count);
+        if (!done) {
+            // Without flags nothing runs in parallel: transform here and hand back one block
+            pthread_mutex_unlock(&pool->lock);
+            transform(out, text, len, key_seq);
+            pthread_mutex_lock(&pool->lock);
+            block_count = 0;
+        } else {
+            pool->done = done;
+            pool->done_cap = block_count;
+        }
+    }
+    pool->transform = transform;
+    pool->out = out;
+    pool->text = text;
+    pool->key_seq = key_seq;
+    pool->len = len;
+    pool->helpers = helpers;
+    pool->block_count = block_count;
+    pool->next_claim = 0;
+    pool->next_collect = 0;
+    if (block_count > 0) {
+        memset(pool->done, 0, block_count);
+    }
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+* Function: pool_next_block()
+*   Waits for the next block in order to be finished. While it waits the caller
+*   transforms blocks no thread has claimed.
+*   :param struct cipher_pool *pool: pool running a job
+*   :param size_t *offset: set to offset of the block in the result
+*   :param size_t *block_len: set to number of result characters in the block
+*   :return bool: true if a block was returned, false once every block was returned
+*/
+bool pool_next_block(struct cipher_pool *pool, size_t *offset, size_t *block_len) {
+    if (pool->block_count == 0) {
+        // Job ran inline in pool_start(): whole result is one block
+        if (pool->len == 0) {
+            return false;
+        }
+        *offset = 0;
+        *block_len = pool->len;
+        pool->len = 0;
+        return true;
+    }
+    if (pool->next_collect == pool->block_count) {
+        return false;
+    }
+    size_t block = pool->next_collect++;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->done[block]) {
+        if (pool->next_claim < pool->block_count) {
+            run_block(pool, pool->next_claim++);
+        } else {
+            pthread_cond_wait(&pool->block_done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    *offset = block * POOL_BLOCK_SIZE;
+    *block_len = (block == pool->block_count - 1) ? pool->len - *offset : POOL_BLOCK_SIZE;
+    return true;
+}
+
+/*
+* Function: pool_finish()
+*   Abandons blocks not started yet and waits for running ones, so the job's
+*   buffers can be freed. Needed only when a job is not collected to the end.
+*   :param struct cipher_pool *pool: pool running a job
+*/
+void pool_finish(struct cipher_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->next_claim = pool->block_count;
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->block_done, &pool->lock);
+    }
+    pool->block_count = 0;
+    pool->len = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+* Function: pool_destroy()
+*   Stops and joins the threads and frees the pool.
+*   :param struct cipher_pool *pool: idle pool
+*/
+void pool_destroy(struct cipher_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->members[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->block_done);
+    free(pool->done);
+    free(pool);
+}
+
+/*
+* Function: pool_thread()
+*   Claims and transforms blocks of the jobs it may help with until the pool stops.
+*   :param void *arg: this thread's struct pool_member
+*   :return void*: NULL
+*/
+static void* pool_thread(void *arg) {
+    struct pool_member *member = arg;
+    struct cipher_pool *pool = member->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        if (member->index < pool->helpers && pool->next_claim < pool->block_count) {
+            run_block(pool, pool->next_claim++);
+        } else {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+* Function: run_block()
+*   Transforms one claimed block with the lock released. Called and returns
+*   with pool->lock held.
+*   :param struct cipher_pool *pool: pool running a job
+*   :param size_t block: index of the claimed block
+*/
+static void run_block(struct cipher_pool *pool, size_t block) {
+    size_t offset = block * POOL_BLOCK_SIZE;
+    size_t block_len = (block == pool->block_count - 1) ? pool->len - offset : POOL_BLOCK_SIZE;
+
+    pool->active++;
+    pthread_mutex_unlock(&pool->lock);
+    pool->transform(pool->out + offset, pool->text + offset, block_len, pool->key_seq + offset);
+    pthread_mutex_lock(&pool->lock);
+    pool->done[block] = 1;
+    pool->active--;
+    pthread_cond_broadcast(&pool->block_done);
+}
@@ -0,0 +1,34 @@
+#ifndef OTP_POOL_H
+#define OTP_POOL_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include "otp_server.h"     // Cipher transform type
+
+/*
+Module Name: Cipher Thread Pool
+Author: Jose Bianchi
+Description: Bounded pool of threads that applies a server transform to one large
+    request in parallel. The message is split into cache-sized blocks that threads
+    claim in order; the caller collects finished blocks in order with pool_next_block()
+    and can send each one while the rest are still being transformed. A caller waiting
+    on a block that no thread has claimed yet transforms it itself, so a pool never
+    makes a request slower than the single threaded loop. Each job says how many of
+    the pool's threads may help with it, and threads are only started once a job
+    may use them. Pools are created inside a worker process (threads do not survive
+    fork()).
+*/
+
+#define POOL_BLOCK_SIZE 262144      // Characters per block (fits a per-core L2 cache with key and result)
+#define POOL_MAX_THREADS 64
+
+struct cipher_pool;
+
+struct cipher_pool* pool_create(int thread_count);
+void pool_start(struct cipher_pool *pool, int helpers, transform_fn transform, char *out,
+                const char *text, size_t len, const char *key_seq);
+bool pool_next_block(struct cipher_pool *pool, size_t *offset, size_t *block_len);
+void pool_finish(struct cipher_pool *pool);
+void pool_destroy(struct cipher_pool *pool);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef OTP_PROTOCOL_H
+#define OTP_PROTOCOL_H
+
+/*
+Module Name: Protocol Constants
+Author: Jose Bianchi
+Description: Client ID codes and access responses shared by the servers and the
+    client library. A client appends KEEP_ALIVE_SUFFIX to its ID code to ask the
+    server to keep the connection open for further requests (Parts 2-5 repeated)
+    until the client closes it. Results only contain uppercase letters and spaces,
+    so a server refusing a request answers with a lowercase status word instead
+    (BUSY_REPLY, TOO_BIG_REPLY, KEY_SHORT_REPLY, TIMEOUT_REPLY) and closes the
+    connection.
+
+    A TCP client appending RESUME_SUFFIX instead opens a resumable session. After the
+    access response it sends a session header: token (SESSION_TOKEN_LEN characters,
+    all '0' for a new session), key length, message length and the result characters
+    it already has (big-endian uint64 each). The server answers with the token and
+    the input characters it has stored (big-endian uint64), or a status word
+    (NO_SESSION_REPLY if the token is unknown or expired). The client then sends the
+    key followed by the message from that offset, and the server answers with the
+    result from the client's offset. A client whose connection drops reconnects
+    with the token and continues where the transfer stopped. The session ends when
+    the client closes the connection after the whole result.
+*/
+
+#define ENC_CLIENT_CODE "4321"
+#define DEC_CLIENT_CODE "1234"
+#define ENC_ACCEPT_REPLY "enc"
+#define DEC_ACCEPT_REPLY "dec"
+#define REJECT_REPLY "reject"
+#define KEEP_ALIVE_SUFFIX "K"
+#define RESUME_SUFFIX "R"
+#define SESSION_TOKEN_LEN 32
+#define SESSION_HEADER_SIZE (SESSION_TOKEN_LEN + 24)
+#define SESSION_REPLY_SIZE (SESSION_TOKEN_LEN + 8)
+#define BUSY_REPLY "busy"           // No worker or byte budget free in time
+#define TOO_BIG_REPLY "toobig"      // Key or message over the server size limit
+#define KEY_SHORT_REPLY "keyshort"  // Key shorter than the message
+#define TIMEOUT_REPLY "timeout"     // Request missed a deadline and was cut off
+#define NO_SESSION_REPLY "nosession"  // Resumed session unknown or expired
+
+#endif
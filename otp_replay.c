@@ -0,0 +1,345 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <inttypes.h>       // Fixed width format macros
+#include <string.h>         // String functions
+#include <unistd.h>         // Process management/ file operations
+#include <poll.h>           // Descriptor readiness functions
+#include <time.h>           // Clock functions
+#include "otp_client.h"     // Client library (libotpclient)
+#include "otp_async.h"      // Pipelined requests
+#include "otp_trace.h"      // Trace file format
+
+#define REPLAY_USAGE "USAGE: %s [-x speed] trace_file port\n"
+#define STATUS_SLOTS 16             // Distinct OTP_ERR_* codes counted in the report
+
+/*
+Program Name: Trace Replay
+Author: Jose Bianchi
+Description: Program is part of encryption/ decryption prgram for converting
+    plaintext data into ciphertext, using a key via the one-time pad-like approach.
+    This specific program replays a request trace written by enc_server or dec_server
+    (-L trace_file) against a server on this host, so engines and tunings can be
+    compared on production-shaped load. Every traced connection is opened when its
+    first request is due and closed after its last one, and each request is sent at
+    its traced arrival time, divided by the -x speed factor (default 1, 0 sends
+    everything at once), whether or not earlier responses came back. Key and message
+    are synthetic A-Z/ space characters of the traced sizes, the same on every run.
+    All requests go over TCP keep-alive connections, including ones traced from the
+    UNIX socket; refused requests are replayed too, continuation connections of
+    resumable sessions are not. Prints a summary of outcomes and latencies (from the
+    time a request was due to its response) when the last request completes.
+*/
+
+struct replay_request {
+    const struct trace_record *record;
+    struct replay_conn *conn;       // Connection the request was traced on
+    uint64_t due_us;                // Send time, since replay start
+    uint64_t done_us;               // Completion time, since replay start
+    int status;
+};
+
+struct replay_conn {
+    struct otp_async *loop;         // Open while the traced connection has requests left
+    size_t remaining;               // Requests not yet submitted
+    bool failed;                    // Connect failed, remaining requests fail too
+};
+
+// Helper function declarations
+uint64_t now_us(const struct timespec *start);
+bool replayable(const struct trace_record *record);
+int by_arrival(const void *a, const void *b);
+int by_number(const void *a, const void *b);
+void on_complete(void *user_data, int status, const char *result, size_t result_len);
+int by_latency(const void *a, const void *b);
+void print_report(struct replay_request *requests, size_t count, size_t skipped, uint64_t elapsed_us);
+
+static struct timespec replay_start;
+
+int main(int argc, char *argv[]) {
+    struct trace_header header;
+    struct trace_record *records;
+    size_t record_count;
+    double speed = 1.0;
+    int option;
+
+    // Validate input
+    while ((option = getopt(argc, argv, "x:")) != -1) {
+        switch (option) {
+            case 'x':
+                speed = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, REPLAY_USAGE, argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 2 || speed < 0) {
+        fprintf(stderr, REPLAY_USAGE, argv[0]);
+        exit(1);
+    }
+    const char *target = argv[optind + 1];
+    if (trace_read(argv[optind], &header, &records, &record_count) < 0) {
+        exit(1);
+    }
+    enum otp_service service = (strcmp(header.name, otp_server_name(OTP_DECRYPT)) == 0) ? OTP_DECRYPT : OTP_ENCRYPT;
+    // Records are written in completion order, requests are replayed in arrival order
+    qsort(records, record_count, sizeof(struct trace_record), by_arrival);
+    struct replay_request *requests = calloc(record_count + 1, sizeof(struct replay_request));
+    size_t count = 0;
+    size_t skipped = 0;
+    uint64_t max_key_len = 0;
+    for (size_t i = 0; requests && i < record_count; i++) {
+        if (!replayable(&records[i])) {
+            skipped++;
+            continue;
+        }
+        requests[count].record = &records[i];
+        requests[count].status = 1;             // Not completed yet
+        count++;
+        max_key_len = (records[i].key_len > max_key_len) ? records[i].key_len : max_key_len;
+    }
+    // One synthetic key serves as both key and text: requests only need the sizes
+    char *synthetic = malloc(max_key_len + 1);
+    uint32_t *numbers = malloc((count + 1) * sizeof(uint32_t));
+    if (!requests || !synthetic || !numbers) {
+        perror("Error: failed to allocate memory for replay");
+        exit(1);
+    }
+    // Connection numbers come from the trace file: remap them to dense indexes so the
+    // connection tables are sized by the requests, not by the largest number
+    for (size_t i = 0; i < count; i++) {
+        numbers[i] = requests[i].record->connection;
+    }
+    qsort(numbers, count, sizeof(uint32_t), by_number);
+    size_t conn_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (conn_count == 0 || numbers[i] != numbers[conn_count - 1]) {
+            numbers[conn_count++] = numbers[i];
+        }
+    }
+    struct replay_conn *conns = calloc(conn_count + 1, sizeof(struct replay_conn));
+    if (!conns) {
+        perror("Error: failed to allocate memory for replay");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t *number = bsearch(&requests[i].record->connection, numbers, conn_count, sizeof(uint32_t), by_number);
+        requests[i].conn = &conns[number - numbers];
+    }
+    free(numbers);
+    uint32_t seed = 1;
+    for (uint64_t i = 0; i < max_key_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        synthetic[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ "[(seed >> 16) % 27];
+    }
+    uint64_t first_arrival = (count > 0) ? requests[0].record->arrival_us : 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t offset = requests[i].record->arrival_us - first_arrival;
+        requests[i].due_us = (speed > 0) ? (uint64_t)(offset / speed) : 0;
+        requests[i].conn->remaining++;
+    }
+    fprintf(stderr, "replaying %zu requests of %s over %s\n", count, header.name, target);
+
+    // Event loop: submit requests as they fall due, run connections with activity
+    struct pollfd *waiters = calloc(conn_count + 1, sizeof(struct pollfd));
+    struct replay_conn **ready = calloc(conn_count + 1, sizeof(struct replay_conn *));
+    if (!waiters || !ready) {
+        perror("Error: failed to allocate memory for replay");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &replay_start);
+    size_t next = 0;
+    size_t open_count = 0;
+    while (next < count || open_count > 0) {
+        uint64_t now = now_us(&replay_start);
+        for (; next < count && requests[next].due_us <= now; next++) {
+            struct replay_request *request = &requests[next];
+            struct replay_conn *conn = request->conn;
+            int status = OTP_OK;
+            conn->remaining--;
+            if (!conn->loop && !conn->failed) {
+                conn->loop = otp_async_create(service, target, 1, &status);
+                conn->failed = (conn->loop == NULL);
+                open_count += (conn->loop != NULL);
+            }
+            if (conn->loop) {
+                status = otp_async_submit(conn->loop, synthetic, request->record->key_len, synthetic,
+                                          request->record->msg_len, on_complete, request);
+            }
+            if (!conn->loop || status != OTP_OK) {
+                on_complete(request, conn->loop ? status : OTP_ERR_CONNECT, NULL, 0);
+            }
+        }
+        // Wait for connection activity or the next request falling due
+        int waiter_count = 0;
+        for (size_t i = 0; i < conn_count; i++) {
+            if (conns[i].loop) {
+                waiters[waiter_count].fd = otp_async_fd(conns[i].loop);
+                waiters[waiter_count].events = POLLIN;
+                ready[waiter_count++] = &conns[i];
+            }
+        }
+        int timeout_ms = -1;
+        if (next < count) {
+            uint64_t due = requests[next].due_us;
+            now = now_us(&replay_start);
+            timeout_ms = (due > now) ? (int)((due - now + 999) / 1000) : 0;
+        }
+        if (waiter_count == 0 && timeout_ms < 0) {
+            break;
+        }
+        poll(waiters, waiter_count, timeout_ms);
+        for (int i = 0; i < waiter_count; i++) {
+            struct replay_conn *conn = ready[i];
+            if (waiters[i].revents) {
+                otp_async_run(conn->loop, 0);
+            }
+            // Close a traced connection once its last request is answered
+            if (conn->remaining == 0 && otp_async_pending(conn->loop) == 0) {
+                otp_async_destroy(conn->loop);
+                conn->loop = NULL;
+                open_count--;
+            }
+        }
+    }
+    print_report(requests, count, skipped, now_us(&replay_start));
+    free(waiters);
+    free(ready);
+    free(conns);
+    free(synthetic);
+    free(requests);
+    free(records);
+    return 0;
+}
+
+/*
+* Function: now_us()
+*   :param const struct timespec *start: monotonic start time
+*   :return uint64_t: microseconds since start
+*/
+uint64_t now_us(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+* Function: replayable()
+*   :param const struct trace_record *record: traced request
+*   :return bool: true if the request can be sent as a TCP request
+*/
+bool replayable(const struct trace_record *record) {
+    return record->msg_len > 0 && record->key_len >= record->msg_len && !(record->flags & TRACE_RESUMED);
+}
+
+/*
+* Function: by_arrival()
+*   qsort() comparison of trace records by arrival time, then connection order.
+*   :param const void *a: first record
+*   :param const void *b: second record
+*   :return int: negative, zero or positive
+*/
+int by_arrival(const void *a, const void *b) {
+    const struct trace_record *first = a;
+    const struct trace_record *second = b;
+
+    if (first->arrival_us != second->arrival_us) {
+        return (first->arrival_us < second->arrival_us) ? -1 : 1;
+    }
+    if (first->connection != second->connection) {
+        return (first->connection < second->connection) ? -1 : 1;
+    }
+    return (first->sequence < second->sequence) ? -1 : (first->sequence > second->sequence);
+}
+
+/*
+* Function: by_number()
+*   qsort()/ bsearch() comparison of connection numbers.
+*   :param const void *a: first number
+*   :param const void *b: second number
+*   :return int: negative, zero or positive
+*/
+int by_number(const void *a, const void *b) {
+    uint32_t first = *(const uint32_t *)a;
+    uint32_t second = *(const uint32_t *)b;
+
+    return (first > second) - (first < second);
+}
+
+/*
+* Function: on_complete()
+*   Completion callback: notes when and how a replayed request finished.
+*   :param void *user_data: the replay_request
+*   :param int status: OTP_OK or OTP_ERR_* status
+*   :param const char *result: result characters (unused)
+*   :param size_t result_len: number of result characters (unused)
+*/
+void on_complete(void *user_data, int status, const char *result, size_t result_len) {
+    struct replay_request *request = user_data;
+
+    (void)result;
+    (void)result_len;
+    request->done_us = now_us(&replay_start);
+    request->status = status;
+}
+
+/*
+* Function: by_latency()
+*   qsort() comparison of latencies.
+*   :param const void *a: first latency
+*   :param const void *b: second latency
+*   :return int: negative, zero or positive
+*/
+int by_latency(const void *a, const void *b) {
+    uint64_t first = *(const uint64_t *)a;
+    uint64_t second = *(const uint64_t *)b;
+    return (first < second) ? -1 : (first > second);
+}
+
+/*
+* Function: print_report()
+*   Prints outcome counts, message throughput and latency percentiles of
+*   successful requests to stdout.
+*   :param struct replay_request *requests: replayed requests
+*   :param size_t count: number of requests
+*   :param size_t skipped: trace records not replayed
+*   :param uint64_t elapsed_us: replay duration
+*/
+void print_report(struct replay_request *requests, size_t count, size_t skipped, uint64_t elapsed_us) {
+    size_t status_counts[STATUS_SLOTS] = {0};
+    uint64_t *latencies = malloc((count + 1) * sizeof(uint64_t));
+    size_t ok_count = 0;
+    uint64_t bytes = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int status = requests[i].status;
+        status_counts[(status <= 0 && -status < STATUS_SLOTS) ? -status : STATUS_SLOTS - 1]++;
+        if (status == OTP_OK) {
+            bytes += requests[i].record->msg_len;
+            if (latencies) {
+                latencies[ok_count] = requests[i].done_us - requests[i].due_us;
+            }
+            ok_count++;
+        }
+    }
+    double seconds = elapsed_us / 1e6;
+    printf("requests=%zu ok=%zu skipped=%zu elapsed=%.3fs throughput=%.1fMB/s rate=%.1freq/s\n",
+           count, ok_count, skipped, seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+           seconds > 0 ? ok_count / seconds : 0.0);
+    for (int i = 1; i < STATUS_SLOTS; i++) {
+        if (status_counts[i] > 0) {
+            printf("  failed: %zu %s\n", status_counts[i],
+                   (i == STATUS_SLOTS - 1) ? "unknown" : otp_strerror(-i));
+        }
+    }
+    if (latencies && ok_count > 0) {
+        qsort(latencies, ok_count, sizeof(uint64_t), by_latency);
+        printf("latency_ms p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+               latencies[ok_count / 2] / 1e3, latencies[ok_count * 90 / 100] / 1e3,
+               latencies[ok_count * 99 / 100] / 1e3, latencies[ok_count - 1] / 1e3);
+    }
+    free(latencies);
+}
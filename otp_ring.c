@@ -0,0 +1,494 @@
+#define _GNU_SOURCE                 // memfd_create()
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <arpa/inet.h>      // Internet functions
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <sys/syscall.h>    // Raw system call numbers
+#include <linux/futex.h>    // Futex operations
+#include <unistd.h>         // Process management/ file operations
+#include <sched.h>          // Processor yield
+#include <poll.h>           // Descriptor readiness functions
+#include <time.h>           // Time structures
+#include "otp_ring.h"
+#include "otp_unix.h"
+
+// Helper function declarations
+static void ring_relax(void);
+static void futex_wait(uint32_t *word, uint32_t expected, int timeout_ms);
+static void futex_wake(uint32_t *word);
+static bool ring_in_bounds(struct otp_ring *ring, uint32_t distance);
+
+/*
+* Function: ring_connect()
+*   Creates a shared ring, connects to the server UNIX-domain socket at socket_path,
+*   identifies with the client ID code and passes the ring to the server.
+*   :param const char *socket_path: filepath of server UNIX-domain socket
+*   :param const char *code: client ID code for the server
+*   :param const char *reply: access response expected from the server
+*   :return struct otp_ring*: ring handle or NULL if error
+*/
+struct otp_ring* ring_connect(const char *socket_path, const char *code, const char *reply) {
+    struct sockaddr_un server_address;
+    char access_response[10];
+
+    struct otp_ring *ring = calloc(1, sizeof(struct otp_ring));
+    if (!ring) {
+        perror("Error: failed to allocate memory for ring");
+        return NULL;
+    }
+    ring->is_server = false;
+    ring->socket_fd = -1;
+    ring->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_COUNT : 0;
+    ring->memfd = memfd_create("otp_ring", MFD_CLOEXEC);
+    if (ring->memfd < 0 || ftruncate(ring->memfd, sizeof(struct ring_shared)) < 0) {
+        perror("Error: failed to create shared ring");
+        if (ring->memfd >= 0) {
+            close(ring->memfd);
+        }
+        free(ring);
+        return NULL;
+    }
+    ring->shared = mmap(NULL, sizeof(struct ring_shared), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, ring->memfd, 0);
+    if (ring->shared == MAP_FAILED) {
+        perror("Error: failed to map shared ring");
+        close(ring->memfd);
+        free(ring);
+        return NULL;
+    }
+    // Mapping of a fresh memfd is zero filled, only the header needs values
+    ring->shared->magic = RING_MAGIC;
+    ring->shared->slot_count = RING_SLOT_COUNT;
+    ring->shared->slot_data = RING_SLOT_DATA;
+
+    ring->socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ring->socket_fd < 0 || setup_unix_socket(&server_address, socket_path) < 0 ||
+            connect(ring->socket_fd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
+        perror("Error: failed to connect to server");
+        ring_close(ring);
+        return NULL;
+    }
+    // Identify self to server and hand over the ring
+    memset(access_response, '\0', sizeof(access_response));
+    if (send(ring->socket_fd, code, strlen(code), MSG_NOSIGNAL) < 0 ||
+            recv(ring->socket_fd, access_response, sizeof(access_response) - 1, 0) < 0 ||
+            strcmp(access_response, reply) != 0) {
+        fprintf(stderr, "Error: could not contact server on socket %s\n", socket_path);
+        ring_close(ring);
+        return NULL;
+    }
+    if (send_fds(ring->socket_fd, UNIX_MODE_RING, &ring->memfd, 1) < 0) {
+        perror("Error: failed to pass ring to server");
+        ring_close(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/*
+* Function: ring_attach()
+*   Maps a ring passed by a client and checks its layout matches this build.
+*   :param int socket_fd: connected UNIX-domain client socket
+*   :param int memfd: shared memory descriptor received from the client
+*   :return struct otp_ring*: ring handle or NULL if error
+*/
+struct otp_ring* ring_attach(int socket_fd, int memfd) {
+    struct stat ring_info;
+
+    if (fstat(memfd, &ring_info) < 0 || ring_info.st_size < (off_t)sizeof(struct ring_shared)) {
+        fprintf(stderr, "Error: client ring has wrong size\n");
+        return NULL;
+    }
+    struct otp_ring *ring = calloc(1, sizeof(struct otp_ring));
+    if (!ring) {
+        perror("Error: failed to allocate memory for ring");
+        return NULL;
+    }
+    ring->shared = mmap(NULL, sizeof(struct ring_shared), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, memfd, 0);
+    if (ring->shared == MAP_FAILED) {
+        perror("Error: failed to map client ring");
+        free(ring);
+        return NULL;
+    }
+    if (ring->shared->magic != RING_MAGIC || ring->shared->slot_count != RING_SLOT_COUNT ||
+            ring->shared->slot_data != RING_SLOT_DATA) {
+        fprintf(stderr, "Error: client ring layout does not match server\n");
+        munmap(ring->shared, sizeof(struct ring_shared));
+        free(ring);
+        return NULL;
+    }
+    ring->socket_fd = socket_fd;
+    ring->memfd = memfd;
+    ring->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_COUNT : 0;
+    ring->is_server = true;
+    // From here on the client's copies of the server-owned indices are never read
+    ring->produced = __atomic_load_n(&ring->shared->responses.head, __ATOMIC_RELAXED);
+    ring->consumed = __atomic_load_n(&ring->shared->requests.tail, __ATOMIC_RELAXED);
+    return ring;
+}
+
+/*
+* Function: ring_submit()
+*   Copies one request into the next free request slot and publishes it.
+*   Blocks while the ring is full.
+*   :param struct otp_ring *ring: client ring handle
+*   :param uint64_t id: caller tag returned with the response
+*   :param const char *key: key sequence characters
+*   :param size_t key_len: number of key characters
+*   :param const char *msg: message characters
+*   :param size_t msg_len: number of message characters
+*   :return int: 0 on success, -1 if request does not fit a slot or server exited
+*/
+int ring_submit(struct otp_ring *ring, uint64_t id, const char *key, size_t key_len,
+                const char *msg, size_t msg_len) {
+    if (key_len + msg_len > RING_SLOT_DATA) {
+        fprintf(stderr, "Error: request too large for ring slot\n");
+        return -1;
+    }
+    struct ring_slot *slot = ring_reserve(ring, &ring->shared->requests);
+    if (!slot) {
+        return -1;
+    }
+    slot->id = id;
+    slot->key_len = key_len;
+    slot->msg_len = msg_len;
+    memcpy(slot->data, key, key_len);
+    memcpy(slot->data + key_len, msg, msg_len);
+    ring_publish(ring, &ring->shared->requests);
+    return 0;
+}
+
+/*
+* Function: ring_collect()
+*   Waits for the next response and copies it out. Responses arrive in the
+*   order requests were submitted.
+*   :param struct otp_ring *ring: client ring handle
+*   :param uint64_t *id: set to caller tag of the request
+*   :param char *out: buffer of at least RING_SLOT_DATA characters for the result
+*   :param size_t *out_len: set to number of result characters
+*   :return int: UNIX_STATUS_* code of the request, -1 if server exited
+*/
+int ring_collect(struct otp_ring *ring, uint64_t *id, char *out, size_t *out_len) {
+    struct ring_slot *slot = ring_peek(ring, &ring->shared->responses);
+    if (!slot) {
+        return -1;
+    }
+    int status = slot->status;
+    *id = slot->id;
+    *out_len = 0;
+    if (status == UNIX_STATUS_OK && slot->msg_len <= RING_SLOT_DATA) {
+        memcpy(out, slot->data, slot->msg_len);
+        *out_len = slot->msg_len;
+    }
+    ring_release(ring, &ring->shared->responses);
+    return status;
+}
+
+/*
+* Function: ring_close()
+*   Tells the server no more requests follow and releases the ring.
+*   :param struct otp_ring *ring: ring handle
+*/
+void ring_close(struct otp_ring *ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->shared && ring->shared != MAP_FAILED) {
+        if (!ring->is_server) {
+            __atomic_store_n(&ring->shared->closed, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&ring->shared->requests.head);
+        }
+        munmap(ring->shared, sizeof(struct ring_shared));
+    }
+    if (ring->socket_fd >= 0) {
+        close(ring->socket_fd);
+    }
+    if (ring->memfd >= 0) {
+        close(ring->memfd);
+    }
+    free(ring);
+}
+
+/*
+* Function: ring_reserve()
+*   Producer side: returns the next free slot of queue, waiting while it is full.
+*   Slot is handed to the consumer with ring_publish().
+*   :param struct otp_ring *ring: ring handle (used to check the peer is alive)
+*   :param struct ring_queue *queue: queue this side produces into
+*   :return struct ring_slot*: free slot or NULL if the peer exited or broke the ring
+*/
+struct ring_slot* ring_reserve(struct otp_ring *ring, struct ring_queue *queue) {
+    uint32_t head = ring->produced;
+    int spins = 0;
+    while (1) {
+        uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        if (!ring_in_bounds(ring, head - tail)) {
+            return NULL;
+        }
+        if (head - tail < RING_SLOT_COUNT) {
+            return &queue->slots[head & (RING_SLOT_COUNT - 1)];
+        }
+        if (spins++ < ring->spin_limit) {
+            ring_relax();
+            continue;
+        }
+        // Announce sleep, then re-check so a release in between is not missed
+        __atomic_store_n(&queue->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+        if (head - tail >= RING_SLOT_COUNT) {
+            futex_wait(&queue->tail, tail, RING_WAIT_MS);
+        }
+        __atomic_store_n(&queue->producer_waiting, 0, __ATOMIC_RELAXED);
+        if (!ring_peer_alive(ring)) {
+            return NULL;
+        }
+        spins = 0;
+    }
+}
+
+/*
+* Function: ring_publish()
+*   Producer side: hands the reserved slot to the consumer. Only makes a system
+*   call if the consumer is asleep.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side produces into
+*/
+void ring_publish(struct otp_ring *ring, struct ring_queue *queue) {
+    ring_publish_count(ring, queue, 1);
+}
+
+/*
+* Function: ring_reserve_at()
+*   Producer side: returns the free slot offset places after the next one, for
+*   filling several slots before publishing them together. The caller checks
+*   ring_space() first.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side produces into
+*   :param uint32_t offset: slots past the next free slot
+*   :return struct ring_slot*: free slot
+*/
+struct ring_slot* ring_reserve_at(struct otp_ring *ring, struct ring_queue *queue, uint32_t offset) {
+    return &queue->slots[(ring->produced + offset) & (RING_SLOT_COUNT - 1)];
+}
+
+/*
+* Function: ring_space()
+*   Producer side: counts the free slots of queue without waiting.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side produces into
+*   :return uint32_t: number of free slots, 0 if the peer broke the ring
+*/
+uint32_t ring_space(struct otp_ring *ring, struct ring_queue *queue) {
+    uint32_t used = ring->produced - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    return ring_in_bounds(ring, used) ? RING_SLOT_COUNT - used : 0;
+}
+
+/*
+* Function: ring_publish_count()
+*   Producer side: hands count filled slots to the consumer with one store, so a
+*   batch costs one wake up at most.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side produces into
+*   :param uint32_t count: number of slots filled
+*/
+void ring_publish_count(struct otp_ring *ring, struct ring_queue *queue, uint32_t count) {
+    ring->produced += count;
+    __atomic_store_n(&queue->head, ring->produced, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->consumer_waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&queue->head);
+    }
+}
+
+/*
+* Function: ring_peek()
+*   Consumer side: returns the oldest published slot of queue, waiting while it
+*   is empty. Slot is returned to the producer with ring_release().
+*   :param struct otp_ring *ring: ring handle (used to check the peer is alive)
+*   :param struct ring_queue *queue: queue this side consumes from
+*   :return struct ring_slot*: published slot or NULL if the ring was closed, peer exited
+*                              or peer broke the ring
+*/
+struct ring_slot* ring_peek(struct otp_ring *ring, struct ring_queue *queue) {
+    uint32_t tail = ring->consumed;
+    int spins = 0;
+    while (1) {
+        uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (!ring_in_bounds(ring, head - tail)) {
+            return NULL;
+        }
+        if (head != tail) {
+            return &queue->slots[tail & (RING_SLOT_COUNT - 1)];
+        }
+        if (ring->is_server && __atomic_load_n(&ring->shared->closed, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        if (spins++ < ring->spin_limit) {
+            ring_relax();
+            continue;
+        }
+        // Announce sleep, then re-check so a publish in between is not missed
+        __atomic_store_n(&queue->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST);
+        if (head == tail) {
+            futex_wait(&queue->head, head, RING_WAIT_MS);
+        }
+        __atomic_store_n(&queue->consumer_waiting, 0, __ATOMIC_RELAXED);
+        if (!ring_peer_alive(ring)) {
+            return NULL;
+        }
+        spins = 0;
+    }
+}
+
+/*
+* Function: ring_release()
+*   Consumer side: returns the peeked slot to the producer. Only makes a system
+*   call if the producer is asleep.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side consumes from
+*/
+void ring_release(struct otp_ring *ring, struct ring_queue *queue) {
+    ring_release_count(ring, queue, 1);
+}
+
+/*
+* Function: ring_peek_at()
+*   Consumer side: returns the published slot offset places after the oldest one.
+*   The caller checks ring_wait_ready() first.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side consumes from
+*   :param uint32_t offset: slots past the oldest published slot
+*   :return struct ring_slot*: published slot
+*/
+struct ring_slot* ring_peek_at(struct otp_ring *ring, struct ring_queue *queue, uint32_t offset) {
+    return &queue->slots[(ring->consumed + offset) & (RING_SLOT_COUNT - 1)];
+}
+
+/*
+* Function: ring_wait_ready()
+*   Consumer side: waits up to window_us for want published slots, spinning (or
+*   yielding the CPU to the producer on a single CPU) instead of sleeping, since
+*   the window is short. Returns early if the producer closed the ring.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side consumes from
+*   :param uint32_t want: number of slots worth waiting for
+*   :param long window_us: longest wait in microseconds (0 = only count)
+*   :return uint32_t: number of published slots, 0 if the peer broke the ring
+*/
+uint32_t ring_wait_ready(struct otp_ring *ring, struct ring_queue *queue, uint32_t want, long window_us) {
+    uint32_t tail = ring->consumed;
+    uint32_t ready = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - tail;
+    struct timespec start;
+    struct timespec now;
+
+    if (!ring_in_bounds(ring, ready)) {
+        return 0;
+    }
+    if (ready >= want || window_us <= 0) {
+        return ready;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (ready < want && !__atomic_load_n(&ring->shared->closed, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 >= window_us) {
+            break;
+        }
+        if (ring->spin_limit > 0) {
+            ring_relax();
+        } else {
+            sched_yield();
+        }
+        ready = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - tail;
+    }
+    return ring_in_bounds(ring, ready) ? ready : 0;
+}
+
+/*
+* Function: ring_release_count()
+*   Consumer side: returns count peeked slots to the producer with one store.
+*   :param struct otp_ring *ring: ring handle
+*   :param struct ring_queue *queue: queue this side consumes from
+*   :param uint32_t count: number of slots consumed
+*/
+void ring_release_count(struct otp_ring *ring, struct ring_queue *queue, uint32_t count) {
+    ring->consumed += count;
+    __atomic_store_n(&queue->tail, ring->consumed, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->producer_waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&queue->tail);
+    }
+}
+
+/*
+* Function: ring_peer_alive()
+*   Checks without blocking whether the other side still holds the UNIX socket.
+*   Only called after an idle futex wait, never on the request path.
+*   :param struct otp_ring *ring: ring handle
+*   :return bool: false once the peer closed its end or exited
+*/
+bool ring_peer_alive(struct otp_ring *ring) {
+    struct pollfd peer = { .fd = ring->socket_fd, .events = POLLIN };
+    char byte;
+
+    if (poll(&peer, 1, 0) <= 0) {
+        return true;
+    }
+    if (peer.revents & (POLLHUP | POLLERR)) {
+        return false;
+    }
+    return recv(ring->socket_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) != 0;
+}
+
+/*
+* Function: ring_in_bounds()
+*   Checks a distance between a head and a tail index read from shared memory. The
+*   peer can write any value there; more than a ring apart means it broke the
+*   protocol, and the ring is marked broken so every later call fails too.
+*   :param struct otp_ring *ring: ring handle
+*   :param uint32_t distance: head minus tail
+*   :return bool: false if the distance is more than RING_SLOT_COUNT
+*/
+static bool ring_in_bounds(struct otp_ring *ring, uint32_t distance) {
+    if (distance > RING_SLOT_COUNT && !ring->broken) {
+        fprintf(stderr, "Error: ring peer moved indices out of bounds\n");
+        ring->broken = true;
+    }
+    return !ring->broken;
+}
+
+/*
+* Function: ring_relax()
+*   Hints to the CPU that the caller is spinning on shared memory.
+*/
+static void ring_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+* Function: futex_wait()
+*   Sleeps until word is woken or no longer holds expected, or timeout passes.
+*   :param uint32_t *word: futex word in shared memory
+*   :param uint32_t expected: value word held when caller decided to sleep
+*   :param int timeout_ms: maximum sleep in milliseconds
+*/
+static void futex_wait(uint32_t *word, uint32_t expected, int timeout_ms) {
+    struct timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+/*
+* Function: futex_wake()
+*   Wakes the process sleeping on word, if any.
+*   :param uint32_t *word: futex word in shared memory
+*/
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
@@ -0,0 +1,89 @@
+#ifndef OTP_RING_H
+#define OTP_RING_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Shared Memory Ring Transport
+Author: Jose Bianchi
+Description: Lock-free single-producer/ single-consumer rings of request and response
+    slots in a memfd shared between one client and one server child. The client creates
+    the mapping and passes it to the server over the UNIX-domain socket (mode 'R').
+    Each side busy-polls the ring and only sleeps on a futex once the ring has been idle
+    for a while, so steady-state requests make no system calls. Slots are transformed in
+    place by the server: request slot in, response slot out, no extra copies.
+*/
+
+#define RING_MAGIC 0x4f545052       // "OTPR"
+#define RING_SLOT_COUNT 256         // Slots per direction (power of two)
+#define RING_SLOT_DATA 4096         // Key + message bytes carried per request slot
+#define RING_SPIN_COUNT 4096        // Empty/ full polls before sleeping on the futex
+#define RING_WAIT_MS 100            // Futex sleep before checking the peer is alive
+
+struct ring_slot {
+    uint64_t id;                    // Caller tag, echoed in the response
+    uint32_t key_len;               // Request: key characters at start of data
+    uint32_t msg_len;               // Request: message characters after key/ Response: result length
+    int32_t status;                 // Response: UNIX_STATUS_* code
+    uint32_t reserved;
+    char data[RING_SLOT_DATA];
+};
+
+struct ring_queue {
+    // Producer and consumer indices live on separate cache lines
+    uint32_t head __attribute__((aligned(64)));     // Next slot written by producer
+    uint32_t producer_waiting;                      // Producer asleep on tail (ring full)
+    uint32_t tail __attribute__((aligned(64)));     // Next slot read by consumer
+    uint32_t consumer_waiting;                      // Consumer asleep on head (ring empty)
+    struct ring_slot slots[RING_SLOT_COUNT] __attribute__((aligned(64)));
+};
+
+struct ring_shared {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint32_t slot_data;
+    uint32_t closed;                // Set by client when no more requests follow
+    struct ring_queue requests;     // Client produces, server consumes
+    struct ring_queue responses;    // Server produces, client consumes
+};
+
+struct otp_ring {
+    struct ring_shared *shared;
+    int socket_fd;                  // UNIX socket kept open to detect peer exit
+    int memfd;
+    int spin_limit;                 // RING_SPIN_COUNT, or 0 on a single CPU
+    bool is_server;
+    bool broken;                    // Peer moved its indices more than a ring apart
+    // Private copies of the indices this side owns; the shared ones are only written
+    uint32_t produced;              // Head of the queue this side produces into
+    uint32_t consumed;              // Tail of the queue this side consumes from
+};
+
+// Client side
+struct otp_ring* ring_connect(const char *socket_path, const char *code, const char *reply);
+int ring_submit(struct otp_ring *ring, uint64_t id, const char *key, size_t key_len,
+                const char *msg, size_t msg_len);
+int ring_collect(struct otp_ring *ring, uint64_t *id, char *out, size_t *out_len);
+void ring_close(struct otp_ring *ring);
+
+// Server side
+struct otp_ring* ring_attach(int socket_fd, int memfd);
+
+// Queue primitives shared by both sides
+struct ring_slot* ring_reserve(struct otp_ring *ring, struct ring_queue *queue);
+void ring_publish(struct otp_ring *ring, struct ring_queue *queue);
+struct ring_slot* ring_peek(struct otp_ring *ring, struct ring_queue *queue);
+void ring_release(struct otp_ring *ring, struct ring_queue *queue);
+
+// Batches: several slots reserved/ peeked, then published/ released with one store
+struct ring_slot* ring_reserve_at(struct otp_ring *ring, struct ring_queue *queue, uint32_t offset);
+uint32_t ring_space(struct otp_ring *ring, struct ring_queue *queue);
+void ring_publish_count(struct otp_ring *ring, struct ring_queue *queue, uint32_t count);
+struct ring_slot* ring_peek_at(struct otp_ring *ring, struct ring_queue *queue, uint32_t offset);
+uint32_t ring_wait_ready(struct otp_ring *ring, struct ring_queue *queue, uint32_t want, long window_us);
+void ring_release_count(struct otp_ring *ring, struct ring_queue *queue, uint32_t count);
+bool ring_peer_alive(struct otp_ring *ring);
+
+#endif
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE                 // splice()
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+#include <inttypes.h>       // Fixed width format macros
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <fcntl.h>          // File control/ splice functions
+#include <netinet/in.h>     // Internet/ socket functions
+#include <netinet/tcp.h>    // TCP socket options
+#include <sys/socket.h>     // Socket functions
+#include <arpa/inet.h>      // Internet functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <sys/wait.h>       // Process termination functions
+#include <unistd.h>         // Process management/ file operations
+#include <poll.h>           // Descriptor readiness functions
+#include <signal.h>         // Signal handling
+#include <time.h>           // Clock functions
+
+#define CONNECT_COUNT 5
+#define MAX_BACKENDS 32
+#define VNODES_PER_BACKEND 64       // Points per backend on the consistent-hash ring
+#define SPLICE_CHUNK 65536          // Bytes moved per splice() call
+#define HEALTH_TIMEOUT_MS 200       // Connect time allowed to a health check
+#define ROUTER_USAGE "USAGE: %s [-m least|hash] [-h health_ms] port backend [backend...]\n" \
+                     "  backend: port on this host or ipv4_address:port\n"
+
+/*
+Program Name: Load-Balancing Router
+Author: Jose Bianchi
+Description: Program is part of encryption/ decryption prgram for converting
+    plaintext data into ciphertext, using a key via the one-time pad-like approach.
+    This specific program sits in front of several enc_server or dec_server instances
+    and accepts the same 5 part protocol on one port, so clients scale out without
+    changes. Each accepted connection is handed to a forked child that picks a backend,
+    connects to it and splices bytes both ways until either side closes; request bytes
+    never pass through user space. Backends are picked by least outstanding connections
+    (default) or by consistent hash of the client address, so a client keeps its backend
+    and only clients of a failed backend move (loopback clients hash by source port
+    too). The parent checks backend health every health_ms; a child that cannot reach
+    its backend marks it down and tries the next.
+    Per-backend counters live in shared memory and are printed on SIGUSR1.
+*/
+
+struct backend {
+    struct sockaddr_in address;
+    char name[32];                  // Address as given on the command line
+    uint32_t outstanding;           // Connections being forwarded right now
+    uint32_t healthy;               // 1 if last health check/ connect succeeded
+    uint64_t connections;           // Connections forwarded in total
+    uint64_t failures;              // Failed health checks and connects
+};
+
+struct vnode {
+    uint32_t hash;
+    int backend;
+};
+
+struct router_shared {
+    int backend_count;
+    uint32_t rotation;              // Rotates the first backend tried so ties are spread
+    struct backend backends[MAX_BACKENDS];
+};
+
+// Router state (shared table mapped before the first fork)
+static struct router_shared *shared;
+static struct vnode hash_ring[MAX_BACKENDS * VNODES_PER_BACKEND];
+static int hash_ring_size;
+static bool use_hash;
+static volatile sig_atomic_t stats_requested;
+
+// Helper function declarations
+int parse_backend(const char *arg, struct backend *backend);
+void build_hash_ring(void);
+uint32_t fnv1a(const void *data, size_t len);
+int pick_backend(const struct sockaddr_in *client_address, int skip);
+int connect_backend(int index, int timeout_ms);
+void check_backends(void);
+void forward_connection(int client_socket, const struct sockaddr_in *client_address);
+bool pump(int from_fd, int pipe_fds[2], size_t *buffered, int to_fd, bool *from_open);
+void print_stats(void);
+void on_signal(int signal_num);
+void setup_socket(struct sockaddr_in* address, int port_num);
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in server_address;
+    struct sockaddr_in client_address;
+    socklen_t client_info_size;
+    int health_ms = 1000;
+    int option;
+
+    // Validate input
+    while ((option = getopt(argc, argv, "m:h:")) != -1) {
+        switch (option) {
+            case 'm':
+                if (strcmp(optarg, "hash") != 0 && strcmp(optarg, "least") != 0) {
+                    fprintf(stderr, ROUTER_USAGE, argv[0]);
+                    exit(1);
+                }
+                use_hash = (strcmp(optarg, "hash") == 0);
+                break;
+            case 'h':
+                health_ms = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, ROUTER_USAGE, argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind < 2 || argc - optind - 1 > MAX_BACKENDS) {
+        fprintf(stderr, ROUTER_USAGE, argv[0]);
+        exit(1);
+    }
+    int port_arg = atoi(argv[optind]);
+    if (port_arg <= 0) {
+        fprintf(stderr, "Error: invalid port number '%s'\n", argv[optind]);
+        exit(1);
+    }
+    // Backend table shared by every child process
+    shared = mmap(NULL, sizeof(struct router_shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Error: failed to map backend table");
+        exit(1);
+    }
+    for (int i = optind + 1; i < argc; i++) {
+        if (parse_backend(argv[i], &shared->backends[shared->backend_count]) < 0) {
+            fprintf(stderr, "Error: invalid backend '%s'\n", argv[i]);
+            exit(1);
+        }
+        shared->backend_count++;
+    }
+    build_hash_ring();
+    check_backends();
+
+    struct sigaction action;
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    // Children are reaped automatically
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Establish IPv4 TCP server (listener) socket
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Error: could not create/ open socket");
+        exit(1);
+    }
+    setup_socket(&server_address, port_arg);
+    if (bind(server_socket, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
+        perror("Error: could not bind router to socket address");
+        exit(1);
+    }
+    listen(server_socket, CONNECT_COUNT);
+
+    struct pollfd listener = { .fd = server_socket, .events = POLLIN };
+    struct timespec last_check;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &last_check);
+    while (1) {
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats();
+        }
+        // Health checks run between accepts, at most every health_ms
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long since_check_ms = (now.tv_sec - last_check.tv_sec) * 1000 +
+                              (now.tv_nsec - last_check.tv_nsec) / 1000000;
+        if (health_ms > 0 && since_check_ms >= health_ms) {
+            check_backends();
+            last_check = now;
+            since_check_ms = 0;
+        }
+        int wait_ms = (health_ms > 0) ? health_ms - since_check_ms : -1;
+        if (poll(&listener, 1, wait_ms) <= 0) {
+            continue;
+        }
+        client_info_size = sizeof(client_address);
+        int client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_info_size);
+        if (client_socket < 0) {
+            if (errno != EINTR) {
+                perror("Error: could not accept connection from socket");
+            }
+            continue;
+        }
+        // Use separate process to forward each client connection
+        pid_t spawn_pid = fork();
+        switch (spawn_pid) {
+            case -1:
+                perror("Error: fork() failed");
+                close(client_socket);
+                break;
+            case 0:
+                close(server_socket);
+                forward_connection(client_socket, &client_address);
+                exit(0);
+            default:
+                close(client_socket);
+        }
+    }
+    close(server_socket);
+    return 0;
+}
+
+/*
+* Function: forward_connection()
+*   Connects to a backend and splices client bytes to it and backend bytes back
+*   until both directions are closed. Runs in a forked child.
+*   :param int client_socket: accepted client socket
+*   :param const struct sockaddr_in *client_address: client address (hash routing)
+*/
+void forward_connection(int client_socket, const struct sockaddr_in *client_address) {
+    int backend_socket = -1;
+    int index = -1;
+
+    // Try backends in routing order until one accepts the connection
+    for (int attempt = 0; attempt < shared->backend_count && backend_socket < 0; attempt++) {
+        index = pick_backend(client_address, index);
+        if (index < 0) {
+            break;
+        }
+        __atomic_add_fetch(&shared->backends[index].outstanding, 1, __ATOMIC_RELAXED);
+        backend_socket = connect_backend(index, -1);
+        if (backend_socket < 0) {
+            __atomic_sub_fetch(&shared->backends[index].outstanding, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (backend_socket < 0) {
+        fprintf(stderr, "Error: no backend available\n");
+        close(client_socket);
+        exit(1);
+    }
+    __atomic_add_fetch(&shared->backends[index].connections, 1, __ATOMIC_RELAXED);
+    // Requests and responses are forwarded whole, do not hold them back
+    int no_delay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    setsockopt(backend_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    // SPLICE_F_NONBLOCK only covers the pipe end, the sockets must not block either
+    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    fcntl(backend_socket, F_SETFL, fcntl(backend_socket, F_GETFL) | O_NONBLOCK);
+    // One pipe per direction carries spliced bytes between the sockets
+    int upstream[2];
+    int downstream[2];
+    if (pipe2(upstream, O_NONBLOCK) < 0 || pipe2(downstream, O_NONBLOCK) < 0) {
+        perror("Error: could not create forwarding pipes");
+        exit(1);
+    }
+    size_t up_buffered = 0;
+    size_t down_buffered = 0;
+    bool client_open = true;
+    bool backend_open = true;
+    bool up_done = false;
+    bool down_done = false;
+    while (!up_done || !down_done) {
+        struct pollfd fds[2] = {
+            { .fd = client_socket, .events = 0 },
+            { .fd = backend_socket, .events = 0 },
+        };
+        // Read a side only while its pipe is empty, write it while the other pipe holds data
+        if (client_open && up_buffered == 0) {
+            fds[0].events |= POLLIN;
+        }
+        if (down_buffered) {
+            fds[0].events |= POLLOUT;
+        }
+        if (backend_open && down_buffered == 0) {
+            fds[1].events |= POLLIN;
+        }
+        if (up_buffered) {
+            fds[1].events |= POLLOUT;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (!pump(client_socket, upstream, &up_buffered, backend_socket, &client_open) ||
+                !pump(backend_socket, downstream, &down_buffered, client_socket, &backend_open)) {
+            // Destination gone, nothing more can be delivered
+            break;
+        }
+        // Pass a close on once everything before it is delivered, so the other side sees EOF
+        if (!up_done && !client_open && up_buffered == 0) {
+            shutdown(backend_socket, SHUT_WR);
+            up_done = true;
+        }
+        if (!down_done && !backend_open && down_buffered == 0) {
+            shutdown(client_socket, SHUT_WR);
+            down_done = true;
+        }
+    }
+    __atomic_sub_fetch(&shared->backends[index].outstanding, 1, __ATOMIC_RELAXED);
+    close(client_socket);
+    close(backend_socket);
+}
+
+/*
+* Function: pump()
+*   Moves bytes one step from a socket into its pipe and from the pipe to the
+*   destination socket, without blocking. Reads only while the pipe is empty.
+*   :param int from_fd: source socket
+*   :param int pipe_fds[2]: pipe of this direction
+*   :param size_t *buffered: bytes waiting in the pipe
+*   :param int to_fd: destination socket
+*   :param bool *from_open: source still open, set to false once it closes
+*   :return bool: false if the destination failed
+*/
+bool pump(int from_fd, int pipe_fds[2], size_t *buffered, int to_fd, bool *from_open) {
+    if (*from_open && *buffered == 0) {
+        ssize_t moved = splice(from_fd, NULL, pipe_fds[1], NULL, SPLICE_CHUNK,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved == 0 || (moved < 0 && errno != EAGAIN && errno != EINTR)) {
+            *from_open = false;
+        } else if (moved > 0) {
+            *buffered = moved;
+        }
+    }
+    while (*buffered > 0) {
+        ssize_t written = splice(pipe_fds[0], NULL, to_fd, NULL, *buffered,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        if (written < 0 && (errno == EAGAIN || errno == EINTR)) {
+            break;
+        } else if (written <= 0) {
+            return false;
+        }
+        *buffered -= written;
+    }
+    return true;
+}
+
+/*
+* Function: pick_backend()
+*   Chooses a healthy backend: fewest outstanding connections, or the next point
+*   on the hash ring after the client address (address and port for loopback
+*   clients, which would otherwise all hash alike). A backend that just failed is
+*   skipped and marked down; if none is healthy every backend is a candidate.
+*   :param const struct sockaddr_in *client_address: client address
+*   :param int skip: backend that just failed, or -1
+*   :return int: backend index, or -1 if no candidate is left
+*/
+int pick_backend(const struct sockaddr_in *client_address, int skip) {
+    bool any_healthy = false;
+
+    if (skip >= 0) {
+        __atomic_store_n(&shared->backends[skip].healthy, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared->backends[skip].failures, 1, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < shared->backend_count; i++) {
+        if (i != skip && __atomic_load_n(&shared->backends[i].healthy, __ATOMIC_RELAXED)) {
+            any_healthy = true;
+        }
+    }
+    if (use_hash) {
+        // Local clients all share 127.0.0.1, so their source port tells them apart
+        uint32_t key[2] = { client_address->sin_addr.s_addr, 0 };
+        if ((ntohl(key[0]) >> 24) == IN_LOOPBACKNET) {
+            key[1] = client_address->sin_port;
+        }
+        // First ring point at or after the client hash, wrapping around
+        uint32_t hash = fnv1a(&key, sizeof(key));
+        int start = 0;
+        while (start < hash_ring_size && hash_ring[start].hash < hash) {
+            start++;
+        }
+        for (int i = 0; i < hash_ring_size; i++) {
+            int backend = hash_ring[(start + i) % hash_ring_size].backend;
+            if (backend != skip &&
+                    (!any_healthy || __atomic_load_n(&shared->backends[backend].healthy, __ATOMIC_RELAXED))) {
+                return backend;
+            }
+        }
+        return -1;
+    }
+    int best = -1;
+    uint32_t best_outstanding = 0;
+    int first = __atomic_fetch_add(&shared->rotation, 1, __ATOMIC_RELAXED) % shared->backend_count;
+    for (int n = 0; n < shared->backend_count; n++) {
+        int i = (first + n) % shared->backend_count;
+        if (i == skip || (any_healthy && !__atomic_load_n(&shared->backends[i].healthy, __ATOMIC_RELAXED))) {
+            continue;
+        }
+        uint32_t outstanding = __atomic_load_n(&shared->backends[i].outstanding, __ATOMIC_RELAXED);
+        if (best < 0 || outstanding < best_outstanding) {
+            best = i;
+            best_outstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+/*
+* Function: connect_backend()
+*   Opens a TCP connection to a backend.
+*   :param int index: backend index
+*   :param int timeout_ms: connect time allowed (-1 waits for the system timeout)
+*   :return int: connected socket or -1 if error
+*/
+int connect_backend(int index, int timeout_ms) {
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0) {
+        return -1;
+    }
+    if (timeout_ms >= 0) {
+        fcntl(socket_fd, F_SETFL, O_NONBLOCK);
+    }
+    const struct sockaddr_in *address = &shared->backends[index].address;
+    if (connect(socket_fd, (const struct sockaddr *)address, sizeof(*address)) == 0) {
+        return socket_fd;
+    }
+    if (timeout_ms >= 0 && errno == EINPROGRESS) {
+        struct pollfd waiter = { .fd = socket_fd, .events = POLLOUT };
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if (poll(&waiter, 1, timeout_ms) == 1 &&
+                getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &error_size) == 0 && error == 0) {
+            return socket_fd;
+        }
+    }
+    close(socket_fd);
+    return -1;
+}
+
+/*
+* Function: check_backends()
+*   Health check: a backend is healthy if it accepts a TCP connection within
+*   HEALTH_TIMEOUT_MS. The probe closes before sending a client ID code, which
+*   servers treat as a rejected client.
+*/
+void check_backends(void) {
+    for (int i = 0; i < shared->backend_count; i++) {
+        int probe = connect_backend(i, HEALTH_TIMEOUT_MS);
+        bool healthy = (probe >= 0);
+        if (probe >= 0) {
+            close(probe);
+        }
+        uint32_t was_healthy = __atomic_exchange_n(&shared->backends[i].healthy, healthy, __ATOMIC_RELAXED);
+        if (!healthy) {
+            __atomic_add_fetch(&shared->backends[i].failures, 1, __ATOMIC_RELAXED);
+        }
+        if (was_healthy != (uint32_t)healthy) {
+            fprintf(stderr, "router: backend %s is %s\n", shared->backends[i].name, healthy ? "up" : "down");
+        }
+    }
+}
+
+/*
+* Function: build_hash_ring()
+*   Places VNODES_PER_BACKEND points per backend on the hash ring, sorted by hash,
+*   so each backend owns many small arcs and a failed backend's clients spread out.
+*/
+void build_hash_ring(void) {
+    char label[48];
+
+    hash_ring_size = 0;
+    for (int i = 0; i < shared->backend_count; i++) {
+        for (int v = 0; v < VNODES_PER_BACKEND; v++) {
+            int label_len = snprintf(label, sizeof(label), "%s#%d", shared->backends[i].name, v);
+            struct vnode node = { .hash = fnv1a(label, label_len), .backend = i };
+            // Insertion sort keeps the ring ordered (small, built once)
+            int j = hash_ring_size++;
+            while (j > 0 && hash_ring[j - 1].hash > node.hash) {
+                hash_ring[j] = hash_ring[j - 1];
+                j--;
+            }
+            hash_ring[j] = node;
+        }
+    }
+}
+
+/*
+* Function: fnv1a()
+*   32 bit FNV-1a hash.
+*   :param const void *data: bytes to hash
+*   :param size_t len: number of bytes
+*   :return uint32_t: hash value
+*/
+uint32_t fnv1a(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+* Function: parse_backend()
+*   Parses "port" (this host) or "ipv4_address:port" into a backend address.
+*   :param const char *arg: backend argument
+*   :param struct backend *backend: backend to fill in
+*   :return int: 0 on success, -1 if invalid
+*/
+int parse_backend(const char *arg, struct backend *backend) {
+    char host[32] = "127.0.0.1";
+    const char *port_text = arg;
+    const char *colon = strchr(arg, ':');
+
+    if (colon) {
+        size_t host_len = colon - arg;
+        if (host_len == 0 || host_len >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, arg, host_len);
+        host[host_len] = '\0';
+        port_text = colon + 1;
+    }
+    int port_num = atoi(port_text);
+    if (port_num <= 0 || port_num > 65535) {
+        return -1;
+    }
+    memset(&backend->address, '\0', sizeof(backend->address));
+    backend->address.sin_family = AF_INET;
+    backend->address.sin_port = htons(port_num);
+    if (inet_pton(AF_INET, host, &backend->address.sin_addr) != 1) {
+        return -1;
+    }
+    snprintf(backend->name, sizeof(backend->name), "%s", arg);
+    return 0;
+}
+
+/*
+* Function: print_stats()
+*   Writes one line per backend: health, outstanding and total connections, failures.
+*/
+void print_stats(void) {
+    for (int i = 0; i < shared->backend_count; i++) {
+        struct backend *backend = &shared->backends[i];
+        fprintf(stderr, "router: backend=%s healthy=%" PRIu32 " outstanding=%" PRIu32
+                " connections=%" PRIu64 " failures=%" PRIu64 "\n", backend->name,
+                __atomic_load_n(&backend->healthy, __ATOMIC_RELAXED),
+                __atomic_load_n(&backend->outstanding, __ATOMIC_RELAXED),
+                __atomic_load_n(&backend->connections, __ATOMIC_RELAXED),
+                __atomic_load_n(&backend->failures, __ATOMIC_RELAXED));
+    }
+}
+
+/*
+* Function: on_signal()
+*   SIGUSR1 asks for backend stats.
+*   :param int signal_num: received signal
+*/
+void on_signal(int signal_num) {
+    if (signal_num == SIGUSR1) {
+        stats_requested = 1;
+    }
+}
+
+/*
+* Function: setup_socket()
+*   Sets up a socket address with port_num value.
+*   :param struct sockaddr_in* address: structure for socket address
+*   :param int port_num: port number for socket address
+*/
+void setup_socket(struct sockaddr_in* address, int port_num) {
+    // Clear out the address struct
+    memset((char*) address, '\0', sizeof(*address));
+
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Convert and store the port number in network byte order
+    address->sin_port = htons(port_num);
+    // Allow a client at any address to connect to this server
+    address->sin_addr.s_addr = INADDR_ANY;
+}
@@ -0,0 +1,2022 @@
+#include <stdlib.h>         // Memory management
+#include <stdio.h>          // Input/ output
+#include <stdbool.h>        // Boolean values
+#include <string.h>         // String functions
+#include <netinet/in.h>     // Internet/ socket functions
+#include <netinet/tcp.h>    // TCP socket options
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+#include <arpa/inet.h>      // Internet functions
+#include <sys/types.h>      // Size functions
+#include <sys/stat.h>       // File status functions
+#include <sys/mman.h>       // Memory mapping functions
+#include <unistd.h>         // Process management/ file operations
+#include <sys/wait.h>       // Process termination functions
+#include <sys/time.h>       // Time value structures
+#include <ctype.h>          // Character functions
+#include <poll.h>           // Descriptor readiness functions
+#include <fcntl.h>          // File control functions
+#include <signal.h>         // Signal handling
+#include <errno.h>          // Error numbers
+#include <time.h>           // Clock functions
+#include <sys/resource.h>   // Process priority
+#include <endian.h>         // Byte order conversion
+#include "otp_server.h"
+#include "otp_protocol.h"
+#include "otp_unix.h"
+#include "otp_ring.h"
+#include "otp_limits.h"
+#include "otp_pool.h"
+#include "otp_spool.h"
+#include "otp_trace.h"
+#include "otp_zerocopy.h"
+#include "otp_handoff.h"
+#include "otp_engine.h"
+
+#define CONNECT_COUNT 5
+#define UNIX_CHUNK_SIZE 65536
+#define REJECT_DRAIN_MS 200         // Idle time that ends draining a refused request
+#define REJECT_DRAIN_MAX_MS 2000    // Longest a refused request is drained
+#define SWEEP_INTERVAL_MS 10000     // Longest time between sweeps of expired sessions
+#define BULK_CHUNK 65536            // Bytes moved per call while bulk bandwidth is paced
+#define SERVER_USAGE "USAGE: %s [-u socket_path] [-k max_key_len] [-m max_msg_len] " \
+                     "[-b byte_budget] [-w max_workers] [-q queue_ms] [-s stage_ms] " \
+                     "[-i idle_ms] [-d request_ms] [-r min_rate] [-t cipher_threads] " \
+                     "[-p parallel_min] [-S spool_dir] [-E session_ttl] [-L trace_file] " \
+                     "[-l bulk_min] [-W bulk_workers] [-B bulk_rate] [-n bulk_nice] " \
+                     "[-z zerocopy_min] [-H handoff_path] [-g batch_us] [-G batch_bytes] " \
+                     "[-T worker_threads] port\n"
+
+// transfer_stage() kinds: header fields, key/ message/ response bytes, Part 2 of a later request
+#define STAGE_HEADER 0
+#define STAGE_PAYLOAD 1
+#define STAGE_NEXT 2
+
+// transfer_stage() results
+#define TRANSFER_DONE 1
+#define TRANSFER_EOF 0
+#define TRANSFER_IDLE -1
+#define TRANSFER_FAILED -2
+
+// handle_tcp_request() results
+#define REQUEST_DONE 1              // Response sent
+#define REQUEST_END 0               // Client closed or went idle before Part 2
+#define REQUEST_FAILED -1           // Request ended by an error or refusal, socket closed
+
+// Limits and shared accounting (set up by run_server() before the first fork)
+static struct server_limits limits;
+static struct server_stats *stats;
+static volatile sig_atomic_t stats_requested;
+static int drain_fd = -1;           // Drain pipe (-H): hangs up once the listeners are handed off
+static struct server_engine *engine;  // Worker threads (-T), NULL when forking per connection
+
+// Worker state: one copy per worker process, or per worker thread with -T
+static __thread uint64_t charged_bytes;      // Budget held by the current request of this worker
+static __thread struct timespec request_deadline;  // Deadline of the current request (zero = none)
+static __thread struct cipher_pool *cipher_pool;   // Worker's cipher threads (started by first large request)
+static __thread char *ring_batch;            // Worker's ring batch buffer (kept between connections)
+static __thread bool in_bulk_lane;           // Current request of this worker is counted in the bulk lane
+static __thread bool bulk_slot;              // Worker holds a bulk slot for its current request
+static __thread struct zc_state zerocopy;    // Zero-copy completions of this worker's TCP connection
+static __thread bool zerocopy_tried;         // Zero-copy was enabled (or refused) on the connection
+static __thread bool zerocopy_reply;         // Response being sent uses MSG_ZEROCOPY
+
+// Request tracing (-L): the acceptor numbers connections, each worker traces its requests
+static int trace_fd = -1;
+static __thread uint32_t connection_number;
+static __thread struct trace_record trace;   // Request being traced by this worker
+static __thread bool trace_active;
+static __thread uint64_t trace_stage_start;  // Start of the stage being timed (us since trace start)
+static __thread uint32_t traced_requests;    // Requests traced on this worker's connection
+
+// Helper function declarations
+void setup_socket(struct sockaddr_in* address, int port_num);
+bool handle_tcp_client(const struct server_profile *profile, int client_socket);
+int handle_tcp_request(const struct server_profile *profile, int client_socket, bool first);
+int transfer_stage(int client_socket, void *buffer, size_t len, bool sending, int kind);
+int transfer_bytes(int client_socket, void *buffer, size_t len, bool sending, int kind,
+                   const struct timespec *stage_deadline);
+int send_parallel(const struct server_profile *profile, int client_socket, char *result,
+                  const char *msg, size_t msg_len, const char *key);
+bool start_zerocopy(int client_socket, size_t len);
+bool finish_zerocopy(int client_socket, int status);
+long payload_stage_ms(size_t len);
+void cut_off(int client_socket);
+void arm_deadline(struct timespec *deadline, long ms);
+void disarm_deadline(struct timespec *deadline);
+bool deadline_armed(const struct timespec *deadline);
+long ms_until(const struct timespec *deadline);
+bool handle_unix_client(const struct server_profile *profile, int client_socket);
+bool check_client_code(const struct server_profile *profile, int client_socket, char *variant);
+bool handle_session_client(const struct server_profile *profile, int client_socket);
+int open_session(const struct server_profile *profile, int client_socket, char *token,
+                 uint64_t key_len, uint64_t msg_len, uint64_t *received);
+int receive_to_spool(int client_socket, int spool_fd, uint64_t received, uint64_t total);
+void remove_session(const struct server_profile *profile, const char *token, uint64_t spool_bytes);
+void sweep_sessions(const struct server_profile *profile);
+int send_result(const struct server_profile *profile, int client_socket, char *result,
+                const char *msg, size_t msg_len, const char *key);
+bool serve_ring(const struct server_profile *profile, int client_socket, int memfd);
+uint32_t transform_ring_batch(const struct server_profile *profile, struct otp_ring *ring,
+                              char *batch, uint32_t count);
+bool valid_text(const char *text, size_t len);
+int map_valid_fd(int fd, char **map, size_t *map_size, size_t *text_len);
+int process_fd_request(const struct server_profile *profile, int msg_fd, int key_fd, int out_fd);
+int write_all(int fd, const char *buffer, size_t len, const struct timespec *stage_deadline);
+void reject_request(int client_socket, const char *reply);
+void reject_connection(int client_socket);
+bool wait_for_worker(void);
+uint32_t interactive_workers(void);
+void reap_workers(void);
+void notify_acceptor(void);
+void serve_connection(const void *context, int client_socket, bool is_unix, uint32_t connection);
+void end_connection(void);
+void drain_workers(int drain_notify);
+bool wait_next_request(int client_socket);
+void on_signal(int signal_num);
+bool charge_budget(uint64_t bytes);
+void release_budget(void);
+bool enter_bulk_lane(void);
+void leave_bulk_lane(void);
+void trace_begin(int transport);
+void trace_stage(uint32_t *stage_us);
+void trace_end(int status);
+void trace_exit(void);
+
+/*
+* Function: run_server()
+*   Parses server arguments, opens the listening sockets and forks a child process
+*   for each accepted connection, or queues it for a worker thread (-T). Returns
+*   once the listeners were handed off and the workers drained, or if setup fails.
+*   :param const struct server_profile *profile: server specific codes and transform
+*   :param int argc: argument count from main()
+*   :param char *argv[]: arguments from main()
+*   :return int: exit status
+*/
+int run_server(const struct server_profile *profile, int argc, char *argv[]) {
+    int client_socket;
+    struct sockaddr_in server_address;
+    struct sockaddr_in client_address;
+    socklen_t client_info_size = sizeof(client_address);
+    char *unix_path = NULL;
+    char *trace_path = NULL;
+    char *handoff_path = NULL;
+    int worker_threads = 0;
+    int option;
+
+    // Validate input
+    limits.queue_ms = 1000;
+    limits.stage_ms = 10000;
+    limits.idle_ms = 60000;
+    limits.request_ms = 300000;
+    limits.min_rate = 16384;
+    limits.cipher_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    limits.parallel_min = 1048576;
+    limits.session_ttl = 300;
+    limits.spool_dir = "/var/tmp";
+    limits.bulk_min = 8388608;
+    limits.bulk_workers = 2;
+    limits.bulk_nice = 10;
+    limits.zerocopy_min = 1048576;
+    limits.batch_bytes = 65536;
+    while ((option = getopt(argc, argv, "u:k:m:b:w:q:s:i:d:r:t:p:S:E:L:l:W:B:n:z:H:g:G:T:")) != -1) {
+        switch (option) {
+            case 'u':
+                unix_path = optarg;
+                break;
+            case 'k':
+                limits.max_key_len = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                limits.max_msg_len = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                limits.byte_budget = strtoull(optarg, NULL, 10);
+                break;
+            case 'w':
+                limits.max_workers = atoi(optarg);
+                break;
+            case 'q':
+                limits.queue_ms = atoi(optarg);
+                break;
+            case 's':
+                limits.stage_ms = atoi(optarg);
+                break;
+            case 'i':
+                limits.idle_ms = atoi(optarg);
+                break;
+            case 'd':
+                limits.request_ms = atoi(optarg);
+                break;
+            case 'r':
+                limits.min_rate = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                limits.cipher_threads = atoi(optarg);
+                break;
+            case 'p':
+                limits.parallel_min = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                limits.spool_dir = optarg;
+                break;
+            case 'E':
+                limits.session_ttl = atoi(optarg);
+                break;
+            case 'L':
+                trace_path = optarg;
+                break;
+            case 'l':
+                limits.bulk_min = strtoull(optarg, NULL, 10);
+                break;
+            case 'W':
+                limits.bulk_workers = atoi(optarg);
+                break;
+            case 'B':
+                limits.bulk_rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'n':
+                limits.bulk_nice = atoi(optarg);
+                break;
+            case 'z':
+                limits.zerocopy_min = strtoull(optarg, NULL, 10);
+                break;
+            case 'H':
+                handoff_path = optarg;
+                break;
+            case 'g':
+                limits.batch_us = atol(optarg);
+                break;
+            case 'G':
+                limits.batch_bytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'T':
+                worker_threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, SERVER_USAGE, argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, SERVER_USAGE, argv[0]);
+        exit(1);
+    }
+    // A single cipher thread gains nothing from splitting requests
+    if (limits.cipher_threads < 2) {
+        limits.parallel_min = 0;
+    }
+    if (limits.bulk_workers < 1) {
+        limits.bulk_workers = 1;
+    }
+    // Connections beyond the worker threads would only wait in the deques
+    if (worker_threads > 0 && limits.max_workers <= 0) {
+        limits.max_workers = worker_threads;
+    }
+    int port_arg = atoi(argv[optind]);
+    if (port_arg <= 0) {
+        fprintf(stderr, "Error: invalid port number '%s'\n", argv[optind]);
+        exit(1);
+    }
+    // Accounting shared by every worker process
+    stats = stats_create();
+    if (!stats) {
+        exit(1);
+    }
+    if (trace_path) {
+        trace_fd = trace_open(trace_path, profile->name);
+        if (trace_fd < 0) {
+            exit(1);
+        }
+    }
+    // SIGCHLD wakes a parent queued for a free worker, SIGUSR1 prints stats
+    struct sigaction action;
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+    if (worker_threads > 0) {
+        // A client gone mid-response must fail its request, not end the process
+        signal(SIGPIPE, SIG_IGN);
+        engine = engine_create(worker_threads, serve_connection, profile, &stats->engine_stolen);
+        if (!engine) {
+            exit(1);
+        }
+    }
+    // A server already running on the handoff path passes its listeners instead
+    int handoff_fds[HANDOFF_MAX_FDS];
+    int handoff_count = 0;
+    int handoff_control = -1;
+    if (handoff_path) {
+        handoff_count = handoff_receive(handoff_path, &handoff_control, handoff_fds, HANDOFF_MAX_FDS);
+        if (handoff_count < 0) {
+            exit(1);
+        }
+    }
+    int server_socket;
+    if (handoff_count > 0) {
+        // Taking over someone else's port would leave the requested one unserved
+        server_socket = handoff_fds[0];
+        struct sockaddr_in bound_address;
+        socklen_t bound_size = sizeof(bound_address);
+        if (getsockname(server_socket, (struct sockaddr *)&bound_address, &bound_size) < 0 ||
+                bound_address.sin_family != AF_INET || ntohs(bound_address.sin_port) != port_arg) {
+            fprintf(stderr, "Error: running server does not listen on port %d\n", port_arg);
+            exit(1);
+        }
+    } else {
+        // Establish IPv4 TCP server (listener) socket
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            perror("Error: could not create/ open socket");
+            exit(1);
+        }
+        setup_socket(&server_address, port_arg);
+        int bind_result = bind(server_socket,
+                                (struct sockaddr *)&server_address,
+                                sizeof(server_address));
+        if (bind_result < 0) {
+            perror("Error: could not bind server to socket address");
+            exit(1);
+        }
+        listen(server_socket, CONNECT_COUNT);
+    }
+
+    // Optional UNIX-domain listener for clients on the same host
+    int unix_socket = -1;
+    if (handoff_count > 1) {
+        // Keep the handed off listener if it serves the same path
+        struct sockaddr_un bound_unix;
+        socklen_t bound_size = sizeof(bound_unix);
+        if (unix_path && getsockname(handoff_fds[1], (struct sockaddr *)&bound_unix, &bound_size) == 0 &&
+                strncmp(bound_unix.sun_path, unix_path, sizeof(bound_unix.sun_path)) == 0) {
+            unix_socket = handoff_fds[1];
+        } else {
+            close(handoff_fds[1]);
+        }
+    }
+    if (unix_path && unix_socket < 0) {
+        struct sockaddr_un unix_address;
+        if (setup_unix_socket(&unix_address, unix_path) < 0) {
+            exit(1);
+        }
+        unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (unix_socket < 0) {
+            perror("Error: could not create/ open UNIX socket");
+            exit(1);
+        }
+        // Remove socket file left behind by a previous server
+        unlink(unix_path);
+        if (bind(unix_socket, (struct sockaddr *)&unix_address, sizeof(unix_address)) < 0) {
+            perror("Error: could not bind server to UNIX socket path");
+            exit(1);
+        }
+        listen(unix_socket, CONNECT_COUNT);
+    }
+
+    // Listen for the next server only once this one is ready to serve
+    int handoff_socket = -1;
+    int drain_notify = -1;
+    if (handoff_path) {
+        handoff_socket = handoff_listen(handoff_path);
+        int drain_pipe[2];
+        if (handoff_socket < 0 || pipe(drain_pipe) < 0) {
+            perror("Error: could not set up listener handoff");
+            exit(1);
+        }
+        drain_fd = drain_pipe[0];
+        drain_notify = drain_pipe[1];
+        if (handoff_control >= 0) {
+            handoff_confirm(handoff_control);
+        }
+    }
+
+    // Descriptors of -1 (no UNIX or handoff listener) are skipped by poll()
+    struct pollfd listeners[3] = {
+        { .fd = server_socket, .events = POLLIN },
+        { .fd = unix_socket, .events = POLLIN },
+        { .fd = handoff_socket, .events = POLLIN },
+    };
+    // Sessions left unfinished by clients that never came back are swept regularly
+    int sweep_ms = -1;
+    if (limits.session_ttl > 0) {
+        sweep_ms = (limits.session_ttl * 1000 < SWEEP_INTERVAL_MS) ? limits.session_ttl * 1000 : SWEEP_INTERVAL_MS;
+        sweep_sessions(profile);
+    }
+    struct timespec next_sweep;
+    arm_deadline(&next_sweep, sweep_ms);
+    while (1) {
+        reap_workers();
+        if (stats_requested) {
+            stats_requested = 0;
+            stats_print(stats, stderr);
+        }
+        if (sweep_ms > 0 && ms_until(&next_sweep) == 0) {
+            sweep_sessions(profile);
+            arm_deadline(&next_sweep, sweep_ms);
+        }
+        if (poll(listeners, 3, (int)ms_until(&next_sweep)) <= 0) {
+            continue;
+        }
+        if (listeners[2].revents & POLLIN) {
+            int listener_fds[HANDOFF_MAX_FDS] = { server_socket, unix_socket };
+            if (handoff_send(handoff_socket, listener_fds, unix_socket < 0 ? 1 : 2)) {
+                break;
+            }
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!(listeners[i].revents & POLLIN)) {
+                continue;
+            }
+            bool is_unix = (listeners[i].fd == unix_socket);
+            if (is_unix) {
+                client_socket = accept(unix_socket, NULL, NULL);
+            } else {
+                client_socket = accept(server_socket,
+                                        (struct sockaddr *)&client_address,
+                                        &client_info_size);
+            }
+            if (client_socket < 0) {
+                if (errno != EINTR) {
+                    perror("Error: could not accept connection from socket");
+                }
+                continue;
+            }
+            // Hold connection until a worker is free, refuse it after queue_ms
+            if (!wait_for_worker()) {
+                reject_connection(client_socket);
+                continue;
+            }
+            connection_number++;
+            if (engine) {
+                // Counted before it is queued, the worker may finish it at once
+                __atomic_add_fetch(&stats->workers, 1, __ATOMIC_RELAXED);
+                if (!engine_submit(engine, client_socket, is_unix, connection_number)) {
+                    __atomic_sub_fetch(&stats->workers, 1, __ATOMIC_RELAXED);
+                    reject_connection(client_socket);
+                    continue;
+                }
+                stats_add(&stats->accepted, 1);
+                continue;
+            }
+            // Use separate process to handle specific client request
+            pid_t spawn_pid = fork();
+            switch (spawn_pid) {
+                case -1:
+                    perror("Error: fork() failed");
+                    close(client_socket);
+                    continue;
+                case 0:
+                    // Budget is returned even when a worker exits on an error
+                    atexit(release_budget);
+                    // A request ended by an error or refusal is still traced
+                    atexit(trace_exit);
+                    atexit(leave_bulk_lane);
+                    close(server_socket);
+                    if (unix_socket >= 0) {
+                        close(unix_socket);
+                    }
+                    if (handoff_socket >= 0) {
+                        close(handoff_socket);
+                        close(drain_notify);
+                    }
+                    if (is_unix) {
+                        exit(handle_unix_client(profile, client_socket) ? 0 : 1);
+                    }
+                    exit(handle_tcp_client(profile, client_socket) ? 0 : 1);
+                default:
+                    close(client_socket);
+                    stats_add(&stats->accepted, 1);
+                    __atomic_add_fetch(&stats->workers, 1, __ATOMIC_RELAXED);
+                    // Cleanup child process without blocking
+                    reap_workers();
+            }
+        }
+    }
+    // The new server accepts from here on, finish the connections accepted so far
+    close(server_socket);
+    if (unix_socket >= 0) {
+        close(unix_socket);
+    }
+    close(handoff_socket);
+    drain_workers(drain_notify);
+    return 0;
+}
+
+/*
+* Function: check_client_code()
+*   Receives client ID code and sends access status message based on code.
+*   A permitted code may be followed by KEEP_ALIVE_SUFFIX, to keep the connection
+*   open, or by RESUME_SUFFIX for a resumable session (refused when sessions are off).
+*   :param const struct server_profile *profile: server specific codes
+*   :param int client_socket: connected client socket
+*   :param char *variant: set to the suffix character, '\0' for a plain request
+*   :return bool: true if client is permitted
+*/
+bool check_client_code(const struct server_profile *profile, int client_socket, char *variant) {
+    char client_code[10];
+    size_t code_len = strlen(profile->permitted_code);
+
+    memset(client_code, '\0', sizeof(client_code));
+    // Part 1 has a stage deadline like the others, a silent client is dropped
+    struct pollfd waiter = { .fd = client_socket, .events = POLLIN };
+    if (poll(&waiter, 1, limits.stage_ms > 0 ? limits.stage_ms : -1) == 0) {
+        stats_add(&stats->timeout_stage, 1);
+        cut_off(client_socket);
+        return false;
+    }
+    int bytes_read = recv(client_socket, client_code, sizeof(client_code) - 1, 0);
+    if (bytes_read < 0) {
+        perror("Error: could not read client code");
+        return false;
+    }
+    client_code[bytes_read] = '\0';
+    const char *suffix = client_code + code_len;
+    *variant = '\0';
+    if (strcmp(suffix, KEEP_ALIVE_SUFFIX) == 0 ||
+            (limits.session_ttl > 0 && strcmp(suffix, RESUME_SUFFIX) == 0)) {
+        *variant = suffix[0];
+    }
+    if (strncmp(client_code, profile->permitted_code, code_len) == 0 &&
+            (suffix[0] == '\0' || *variant != '\0')) {
+        send(client_socket, profile->accept_reply, strlen(profile->accept_reply), 0);
+        return true;
+    }
+    send(client_socket, REJECT_REPLY, strlen(REJECT_REPLY), 0);
+    return false;
+}
+
+/*
+* Function: handle_tcp_client()
+*   Handles client requests in 5 parts: client ID code, key sequence size,
+*   key sequence, message size, and message. Keep-alive clients may repeat
+*   Parts 2-5 until they close the connection; resumable sessions are handed to
+*   handle_session_client(). Runs in a forked child or on a worker thread; the
+*   socket is closed on return.
+*   :param const struct server_profile *profile: server specific codes and transform
+*   :param int client_socket: connected client socket
+*   :return bool: false if the connection ended on an error or refusal
+*/
+bool handle_tcp_client(const struct server_profile *profile, int client_socket) {
+    char variant;
+    int status;
+    // Part 1: Client ID code (only accept message from permitted client)
+    if (!check_client_code(profile, client_socket, &variant)) {
+        // If error, end connection and start over with next client
+        close(client_socket);
+        return false;
+    }
+    // Responses are sent whole, do not hold them back waiting for ACKs
+    int no_delay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if (variant == RESUME_SUFFIX[0]) {
+        return handle_session_client(profile, client_socket);
+    }
+    bool keep_alive = (variant == KEEP_ALIVE_SUFFIX[0]);
+    for (bool first = true; (status = handle_tcp_request(profile, client_socket, first)) == REQUEST_DONE &&
+                            keep_alive; first = false);
+    if (status == REQUEST_FAILED) {
+        return false;
+    }
+    close(client_socket);
+    return true;
+}
+
+/*
+* Function: handle_tcp_request()
+*   Handles Parts 2-5 of one request. Result of transform is sent to client
+*   as response. Every stage runs against its deadline (transfer_stage()).
+*   On any error the request's buffers are freed and the socket is closed.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int client_socket: connected client socket
+*   :param bool first: true for the first request on the connection
+*   :return int: REQUEST_DONE, REQUEST_END or REQUEST_FAILED
+*/
+int handle_tcp_request(const struct server_profile *profile, int client_socket, bool first) {
+    // Receieve request from client (Parts 2-5)
+    int nbo_key_len;
+    int key_len;
+    int nbo_msg_len;
+    int msg_len;
+    int status;
+    char *key = NULL;
+    char *msg = NULL;
+    char *result = NULL;
+    // Part 2: Key size (later keep-alive requests may wait up to idle_ms for it)
+    disarm_deadline(&request_deadline);
+    status = transfer_stage(client_socket, &nbo_key_len, sizeof(nbo_key_len), false,
+                            first ? STAGE_HEADER : STAGE_NEXT);
+    if (status == TRANSFER_EOF) {
+        // Client finished sending requests
+        return REQUEST_END;
+    } else if (status == TRANSFER_IDLE) {
+        stats_add(&stats->idle_closed, 1);
+        return REQUEST_END;
+    } else if (status != TRANSFER_DONE) {
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    arm_deadline(&request_deadline, limits.request_ms);
+    trace_begin(TRACE_TCP);
+    // Admission: size limit, then charge key to the global byte budget
+    key_len = ntohl(nbo_key_len);
+    trace.key_len = key_len;
+    if (key_len < 0 || (limits.max_key_len && (uint64_t)key_len > limits.max_key_len)) {
+        stats_add(&stats->rejected_size, 1);
+        reject_request(client_socket, TOO_BIG_REPLY);
+        return REQUEST_FAILED;
+    }
+    if (!charge_budget(key_len)) {
+        stats_add(&stats->rejected_budget, 1);
+        reject_request(client_socket, BUSY_REPLY);
+        return REQUEST_FAILED;
+    }
+    // Allocate memory for key sequence
+    key = calloc(key_len + 1, sizeof(char));
+    if (!key) {
+        perror("Error: failed to allocate memory for key");
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    // Part 3: Key string
+    if (transfer_stage(client_socket, key, key_len, false, STAGE_PAYLOAD) != TRANSFER_DONE) {
+        free(key);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    key[key_len] = '\0';
+    trace_stage(&trace.key_us);
+    // Part 4: Message size
+    if (transfer_stage(client_socket, &nbo_msg_len, sizeof(nbo_msg_len), false, STAGE_HEADER) != TRANSFER_DONE) {
+        free(key);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    // Key sequence must cover the whole message
+    msg_len = ntohl(nbo_msg_len);
+    trace.msg_len = msg_len;
+    if (msg_len > key_len) {
+        stats_add(&stats->rejected_key_short, 1);
+        free(key);
+        reject_request(client_socket, KEY_SHORT_REPLY);
+        return REQUEST_FAILED;
+    }
+    // Admission: message and response buffers are charged together
+    if (msg_len < 0 || (limits.max_msg_len && (uint64_t)msg_len > limits.max_msg_len)) {
+        stats_add(&stats->rejected_size, 1);
+        free(key);
+        reject_request(client_socket, TOO_BIG_REPLY);
+        return REQUEST_FAILED;
+    }
+    // Large messages wait for a bulk slot before taking any more budget
+    if (limits.bulk_min && (uint64_t)msg_len >= limits.bulk_min && !enter_bulk_lane()) {
+        free(key);
+        reject_request(client_socket, BUSY_REPLY);
+        return REQUEST_FAILED;
+    }
+    if (!charge_budget(2 * (uint64_t)msg_len)) {
+        stats_add(&stats->rejected_budget, 1);
+        free(key);
+        reject_request(client_socket, BUSY_REPLY);
+        return REQUEST_FAILED;
+    }
+    // Allocate memory for message
+    msg = calloc(msg_len + 1, sizeof(char));
+    if (!msg) {
+        perror("Error: failed to allocate memory for message");
+        free(key);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    // Part 5: Message string
+    if (transfer_stage(client_socket, msg, msg_len, false, STAGE_PAYLOAD) != TRANSFER_DONE) {
+        free(key);
+        free(msg);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    msg[msg_len] = '\0';
+    trace_stage(&trace.msg_us);
+    // Apply server transform to message
+    result = calloc(msg_len + 1, sizeof(char));
+    if (!result) {
+        perror("Error: failed to allocate memory for response");
+        free(key);
+        free(msg);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    // Send result as response to client (a client not reading it is cut off too)
+    if (send_result(profile, client_socket, result, msg, msg_len, key) != TRANSFER_DONE) {
+        free(key);
+        free(msg);
+        free(result);
+        close(client_socket);
+        return REQUEST_FAILED;
+    }
+    free(key);
+    free(msg);
+    free(result);
+    release_budget();
+    leave_bulk_lane();
+    stats_add(&stats->completed, 1);
+    trace_stage(&trace.result_us);
+    trace_end(TRACE_OK);
+    return REQUEST_DONE;
+}
+
+/*
+* Function: send_result()
+*   Transforms a message and sends the result. Large messages are transformed by
+*   the pool and sent block by block as they finish (send_parallel()). Results of
+*   at least zerocopy_min characters are sent with MSG_ZEROCOPY; the result buffer
+*   is not released back to the caller until the kernel is done with it.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int client_socket: connected client socket
+*   :param char *result: buffer of at least msg_len characters for the result
+*   :param const char *msg: message characters
+*   :param size_t msg_len: number of message characters
+*   :param const char *key: key characters
+*   :return int: TRANSFER_DONE or TRANSFER_FAILED
+*/
+int send_result(const struct server_profile *profile, int client_socket, char *result,
+                const char *msg, size_t msg_len, const char *key) {
+    int status;
+
+    start_zerocopy(client_socket, msg_len);
+    if (limits.parallel_min && (uint64_t)msg_len >= limits.parallel_min) {
+        status = send_parallel(profile, client_socket, result, msg, msg_len, key);
+    } else {
+        profile->transform(result, msg, msg_len, key);
+        status = transfer_stage(client_socket, result, msg_len, true, STAGE_PAYLOAD);
+    }
+    if (!finish_zerocopy(client_socket, status)) {
+        return TRANSFER_FAILED;
+    }
+    return status;
+}
+
+/*
+* Function: start_zerocopy()
+*   Decides whether the next response is sent with MSG_ZEROCOPY, enabling it on
+*   the connection for the first large response. A connection on which the kernel
+*   had to copy a zero-copy response (loopback, no scatter-gather) keeps using
+*   plain sends, which are cheaper than copying and tracking completions.
+*   :param int client_socket: connected client socket
+*   :param size_t len: response size
+*   :return bool: true if the response uses MSG_ZEROCOPY
+*/
+bool start_zerocopy(int client_socket, size_t len) {
+    zerocopy_reply = false;
+    if (!limits.zerocopy_min || (uint64_t)len < limits.zerocopy_min) {
+        return false;
+    }
+    if (!zerocopy_tried) {
+        zerocopy_tried = true;
+        zc_enable(&zerocopy, client_socket);
+    }
+    zerocopy_reply = zerocopy.enabled && zerocopy.copied == 0;
+    return zerocopy_reply;
+}
+
+/*
+* Function: finish_zerocopy()
+*   Waits for the completions of a zero-copy response, so its buffer can be freed
+*   or reused, bounded by the request deadline (or stage_ms without one). A client
+*   that never acknowledges the data is cut off.
+*   :param int client_socket: connected client socket
+*   :param int status: result of sending the response
+*   :return bool: false if completions did not arrive in time
+*/
+bool finish_zerocopy(int client_socket, int status) {
+    if (!zerocopy_reply) {
+        return true;
+    }
+    zerocopy_reply = false;
+    uint64_t copied = zerocopy.copied;
+    long wait_ms = ms_until(&request_deadline);
+    if (limits.stage_ms && (wait_ms < 0 || limits.stage_ms < wait_ms)) {
+        wait_ms = limits.stage_ms;
+    }
+    // A failed connection is shut down: remaining completions follow promptly
+    if (!zc_wait(&zerocopy, client_socket, wait_ms)) {
+        if (status == TRANSFER_DONE) {
+            stats_add(&stats->timeout_stage, 1);
+            cut_off(client_socket);
+        }
+        return false;
+    }
+    stats_add(&stats->zerocopy_replies, 1);
+    if (zerocopy.copied > copied) {
+        stats_add(&stats->zerocopy_copied, 1);
+    }
+    return true;
+}
+
+/*
+* Function: handle_session_client()
+*   Serves one connection of a resumable session (see otp_protocol.h). Key and
+*   message go to the session's spool file as they arrive, so a dropped connection
+*   loses nothing already received. Once the input is complete the result is sent
+*   from the offset the client asked for, and the spool is deleted when the client
+*   closes the connection after it. The spool, its mapping and the socket are
+*   closed on return, also when the connection ends on an error.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int client_socket: connected client socket
+*   :return bool: false if the connection ended on an error or refusal
+*/
+bool handle_session_client(const struct server_profile *profile, int client_socket) {
+    char header[SESSION_HEADER_SIZE];
+    char token[SESSION_TOKEN_LEN + 1];
+    uint64_t field;
+    uint64_t received;
+
+    arm_deadline(&request_deadline, limits.request_ms);
+    if (transfer_stage(client_socket, header, sizeof(header), false, STAGE_HEADER) != TRANSFER_DONE) {
+        close(client_socket);
+        return false;
+    }
+    memcpy(token, header, SESSION_TOKEN_LEN);
+    token[SESSION_TOKEN_LEN] = '\0';
+    memcpy(&field, header + SESSION_TOKEN_LEN, sizeof(field));
+    uint64_t key_len = be64toh(field);
+    memcpy(&field, header + SESSION_TOKEN_LEN + 8, sizeof(field));
+    uint64_t msg_len = be64toh(field);
+    memcpy(&field, header + SESSION_TOKEN_LEN + 16, sizeof(field));
+    uint64_t result_have = be64toh(field);
+    trace_begin(TRACE_SESSION);
+    trace.key_len = key_len;
+    trace.msg_len = msg_len;
+    if (msg_len > key_len) {
+        stats_add(&stats->rejected_key_short, 1);
+        reject_request(client_socket, KEY_SHORT_REPLY);
+        return false;
+    }
+    if (result_have > msg_len || msg_len > SIZE_MAX / 2 || key_len > SIZE_MAX / 2) {
+        fprintf(stderr, "Error: invalid session header\n");
+        close(client_socket);
+        return false;
+    }
+    int spool_fd = open_session(profile, client_socket, token, key_len, msg_len, &received);
+    if (spool_fd < 0) {
+        return false;
+    }
+    if (limits.bulk_min && msg_len >= limits.bulk_min && !enter_bulk_lane()) {
+        close(spool_fd);
+        reject_request(client_socket, BUSY_REPLY);
+        return false;
+    }
+    // Reply: token and input characters already stored
+    memcpy(header, token, SESSION_TOKEN_LEN);
+    field = htobe64(received);
+    memcpy(header + SESSION_TOKEN_LEN, &field, sizeof(field));
+    if (transfer_stage(client_socket, header, SESSION_REPLY_SIZE, true, STAGE_HEADER) != TRANSFER_DONE ||
+            receive_to_spool(client_socket, spool_fd, received, key_len + msg_len) != TRANSFER_DONE) {
+        close(spool_fd);
+        close(client_socket);
+        return false;
+    }
+    trace_stage(&trace.key_us);
+    // Input complete: cipher straight from the spool
+    size_t map_size = SPOOL_HEADER_SIZE + key_len + msg_len;
+    char *spool = mmap(NULL, map_size, PROT_READ, MAP_SHARED, spool_fd, 0);
+    size_t remaining = msg_len - result_have;
+    if (spool == MAP_FAILED) {
+        perror("Error: failed to map session spool");
+        close(spool_fd);
+        close(client_socket);
+        return false;
+    }
+    const char *key = spool + SPOOL_HEADER_SIZE;
+    const char *msg = key + key_len;
+    if (!valid_text(key, key_len) || !valid_text(msg, msg_len)) {
+        fprintf(stderr, "Error: session input contains bad characters\n");
+        remove_session(profile, token, key_len + msg_len);
+        munmap(spool, map_size);
+        close(spool_fd);
+        close(client_socket);
+        return false;
+    }
+    // The spool was charged when the session was created, the result buffer is charged per connection
+    if (!charge_budget(remaining)) {
+        stats_add(&stats->rejected_budget, 1);
+        munmap(spool, map_size);
+        close(spool_fd);
+        reject_request(client_socket, BUSY_REPLY);
+        return false;
+    }
+    char *result = malloc(remaining + 1);
+    if (!result) {
+        perror("Error: failed to allocate memory for response");
+        munmap(spool, map_size);
+        close(spool_fd);
+        close(client_socket);
+        return false;
+    }
+    if (send_result(profile, client_socket, result, msg + result_have, remaining, key + result_have) != TRANSFER_DONE) {
+        free(result);
+        munmap(spool, map_size);
+        close(spool_fd);
+        close(client_socket);
+        return false;
+    }
+    free(result);
+    release_budget();
+    stats_add(&stats->completed, 1);
+    trace_stage(&trace.result_us);
+    trace_end(TRACE_OK);
+    // The client closing the connection confirms it has the whole result
+    char extra;
+    if (transfer_stage(client_socket, &extra, 1, false, STAGE_HEADER) == TRANSFER_EOF) {
+        remove_session(profile, token, key_len + msg_len);
+    }
+    munmap(spool, map_size);
+    close(spool_fd);
+    close(client_socket);
+    return true;
+}
+
+/*
+* Function: open_session()
+*   Creates a new session (token of all '0') or reopens the client's session.
+*   Refuses the connection with a status word when neither is possible.
+*   :param const struct server_profile *profile: server name for spool files
+*   :param int client_socket: connected client socket
+*   :param char *token: token from the client, replaced by a new session's token
+*   :param uint64_t key_len: key length from the session header
+*   :param uint64_t msg_len: message length from the session header
+*   :param uint64_t *received: set to the input characters already stored
+*   :return int: locked spool descriptor, -1 if refused (socket closed)
+*/
+int open_session(const struct server_profile *profile, int client_socket, char *token,
+                 uint64_t key_len, uint64_t msg_len, uint64_t *received) {
+    if (strspn(token, "0") == SESSION_TOKEN_LEN) {
+        // The result buffer is charged on top of the spool, so both must fit the budget
+        if ((limits.max_key_len && key_len > limits.max_key_len) ||
+                (limits.max_msg_len && msg_len > limits.max_msg_len) ||
+                (limits.byte_budget && key_len + 2 * msg_len > limits.byte_budget)) {
+            stats_add(&stats->rejected_size, 1);
+            reject_request(client_socket, TOO_BIG_REPLY);
+            return -1;
+        }
+        // The spool holds the input until the session finishes or expires, so it
+        // keeps its budget across connections instead of charging the worker
+        uint64_t spool_bytes = key_len + msg_len;
+        if (!budget_acquire(stats, &limits, spool_bytes)) {
+            stats_add(&stats->rejected_budget, 1);
+            reject_request(client_socket, BUSY_REPLY);
+            return -1;
+        }
+        int lock_fd = spool_lock(limits.spool_dir);
+        int spool_fd = spool_create(limits.spool_dir, profile->name, key_len, msg_len, token);
+        if (spool_fd >= 0) {
+            stats_add(&stats->spooled_bytes, spool_bytes);
+        }
+        spool_unlock(lock_fd);
+        if (spool_fd < 0) {
+            budget_release(stats, spool_bytes);
+            reject_request(client_socket, BUSY_REPLY);
+            return -1;
+        }
+        stats_add(&stats->sessions_started, 1);
+        *received = 0;
+        return spool_fd;
+    }
+    uint64_t stored_key_len;
+    uint64_t stored_msg_len;
+    int spool_fd = SPOOL_NOT_FOUND;
+    if (spool_valid_token(token)) {
+        spool_fd = spool_open(limits.spool_dir, profile->name, token, &stored_key_len, &stored_msg_len, received);
+    }
+    if (spool_fd == SPOOL_BUSY) {
+        // Previous connection of the session is still being served
+        reject_request(client_socket, BUSY_REPLY);
+        return -1;
+    }
+    if (spool_fd < 0 || stored_key_len != key_len || stored_msg_len != msg_len) {
+        if (spool_fd >= 0) {
+            close(spool_fd);
+        }
+        reject_request(client_socket, NO_SESSION_REPLY);
+        return -1;
+    }
+    stats_add(&stats->sessions_resumed, 1);
+    trace.flags |= TRACE_RESUMED;
+    return spool_fd;
+}
+
+/*
+* Function: remove_session()
+*   Deletes the spool of a finished session and returns its budget.
+*   :param const struct server_profile *profile: server name for spool files
+*   :param const char *token: session token
+*   :param uint64_t spool_bytes: key plus message length charged for the spool
+*/
+void remove_session(const struct server_profile *profile, const char *token, uint64_t spool_bytes) {
+    int lock_fd = spool_lock(limits.spool_dir);
+    spool_remove(limits.spool_dir, profile->name, token);
+    // A spool created by the server that handed off to this one was never charged here
+    uint64_t charged = __atomic_load_n(&stats->spooled_bytes, __ATOMIC_RELAXED);
+    if (spool_bytes > charged) {
+        spool_bytes = charged;
+    }
+    __atomic_sub_fetch(&stats->spooled_bytes, spool_bytes, __ATOMIC_RELAXED);
+    budget_release(stats, spool_bytes);
+    spool_unlock(lock_fd);
+}
+
+/*
+* Function: sweep_sessions()
+*   Removes expired spools, then sets the budget held for spools to what is left,
+*   which also charges spools found at startup.
+*   :param const struct server_profile *profile: server name for spool files
+*/
+void sweep_sessions(const struct server_profile *profile) {
+    int lock_fd = spool_lock(limits.spool_dir);
+    spool_sweep(limits.spool_dir, profile->name, limits.session_ttl);
+    budget_rebase_spool(stats, spool_usage(limits.spool_dir, profile->name));
+    spool_unlock(lock_fd);
+}
+
+/*
+* Function: receive_to_spool()
+*   Receives session input into the spool file. Whatever has arrived is written
+*   at once, so a dropped connection loses nothing the server already read. The
+*   whole input shares one payload stage deadline.
+*   :param int client_socket: connected client socket
+*   :param int spool_fd: locked spool descriptor
+*   :param uint64_t received: input characters already stored
+*   :param uint64_t total: key plus message length
+*   :return int: TRANSFER_DONE or TRANSFER_FAILED
+*/
+int receive_to_spool(int client_socket, int spool_fd, uint64_t received, uint64_t total) {
+    char chunk[UNIX_CHUNK_SIZE];
+    struct timespec stage_deadline;
+
+    arm_deadline(&stage_deadline, payload_stage_ms(total - received));
+    while (received < total) {
+        // Wait (against the deadlines) for one byte, then take whatever else is ready
+        if (transfer_bytes(client_socket, chunk, 1, false, STAGE_PAYLOAD, &stage_deadline) != TRANSFER_DONE) {
+            return TRANSFER_FAILED;
+        }
+        size_t want = (total - received < sizeof(chunk)) ? total - received : sizeof(chunk);
+        ssize_t bytes = recv(client_socket, chunk + 1, want - 1, MSG_DONTWAIT);
+        size_t len = 1 + (bytes > 0 ? bytes : 0);
+        if (pwrite(spool_fd, chunk, len, SPOOL_HEADER_SIZE + received) != (ssize_t)len) {
+            perror("Error: failed to write session spool");
+            return TRANSFER_FAILED;
+        }
+        received += len;
+    }
+    return TRANSFER_DONE;
+}
+
+/*
+* Function: transfer_stage()
+*   Receives or sends len bytes of one protocol stage. Waits are bounded by the
+*   stage deadline and the request deadline, whichever comes first: header stages
+*   get stage_ms, payload stages stage_ms plus the time len bytes take at min_rate,
+*   and Part 2 of a later keep-alive request idle_ms. A client missing a deadline
+*   is sent TIMEOUT_REPLY and counted in stats; the caller only has to free its
+*   buffers and close the socket. An idle keep-alive connection is just closed.
+*   :param int client_socket: connected client socket
+*   :param void *buffer: bytes to send or buffer receiving len bytes
+*   :param size_t len: number of bytes in this stage
+*   :param bool sending: true to send buffer, false to receive into it
+*   :param int kind: STAGE_HEADER, STAGE_PAYLOAD or STAGE_NEXT
+*   :return int: TRANSFER_DONE, TRANSFER_EOF (closed before first byte), TRANSFER_IDLE
+*                (idle_ms passed before next request), TRANSFER_FAILED
+*/
+int transfer_stage(int client_socket, void *buffer, size_t len, bool sending, int kind) {
+    struct timespec stage_deadline;
+
+    if (kind == STAGE_PAYLOAD) {
+        arm_deadline(&stage_deadline, payload_stage_ms(len));
+    } else {
+        arm_deadline(&stage_deadline, kind == STAGE_NEXT ? limits.idle_ms : limits.stage_ms);
+    }
+    return transfer_bytes(client_socket, buffer, len, sending, kind, &stage_deadline);
+}
+
+/*
+* Function: transfer_bytes()
+*   Moves len bytes of a stage against an already armed stage deadline, so a stage
+*   sent in several pieces (parallel response blocks) shares one deadline.
+*   :param int client_socket: connected client socket
+*   :param void *buffer: bytes to send or buffer receiving len bytes
+*   :param size_t len: number of bytes to move
+*   :param bool sending: true to send buffer, false to receive into it
+*   :param int kind: STAGE_HEADER, STAGE_PAYLOAD or STAGE_NEXT
+*   :param const struct timespec *stage_deadline: deadline of the whole stage
+*   :return int: same results as transfer_stage()
+*/
+int transfer_bytes(int client_socket, void *buffer, size_t len, bool sending, int kind,
+                   const struct timespec *stage_deadline) {
+    size_t total = 0;
+    // Bulk payload shares bulk_rate with the other bulk requests, moved in small pieces
+    bool paced = bulk_slot && limits.bulk_rate && kind == STAGE_PAYLOAD;
+
+    while (total < len) {
+        // Try the socket first, only wait (and check deadlines) when it is not ready
+        ssize_t bytes;
+        size_t want = (paced && len - total > BULK_CHUNK) ? BULK_CHUNK : len - total;
+        if (sending && zerocopy_reply && kind == STAGE_PAYLOAD) {
+            bytes = zc_send(&zerocopy, client_socket, (char *)buffer + total, want, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else if (sending) {
+            bytes = send(client_socket, (char *)buffer + total, want, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            bytes = recv(client_socket, (char *)buffer + total, want, MSG_DONTWAIT);
+        }
+        if (bytes > 0) {
+            total += bytes;
+            long pace_us = paced ? bulk_pace(stats, &limits, bytes) : 0;
+            if (pace_us > 0) {
+                struct timespec pause = { .tv_sec = pace_us / 1000000, .tv_nsec = (pace_us % 1000000) * 1000L };
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        } else if (bytes == 0) {
+            return (total == 0 && !sending) ? TRANSFER_EOF : TRANSFER_FAILED;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror(sending ? "Error: could not write to client" : "Error: could not read from client");
+            return TRANSFER_FAILED;
+        }
+        // Wait for the socket, bounded by the nearest deadline
+        long stage_left = ms_until(stage_deadline);
+        long request_left = ms_until(&request_deadline);
+        long wait_ms = stage_left;
+        if (request_left >= 0 && (wait_ms < 0 || request_left < wait_ms)) {
+            wait_ms = request_left;
+        }
+        if (wait_ms == 0) {
+            // An idle keep-alive connection is simply closed, nothing was cut off
+            if (kind == STAGE_NEXT && total == 0) {
+                return TRANSFER_IDLE;
+            }
+            if (request_left == 0) {
+                stats_add(&stats->timeout_request, 1);
+            } else if (kind == STAGE_PAYLOAD) {
+                stats_add(&stats->timeout_rate, 1);
+            } else {
+                stats_add(&stats->timeout_stage, 1);
+            }
+            cut_off(client_socket);
+            return TRANSFER_FAILED;
+        }
+        // Queued zero-copy completions would wake poll() at once (POLLERR)
+        if (zerocopy_reply) {
+            zc_reap(&zerocopy, client_socket);
+        }
+        // A draining server stops waiting for the next keep-alive request
+        struct pollfd waiters[2] = {
+            { .fd = client_socket, .events = sending ? POLLOUT : POLLIN },
+            { .fd = drain_fd, .events = POLLIN },
+        };
+        bool drainable = (kind == STAGE_NEXT && total == 0 && drain_fd >= 0);
+        poll(waiters, drainable ? 2 : 1, wait_ms < 0 ? -1 : (int)wait_ms);
+        if (drainable && waiters[1].revents && !waiters[0].revents) {
+            return TRANSFER_IDLE;
+        }
+    }
+    return TRANSFER_DONE;
+}
+
+/*
+* Function: send_parallel()
+*   Transforms a large message on the worker's cipher pool and sends each block of
+*   the result as soon as it and every block before it are finished, so sending
+*   overlaps with transforming the rest. The pool is created on first use; only the
+*   helper threads free server-wide work on the request, so concurrent large
+*   requests share cipher_threads instead of each starting that many.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int client_socket: connected client socket
+*   :param char *result: buffer of at least msg_len characters for the result
+*   :param const char *msg: message characters
+*   :param size_t msg_len: number of message characters
+*   :param const char *key: key characters
+*   :return int: TRANSFER_DONE or TRANSFER_FAILED
+*/
+int send_parallel(const struct server_profile *profile, int client_socket, char *result,
+                  const char *msg, size_t msg_len, const char *key) {
+    struct timespec stage_deadline;
+    size_t offset;
+    size_t block_len;
+    int status = TRANSFER_DONE;
+
+    if (!cipher_pool) {
+        cipher_pool = pool_create(limits.cipher_threads);
+    }
+    if (!cipher_pool) {
+        profile->transform(result, msg, msg_len, key);
+        return transfer_stage(client_socket, result, msg_len, true, STAGE_PAYLOAD);
+    }
+    arm_deadline(&stage_deadline, payload_stage_ms(msg_len));
+    // No more helpers than blocks beyond the one the worker starts on
+    size_t blocks = (msg_len + POOL_BLOCK_SIZE - 1) / POOL_BLOCK_SIZE;
+    int helpers = helpers_acquire(stats, &limits, blocks > POOL_MAX_THREADS ? POOL_MAX_THREADS : (int)blocks - 1);
+    pool_start(cipher_pool, helpers, profile->transform, result, msg, msg_len, key);
+    while (status == TRANSFER_DONE && pool_next_block(cipher_pool, &offset, &block_len)) {
+        status = transfer_bytes(client_socket, result + offset, block_len, true, STAGE_PAYLOAD, &stage_deadline);
+    }
+    // Threads may still be writing result if sending failed
+    pool_finish(cipher_pool);
+    helpers_release(stats, helpers);
+    return status;
+}
+
+/*
+* Function: payload_stage_ms()
+*   Deadline of a stage moving len payload bytes: stage_ms of grace plus the time
+*   len bytes take at min_rate (or a bulk request's share of bulk_rate, if lower).
+*   Without a minimum rate only the request deadline applies.
+*   :param size_t len: payload bytes in the stage
+*   :return long: stage deadline in ms (0 = none)
+*/
+long payload_stage_ms(size_t len) {
+    uint64_t rate = limits.min_rate;
+
+    // A paced bulk request is only owed its share of the bulk bandwidth
+    if (bulk_slot && limits.bulk_rate && limits.bulk_rate / limits.bulk_workers < rate) {
+        rate = limits.bulk_rate / limits.bulk_workers;
+    }
+    if (rate == 0) {
+        return 0;
+    }
+    return limits.stage_ms + (long)(len * 1000ULL / rate);
+}
+
+/*
+* Function: cut_off()
+*   Tells a client that missed a deadline why it is dropped. Never blocks: a
+*   stalled client may not be reading, so the word is only sent if it fits.
+*   :param int client_socket: connected client socket
+*/
+void cut_off(int client_socket) {
+    trace.status = TRACE_TIMEOUT;
+    send(client_socket, TIMEOUT_REPLY, strlen(TIMEOUT_REPLY), MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(client_socket, SHUT_RDWR);
+}
+
+/*
+* Function: arm_deadline()
+*   Sets deadline to ms from now; ms of 0 (no limit) disarms it.
+*   :param struct timespec *deadline: deadline to set
+*   :param long ms: milliseconds from now
+*/
+void arm_deadline(struct timespec *deadline, long ms) {
+    if (ms <= 0) {
+        disarm_deadline(deadline);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+* Function: disarm_deadline()
+*   Marks deadline as not set.
+*   :param struct timespec *deadline: deadline to clear
+*/
+void disarm_deadline(struct timespec *deadline) {
+    deadline->tv_sec = 0;
+    deadline->tv_nsec = 0;
+}
+
+/*
+* Function: deadline_armed()
+*   :param const struct timespec *deadline: deadline to check
+*   :return bool: true if deadline is set
+*/
+bool deadline_armed(const struct timespec *deadline) {
+    return deadline->tv_sec != 0 || deadline->tv_nsec != 0;
+}
+
+/*
+* Function: ms_until()
+*   Milliseconds left before deadline, rounded up so a wait never ends early.
+*   :param const struct timespec *deadline: deadline to check
+*   :return long: milliseconds left, 0 once passed, -1 if deadline is not set
+*/
+long ms_until(const struct timespec *deadline) {
+    struct timespec now;
+
+    if (!deadline_armed(deadline)) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long left_ns = (long long)(deadline->tv_sec - now.tv_sec) * 1000000000LL +
+                        (deadline->tv_nsec - now.tv_nsec);
+    return (left_ns <= 0) ? 0 : (long)((left_ns + 999999) / 1000000);
+}
+
+/*
+* Function: handle_unix_client()
+*   Handles requests from a client on the same host. After the client ID code,
+*   client passes descriptors with SCM_RIGHTS. Mode 'F' passes message, key and
+*   output descriptors: server maps the input files, writes the result to the output
+*   descriptor and replies with a 4 byte status code; any number of 'F' requests may
+*   follow on the same connection. Mode 'R' passes a shared memory ring that is
+*   served until the client closes it. No payload bytes pass through the socket.
+*   The socket and every passed descriptor are closed on return.
+*   :param const struct server_profile *profile: server specific codes and transform
+*   :param int client_socket: connected UNIX-domain client socket
+*   :return bool: false if the connection ended on an error or refusal
+*/
+bool handle_unix_client(const struct server_profile *profile, int client_socket) {
+    int fds[UNIX_MAX_FDS];
+    char mode;
+    char variant;
+    int fd_count = 0;
+
+    // Sessions exist for lossy links, a local client has nothing to resume
+    if (!check_client_code(profile, client_socket, &variant) || variant == RESUME_SUFFIX[0]) {
+        close(client_socket);
+        return false;
+    }
+    // Descriptor requests carry no payload; only the wait between them is bounded
+    struct timeval idle = { .tv_sec = limits.idle_ms / 1000, .tv_usec = (limits.idle_ms % 1000) * 1000 };
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    for (int request = 0; (request == 0 || wait_next_request(client_socket)) &&
+                          (fd_count = recv_fds(client_socket, &mode, fds, UNIX_MAX_FDS)) > 0; request++) {
+        if (mode == UNIX_MODE_RING && fd_count == 1 && request == 0) {
+            return serve_ring(profile, client_socket, fds[0]);
+        }
+        if (mode != UNIX_MODE_FILES || fd_count != UNIX_FILE_FD_COUNT) {
+            fprintf(stderr, "Error: unknown request mode from client\n");
+            for (int i = 0; i < fd_count; i++) {
+                close(fds[i]);
+            }
+            close(client_socket);
+            return false;
+        }
+        trace_begin(TRACE_UNIX);
+        int status = process_fd_request(profile, fds[0], fds[1], fds[2]);
+        trace_stage(&trace.result_us);
+        trace_end(status == UNIX_STATUS_OK ? TRACE_OK :
+                  (status == UNIX_STATUS_TOO_BIG ? TRACE_TOO_BIG :
+                  (status == UNIX_STATUS_KEY_SHORT ? TRACE_KEY_SHORT :
+                  (status == UNIX_STATUS_TIMEOUT ? TRACE_TIMEOUT : TRACE_FAILED))));
+        for (int i = 0; i < UNIX_FILE_FD_COUNT; i++) {
+            close(fds[i]);
+        }
+        int nbo_status = htonl(status);
+        if (send(client_socket, &nbo_status, sizeof(nbo_status), MSG_NOSIGNAL) < 0) {
+            break;
+        }
+    }
+    if (fd_count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        stats_add(&stats->idle_closed, 1);
+    }
+    close(client_socket);
+    return true;
+}
+
+/*
+* Function: serve_ring()
+*   Serves requests from a client shared memory ring until the client closes it
+*   or exits. Requests ready together (waiting up to batch_us after the first for
+*   more) are transformed as one batch and answered with one publish. The
+*   worker's batch buffer is allocated once and reused by its later rings.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int client_socket: connected UNIX-domain client socket
+*   :param int memfd: shared memory descriptor of the ring
+*   :return bool: false if the ring could not be served or the client broke it
+*                 (socket and memfd closed)
+*/
+bool serve_ring(const struct server_profile *profile, int client_socket, int memfd) {
+    struct otp_ring *ring = ring_attach(client_socket, memfd);
+    if (!ring) {
+        close(memfd);
+        close(client_socket);
+        return false;
+    }
+    // Message, key and result of a batch side by side; any single request fits
+    size_t batch_size = (limits.batch_bytes > RING_SLOT_DATA) ? limits.batch_bytes : RING_SLOT_DATA;
+    if (!ring_batch) {
+        ring_batch = malloc(3 * batch_size);
+    }
+    if (!ring_batch) {
+        perror("Error: failed to allocate memory for ring batch");
+        ring_close(ring);
+        return false;
+    }
+    char *batch = ring_batch;
+    while (ring_peek(ring, &ring->shared->requests) != NULL) {
+        if (!ring_reserve(ring, &ring->shared->responses)) {
+            break;
+        }
+        // A batch is bounded by the response slots the client has freed
+        uint32_t count = 1;
+        if (limits.batch_bytes > 0) {
+            uint32_t space = ring_space(ring, &ring->shared->responses);
+            uint32_t ready = ring_wait_ready(ring, &ring->shared->requests, space, limits.batch_us);
+            count = (ready < space) ? ready : space;
+        }
+        // A client that moved its indices out of bounds loses the ring
+        if (ring->broken || count == 0 || count > RING_SLOT_COUNT) {
+            break;
+        }
+        count = transform_ring_batch(profile, ring, batch, count);
+        ring_release_count(ring, &ring->shared->requests, count);
+        ring_publish_count(ring, &ring->shared->responses, count);
+    }
+    bool served = !ring->broken;
+    ring_close(ring);
+    return served;
+}
+
+/*
+* Function: transform_ring_batch()
+*   Checks up to count ready request slots and copies the messages and key
+*   characters of the valid ones into one contiguous batch, transforms the batch in a
+*   single pass and copies each result into its response slot. Stops before the
+*   batch would exceed batch_bytes; the first request is always taken.
+*   :param const struct server_profile *profile: server specific transform
+*   :param struct otp_ring *ring: server ring handle
+*   :param char *batch: room for 3 times the larger of batch_bytes and RING_SLOT_DATA
+*   :param uint32_t count: request slots ready and response slots free
+*   :return uint32_t: number of requests answered (at least 1)
+*/
+uint32_t transform_ring_batch(const struct server_profile *profile, struct otp_ring *ring,
+                              char *batch, uint32_t count) {
+    size_t batch_size = (limits.batch_bytes > RING_SLOT_DATA) ? limits.batch_bytes : RING_SLOT_DATA;
+    char *batch_msg = batch;
+    char *batch_key = batch + batch_size;
+    char *batch_result = batch + 2 * batch_size;
+    size_t batch_len = 0;
+    uint32_t result_lens[RING_SLOT_COUNT];
+    uint32_t taken;
+
+    for (taken = 0; taken < count; taken++) {
+        struct ring_slot *request = ring_peek_at(ring, &ring->shared->requests, taken);
+        struct ring_slot *response = ring_reserve_at(ring, &ring->shared->responses, taken);
+        // Read lengths once, client can still write to shared memory
+        uint32_t key_len = __atomic_load_n(&request->key_len, __ATOMIC_RELAXED);
+        uint32_t msg_len = __atomic_load_n(&request->msg_len, __ATOMIC_RELAXED);
+        if (taken > 0 && key_len <= RING_SLOT_DATA && batch_len + msg_len > limits.batch_bytes) {
+            break;
+        }
+        response->id = request->id;
+        result_lens[taken] = 0;
+        if (key_len > RING_SLOT_DATA || msg_len > RING_SLOT_DATA - key_len ||
+                !valid_text(request->data, key_len + msg_len)) {
+            response->status = UNIX_STATUS_BAD_INPUT;
+        } else if (key_len < msg_len) {
+            stats_add(&stats->rejected_key_short, 1);
+            response->status = UNIX_STATUS_KEY_SHORT;
+        } else {
+            memcpy(batch_msg + batch_len, request->data + key_len, msg_len);
+            memcpy(batch_key + batch_len, request->data, msg_len);
+            batch_len += msg_len;
+            result_lens[taken] = msg_len;
+            response->status = UNIX_STATUS_OK;
+        }
+    }
+    profile->transform(batch_result, batch_msg, batch_len, batch_key);
+    size_t offset = 0;
+    for (uint32_t i = 0; i < taken; i++) {
+        // Lengths kept here, the client can write to response slots too
+        struct ring_slot *response = ring_reserve_at(ring, &ring->shared->responses, i);
+        memcpy(response->data, batch_result + offset, result_lens[i]);
+        response->msg_len = result_lens[i];
+        offset += result_lens[i];
+    }
+    if (taken > 1) {
+        stats_add(&stats->ring_batches, 1);
+        stats_add(&stats->ring_batched, taken);
+    }
+    return taken;
+}
+
+/*
+* Function: process_fd_request()
+*   Maps message and key files, applies transform in chunks and writes result
+*   followed by a newline to the output descriptor, within the request deadline.
+*   :param const struct server_profile *profile: server specific transform
+*   :param int msg_fd: descriptor of message file
+*   :param int key_fd: descriptor of key file
+*   :param int out_fd: descriptor receiving the result
+*   :return int: UNIX_STATUS_* code
+*/
+int process_fd_request(const struct server_profile *profile, int msg_fd, int key_fd, int out_fd) {
+    char *msg_map = NULL;
+    char *key_map = NULL;
+    size_t msg_map_size;
+    size_t key_map_size;
+    size_t msg_len;
+    size_t key_len;
+    int status;
+
+    arm_deadline(&request_deadline, limits.request_ms);
+    status = map_valid_fd(msg_fd, &msg_map, &msg_map_size, &msg_len);
+    if (status != UNIX_STATUS_OK) {
+        return status;
+    }
+    status = map_valid_fd(key_fd, &key_map, &key_map_size, &key_len);
+    if (status != UNIX_STATUS_OK) {
+        munmap(msg_map, msg_map_size);
+        return status;
+    }
+    trace.key_len = key_len;
+    trace.msg_len = msg_len;
+    if (limits.max_msg_len && msg_len > limits.max_msg_len) {
+        stats_add(&stats->rejected_size, 1);
+        munmap(msg_map, msg_map_size);
+        munmap(key_map, key_map_size);
+        return UNIX_STATUS_TOO_BIG;
+    }
+    // Key file cannot be shorter than message file
+    if (key_len < msg_len) {
+        stats_add(&stats->rejected_key_short, 1);
+        munmap(msg_map, msg_map_size);
+        munmap(key_map, key_map_size);
+        return UNIX_STATUS_KEY_SHORT;
+    }
+    if (limits.bulk_min && msg_len >= limits.bulk_min && !enter_bulk_lane()) {
+        munmap(msg_map, msg_map_size);
+        munmap(key_map, key_map_size);
+        return UNIX_STATUS_BUSY;
+    }
+    char *chunk = malloc(UNIX_CHUNK_SIZE + 1);
+    if (!chunk) {
+        perror("Error: failed to allocate memory for response");
+        munmap(msg_map, msg_map_size);
+        munmap(key_map, key_map_size);
+        return UNIX_STATUS_IO_ERROR;
+    }
+    // The output may be a pipe nobody reads: write without blocking, against the
+    // request deadline and a payload stage deadline for the whole response
+    struct timespec stage_deadline;
+    arm_deadline(&stage_deadline, payload_stage_ms(msg_len + 1));
+    int out_flags = fcntl(out_fd, F_GETFL);
+    if (out_flags >= 0 && !(out_flags & O_NONBLOCK)) {
+        fcntl(out_fd, F_SETFL, out_flags | O_NONBLOCK);
+    }
+    // Transform and write one chunk at a time so memory stays bounded
+    for (size_t offset = 0; offset < msg_len && status == UNIX_STATUS_OK; offset += UNIX_CHUNK_SIZE) {
+        size_t chunk_len = msg_len - offset;
+        if (chunk_len > UNIX_CHUNK_SIZE) {
+            chunk_len = UNIX_CHUNK_SIZE;
+        }
+        profile->transform(chunk, msg_map + offset, chunk_len, key_map + offset);
+        // Terminating newline rides along with the final chunk
+        if (offset + chunk_len == msg_len) {
+            chunk[chunk_len++] = '\n';
+        }
+        status = write_all(out_fd, chunk, chunk_len, &stage_deadline);
+    }
+    // The descriptor is shared with the client, leave its flags as they were
+    if (out_flags >= 0 && !(out_flags & O_NONBLOCK)) {
+        fcntl(out_fd, F_SETFL, out_flags);
+    }
+    free(chunk);
+    munmap(msg_map, msg_map_size);
+    munmap(key_map, key_map_size);
+    leave_bulk_lane();
+    if (status == UNIX_STATUS_OK) {
+        stats_add(&stats->completed, 1);
+    }
+    return status;
+}
+
+/*
+* Function: map_valid_fd()
+*   Memory maps a client file and verifies it contains only valid characters
+*   (uppercase letters and space) up to the first newline character.
+*   :param int fd: descriptor of file to map
+*   :param char **map: set to start of mapping
+*   :param size_t *map_size: set to size of mapping
+*   :param size_t *text_len: set to number of text characters before newline
+*   :return int: UNIX_STATUS_* code
+*/
+int map_valid_fd(int fd, char **map, size_t *map_size, size_t *text_len) {
+    struct stat file_info;
+
+    if (fstat(fd, &file_info) < 0 || !S_ISREG(file_info.st_mode) || file_info.st_size < 1) {
+        return UNIX_STATUS_BAD_INPUT;
+    }
+    *map_size = file_info.st_size;
+    *map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*map == MAP_FAILED) {
+        perror("Error: failed to map client file");
+        return UNIX_STATUS_IO_ERROR;
+    }
+    char *newline = memchr(*map, '\n', *map_size);
+    *text_len = newline ? (size_t)(newline - *map) : *map_size;
+    if (!valid_text(*map, *text_len)) {
+        munmap(*map, *map_size);
+        return UNIX_STATUS_BAD_INPUT;
+    }
+    return UNIX_STATUS_OK;
+}
+
+/*
+* Function: valid_text()
+*   Verifies text contains only valid characters (uppercase letters and space).
+*   :param const char *text: characters to check
+*   :param size_t len: number of characters
+*   :return bool: true if every character is valid
+*/
+bool valid_text(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!(isupper(text[i]) || isspace(text[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+* Function: write_all()
+*   Writes the whole buffer to a non-blocking descriptor, waiting for it to drain
+*   until the stage deadline or the request deadline, whichever comes first. A
+*   missed deadline is counted in stats like a socket transfer's.
+*   :param int fd: descriptor to write
+*   :param const char *buffer: data to write
+*   :param size_t len: number of bytes to write
+*   :param const struct timespec *stage_deadline: deadline of the response stage
+*   :return int: UNIX_STATUS_OK, UNIX_STATUS_TIMEOUT or UNIX_STATUS_IO_ERROR
+*/
+int write_all(int fd, const char *buffer, size_t len, const struct timespec *stage_deadline) {
+    size_t total_written = 0;
+    while (total_written < len) {
+        ssize_t bytes_written = write(fd, buffer + total_written, len - total_written);
+        if (bytes_written > 0) {
+            total_written += bytes_written;
+            continue;
+        } else if (bytes_written == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            perror("Error: could not write to client output");
+            return UNIX_STATUS_IO_ERROR;
+        }
+        // Wait for the descriptor, bounded by the nearest deadline
+        long stage_left = ms_until(stage_deadline);
+        long request_left = ms_until(&request_deadline);
+        long wait_ms = stage_left;
+        if (request_left >= 0 && (wait_ms < 0 || request_left < wait_ms)) {
+            wait_ms = request_left;
+        }
+        if (wait_ms == 0) {
+            stats_add(request_left == 0 ? &stats->timeout_request : &stats->timeout_rate, 1);
+            return UNIX_STATUS_TIMEOUT;
+        }
+        struct pollfd waiter = { .fd = fd, .events = POLLOUT };
+        poll(&waiter, 1, wait_ms < 0 ? -1 : (int)wait_ms);
+    }
+    return UNIX_STATUS_OK;
+}
+
+/*
+* Function: charge_budget()
+*   Charges bytes about to be allocated by this worker's request to the global
+*   budget. Charges are returned by release_budget() when the request ends.
+*   :param uint64_t bytes: bytes about to be allocated
+*   :return bool: true if charged, false if budget did not free up within queue_ms
+*/
+bool charge_budget(uint64_t bytes) {
+    if (!budget_acquire(stats, &limits, bytes)) {
+        return false;
+    }
+    charged_bytes += bytes;
+    return true;
+}
+
+/*
+* Function: release_budget()
+*   Returns everything the current request charged to the global budget.
+*   Also registered with atexit() (end_connection() on worker threads) so
+*   requests ended by errors do not leak budget.
+*/
+void release_budget(void) {
+    budget_release(stats, charged_bytes);
+    charged_bytes = 0;
+}
+
+/*
+* Function: reject_request()
+*   Answers a refused request with a status word and closes the connection. Input
+*   the client is still sending is drained for a short time first, so closing does
+*   not reset the connection before the client reads the status.
+*   :param int client_socket: connected client socket
+*   :param const char *reply: BUSY_REPLY, TOO_BIG_REPLY, KEY_SHORT_REPLY or NO_SESSION_REPLY
+*/
+void reject_request(int client_socket, const char *reply) {
+    char drain[4096];
+    struct timeval idle = { .tv_sec = 0, .tv_usec = REJECT_DRAIN_MS * 1000 };
+    struct timespec start;
+    struct timespec now;
+
+    if (strcmp(reply, TOO_BIG_REPLY) == 0) {
+        trace.status = TRACE_TOO_BIG;
+    } else if (strcmp(reply, KEY_SHORT_REPLY) == 0) {
+        trace.status = TRACE_KEY_SHORT;
+    } else {
+        trace.status = (strcmp(reply, BUSY_REPLY) == 0) ? TRACE_BUSY : TRACE_NO_SESSION;
+    }
+    send(client_socket, reply, strlen(reply), MSG_NOSIGNAL);
+    shutdown(client_socket, SHUT_WR);
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (recv(client_socket, drain, sizeof(drain), 0) > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > REJECT_DRAIN_MAX_MS) {
+            break;
+        }
+    }
+    close(client_socket);
+}
+
+/*
+* Function: reject_connection()
+*   Refuses a connection while every worker is busy by answering the client ID
+*   code with BUSY_REPLY. Runs in the parent, so it never blocks.
+*   :param int client_socket: accepted client socket
+*/
+void reject_connection(int client_socket) {
+    char client_code[10];
+
+    stats_add(&stats->rejected_busy, 1);
+    recv(client_socket, client_code, sizeof(client_code), MSG_DONTWAIT);
+    send(client_socket, BUSY_REPLY, strlen(BUSY_REPLY), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_socket);
+}
+
+/*
+* Function: wait_for_worker()
+*   Waits up to queue_ms for the number of interactive workers to drop below
+*   max_workers; workers in the bulk lane do not count. Exiting workers, worker
+*   threads finishing a connection and workers moving to the bulk lane interrupt
+*   the wait with SIGCHLD.
+*   :return bool: true if a new worker may be started
+*/
+bool wait_for_worker(void) {
+    struct timespec start;
+    struct timespec now;
+
+    reap_workers();
+    if (limits.max_workers <= 0 || interactive_workers() < (uint32_t)limits.max_workers) {
+        return true;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long remaining_ms = limits.queue_ms - ((now.tv_sec - start.tv_sec) * 1000 +
+                                               (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (remaining_ms <= 0) {
+            return false;
+        }
+        poll(NULL, 0, remaining_ms);
+        reap_workers();
+        if (interactive_workers() < (uint32_t)limits.max_workers) {
+            return true;
+        }
+    }
+}
+
+/*
+* Function: interactive_workers()
+*   :return uint32_t: running workers not serving a bulk request
+*/
+uint32_t interactive_workers(void) {
+    uint32_t workers = __atomic_load_n(&stats->workers, __ATOMIC_RELAXED);
+    uint32_t bulk = __atomic_load_n(&stats->bulk_lane, __ATOMIC_RELAXED);
+    return (workers > bulk) ? workers - bulk : 0;
+}
+
+/*
+* Function: reap_workers()
+*   Cleans up exited worker processes without blocking.
+*/
+void reap_workers(void) {
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        __atomic_sub_fetch(&stats->workers, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+* Function: notify_acceptor()
+*   Wakes an acceptor queued for a free worker (wait_for_worker()) with SIGCHLD:
+*   the parent of a worker process, or this process for a worker thread, where
+*   only the acceptor thread takes signals.
+*/
+void notify_acceptor(void) {
+    kill(engine ? getpid() : getppid(), SIGCHLD);
+}
+
+/*
+* Function: serve_connection()
+*   Worker thread side of the engine (-T): serves one queued connection with the
+*   worker state a fresh worker process would start with, then returns the worker.
+*   :param const void *context: server profile
+*   :param int client_socket: accepted client socket
+*   :param bool is_unix: true for a UNIX-domain connection
+*   :param uint32_t connection: connection number given by the acceptor
+*/
+void serve_connection(const void *context, int client_socket, bool is_unix, uint32_t connection) {
+    const struct server_profile *profile = context;
+
+    connection_number = connection;
+    traced_requests = 0;
+    memset(&zerocopy, '\0', sizeof(zerocopy));
+    zerocopy_tried = false;
+    if (is_unix) {
+        handle_unix_client(profile, client_socket);
+    } else {
+        handle_tcp_client(profile, client_socket);
+    }
+    end_connection();
+    __atomic_sub_fetch(&stats->workers, 1, __ATOMIC_RELAXED);
+    notify_acceptor();
+}
+
+/*
+* Function: end_connection()
+*   Does for a worker thread what the exit handlers do for a worker process: a
+*   request ended by an error or refusal is traced and its budget and bulk slot
+*   are returned.
+*/
+void end_connection(void) {
+    leave_bulk_lane();
+    trace_exit();
+    release_budget();
+}
+
+/*
+* Function: drain_workers()
+*   Waits for every worker to exit after the listeners were handed off. Closing the
+*   drain pipe ends keep-alive and descriptor connections at their next wait for a
+*   request; requests already started run to completion.
+*   :param int drain_notify: write end of the drain pipe
+*/
+void drain_workers(int drain_notify) {
+    close(drain_notify);
+    while (__atomic_load_n(&stats->workers, __ATOMIC_RELAXED) > 0) {
+        if (stats_requested) {
+            stats_requested = 0;
+            stats_print(stats, stderr);
+        }
+        // SIGCHLD ends the wait early; the timeout covers one arriving just before it
+        poll(NULL, 0, 100);
+        reap_workers();
+    }
+}
+
+/*
+* Function: wait_next_request()
+*   Waits up to idle_ms for the next request on a connection carrying several; a
+*   server handing off its listeners stops waiting at once.
+*   :param int client_socket: connected client socket
+*   :return bool: true if the client sent more (or closed), false if it was closed as idle
+*/
+bool wait_next_request(int client_socket) {
+    struct pollfd waiters[2] = {
+        { .fd = client_socket, .events = POLLIN },
+        { .fd = drain_fd, .events = POLLIN },
+    };
+    int ready;
+
+    while ((ready = poll(waiters, 2, limits.idle_ms > 0 ? limits.idle_ms : -1)) < 0 && errno == EINTR);
+    if (ready > 0 && waiters[0].revents) {
+        return true;
+    }
+    stats_add(&stats->idle_closed, 1);
+    return false;
+}
+
+/*
+* Function: on_signal()
+*   SIGCHLD only interrupts blocking calls in the parent; SIGUSR1 asks for stats.
+*   :param int signal_num: received signal
+*/
+void on_signal(int signal_num) {
+    if (signal_num == SIGUSR1) {
+        stats_requested = 1;
+    }
+}
+
+/*
+* Function: setup_socket()
+*   Sets up a socket address with port_num value.
+*   :param struct sockaddr_in* address: structure for socket address
+*   :param int port_num: port number for socket address
+*/
+void setup_socket(struct sockaddr_in* address, int port_num) {
+    // Clear out the address struct
+    memset((char*) address, '\0', sizeof(*address));
+
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Convert and store the port number in network byte order
+    address->sin_port = htons(port_num);
+    // Allow a client at any address to connect to this server
+    address->sin_addr.s_addr = INADDR_ANY;
+}
+
+/*
+* Function: trace_begin()
+*   Starts tracing a request whose Part 2 (or session header) just arrived. Does
+*   nothing unless the server was started with -L.
+*   :param int transport: TRACE_TCP, TRACE_UNIX or TRACE_SESSION
+*/
+void trace_begin(int transport) {
+    if (trace_fd < 0) {
+        return;
+    }
+    memset(&trace, '\0', sizeof(trace));
+    trace.arrival_us = trace_elapsed_us();
+    trace.connection = connection_number;
+    trace.sequence = traced_requests++;
+    trace.transport = transport;
+    trace.status = TRACE_FAILED;
+    trace_stage_start = trace.arrival_us;
+    trace_active = true;
+}
+
+/*
+* Function: trace_stage()
+*   Stores the time since the previous stage ended and starts timing the next.
+*   :param uint32_t *stage_us: stage time field of the traced request
+*/
+void trace_stage(uint32_t *stage_us) {
+    if (!trace_active) {
+        return;
+    }
+    uint64_t now = trace_elapsed_us();
+    *stage_us = (now - trace_stage_start > UINT32_MAX) ? UINT32_MAX : (uint32_t)(now - trace_stage_start);
+    trace_stage_start = now;
+}
+
+/*
+* Function: trace_end()
+*   Appends the traced request to the trace file.
+*   :param int status: TRACE_OK or the TRACE_* outcome of the request
+*/
+void trace_end(int status) {
+    if (!trace_active) {
+        return;
+    }
+    trace.status = status;
+    trace_active = false;
+    if (trace_write(trace_fd, &trace) < 0) {
+        perror("Error: failed to write trace record");
+    }
+}
+
+/*
+* Function: trace_exit()
+*   Worker exit handler (end_connection() on worker threads): traces a request
+*   ended early with the outcome noted by cut_off()/ reject_request(), or TRACE_FAILED.
+*/
+void trace_exit(void) {
+    trace_end(trace.status);
+}
+
+/*
+* Function: enter_bulk_lane()
+*   Moves the worker's current request to the bulk lane: it stops counting
+*   against max_workers, so the parent can start a worker for interactive
+*   requests, drops to bulk_nice CPU priority and waits for one of bulk_workers
+*   slots until the request deadline. Priority is lowered for good (raising it
+*   needs privileges); cipher threads started earlier keep theirs. Worker threads
+*   serve other connections afterwards, so they keep their priority.
+*   :return bool: true once a slot is held, false if none freed up in time
+*/
+bool enter_bulk_lane(void) {
+    stats_add(&stats->bulk_requests, 1);
+    __atomic_add_fetch(&stats->bulk_lane, 1, __ATOMIC_RELAXED);
+    in_bulk_lane = true;
+    notify_acceptor();
+    if (!engine && getpriority(PRIO_PROCESS, 0) < limits.bulk_nice) {
+        setpriority(PRIO_PROCESS, 0, limits.bulk_nice);
+    }
+    long timeout_ms = deadline_armed(&request_deadline) ? ms_until(&request_deadline)
+                                                        : (limits.request_ms > 0 ? limits.request_ms : -1);
+    if (!lane_acquire(stats, &limits, timeout_ms)) {
+        stats_add(&stats->rejected_bulk, 1);
+        return false;
+    }
+    bulk_slot = true;
+    return true;
+}
+
+/*
+* Function: leave_bulk_lane()
+*   Returns the bulk slot and lane count of the current request, if any. Also
+*   registered with atexit() (end_connection() on worker threads) so requests
+*   ended by errors do not leak slots.
+*/
+void leave_bulk_lane(void) {
+    if (bulk_slot) {
+        lane_release(stats);
+        bulk_slot = false;
+    }
+    if (in_bulk_lane) {
+        __atomic_sub_fetch(&stats->bulk_lane, 1, __ATOMIC_RELAXED);
+        in_bulk_lane = false;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include <stddef.h>         // Size types
+
+/*
+Module Name: Server Core
+Author: Jose Bianchi
+Description: Shared listener and request handling for the encryption and decryption
+    servers. Each server supplies a profile naming its client ID code, access response,
+    and cipher transform; everything else (TCP and UNIX-domain listeners, the 5 part
+    request protocol, descriptor requests) is implemented once here.
+*/
+
+/*
+* Type: transform_fn
+*   Applies the cipher to len characters of text with the matching key characters,
+*   writing len result characters to out (no terminating character).
+*/
+typedef void (*transform_fn)(char *out, const char *text, size_t len, const char *key_seq);
+
+struct server_profile {
+    const char *name;               // Server name used in usage/ error output
+    const char *permitted_code;     // Client ID code accepted by this server
+    const char *accept_reply;       // Access response sent to permitted clients
+    transform_fn transform;         // Encryption or decryption of one block
+};
+
+int run_server(const struct server_profile *profile, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE                 // be64toh()/ htobe64()
+#include <stdio.h>          // Input/ output
+#include <stdlib.h>         // Memory management
+#include <string.h>         // String functions
+#include <time.h>           // Time functions
+#include <endian.h>         // Byte order conversion
+#include <dirent.h>         // Directory functions
+#include <errno.h>          // Error numbers
+#include <fcntl.h>          // File control functions
+#include <sys/file.h>       // File locking
+#include <sys/stat.h>       // File status functions
+#include <sys/random.h>     // Random bytes
+#include <unistd.h>         // Process management/ file operations
+#include "otp_spool.h"
+
+#define SPOOL_SUFFIX ".spool"
+
+// Helper function declarations
+static void spool_path(char *path, size_t size, const char *dir, const char *prefix, const char *token);
+static bool spool_name(const char *name, const char *prefix);
+
+/*
+* Function: spool_create()
+*   Creates the spool file of a new session under a random token and locks it.
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name, keeps spools of both servers apart
+*   :param uint64_t key_len: key characters the session will send
+*   :param uint64_t msg_len: message characters the session will send
+*   :param char *token: buffer of SPOOL_TOKEN_LEN + 1 characters for the token
+*   :return int: locked spool descriptor or -1 if error
+*/
+int spool_create(const char *dir, const char *prefix, uint64_t key_len, uint64_t msg_len, char *token) {
+    unsigned char random_bytes[SPOOL_TOKEN_LEN / 2];
+    char path[4096];
+
+    if (getrandom(random_bytes, sizeof(random_bytes), 0) != sizeof(random_bytes)) {
+        perror("Error: failed to generate session token");
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(random_bytes); i++) {
+        sprintf(token + i * 2, "%02X", random_bytes[i]);
+    }
+    spool_path(path, sizeof(path), dir, prefix, token);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        perror("Error: failed to create session spool");
+        return -1;
+    }
+    uint64_t header[2] = {htobe64(key_len), htobe64(msg_len)};
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0 || write(fd, header, sizeof(header)) != sizeof(header)) {
+        perror("Error: failed to write session spool");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+* Function: spool_open()
+*   Opens and locks the spool file of an existing session.
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name
+*   :param const char *token: session token (validated by the caller)
+*   :param uint64_t *key_len: set to the session's key length
+*   :param uint64_t *msg_len: set to the session's message length
+*   :param uint64_t *received: set to the input characters stored so far
+*   :return int: locked spool descriptor, SPOOL_NOT_FOUND or SPOOL_BUSY (served elsewhere)
+*/
+int spool_open(const char *dir, const char *prefix, const char *token,
+               uint64_t *key_len, uint64_t *msg_len, uint64_t *received) {
+    char path[4096];
+    uint64_t header[2];
+    struct stat file_info;
+
+    spool_path(path, sizeof(path), dir, prefix, token);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return SPOOL_NOT_FOUND;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return SPOOL_BUSY;
+    }
+    // Swept while waiting for the lock, or cut short by a crash before the header
+    if (fstat(fd, &file_info) < 0 || file_info.st_nlink == 0 || file_info.st_size < SPOOL_HEADER_SIZE ||
+            pread(fd, header, sizeof(header), 0) != sizeof(header)) {
+        close(fd);
+        return SPOOL_NOT_FOUND;
+    }
+    *key_len = be64toh(header[0]);
+    *msg_len = be64toh(header[1]);
+    *received = file_info.st_size - SPOOL_HEADER_SIZE;
+    if (*received > *key_len + *msg_len) {
+        close(fd);
+        return SPOOL_NOT_FOUND;
+    }
+    return fd;
+}
+
+/*
+* Function: spool_remove()
+*   Deletes the spool file of a finished session.
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name
+*   :param const char *token: session token
+*/
+void spool_remove(const char *dir, const char *prefix, const char *token) {
+    char path[4096];
+
+    spool_path(path, sizeof(path), dir, prefix, token);
+    unlink(path);
+}
+
+/*
+* Function: spool_sweep()
+*   Removes spool files of this server not written for ttl_sec seconds. Spools
+*   locked by a worker are left alone.
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name
+*   :param int ttl_sec: session lifetime in seconds
+*/
+void spool_sweep(const char *dir, const char *prefix, int ttl_sec) {
+    DIR *spools = opendir(dir);
+    if (!spools) {
+        return;
+    }
+    time_t now = time(NULL);
+    struct dirent *entry;
+    while ((entry = readdir(spools)) != NULL) {
+        if (!spool_name(entry->d_name, prefix)) {
+            continue;
+        }
+        struct stat file_info;
+        int fd = openat(dirfd(spools), entry->d_name, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (fstat(fd, &file_info) == 0 && now - file_info.st_mtime >= ttl_sec &&
+                flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            unlinkat(dirfd(spools), entry->d_name, 0);
+        }
+        close(fd);
+    }
+    closedir(spools);
+}
+
+/*
+* Function: spool_usage()
+*   Adds up the key and message lengths in the headers of this server's spool
+*   files, the bytes its sessions have been admitted to store.
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name
+*   :return uint64_t: bytes declared by the spools in dir
+*/
+uint64_t spool_usage(const char *dir, const char *prefix) {
+    DIR *spools = opendir(dir);
+    if (!spools) {
+        return 0;
+    }
+    uint64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(spools)) != NULL) {
+        if (!spool_name(entry->d_name, prefix)) {
+            continue;
+        }
+        uint64_t header[2];
+        int fd = openat(dirfd(spools), entry->d_name, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        // A spool cut short by a crash before its header holds nothing
+        if (pread(fd, header, sizeof(header), 0) == sizeof(header)) {
+            total += be64toh(header[0]) + be64toh(header[1]);
+        }
+        close(fd);
+    }
+    closedir(spools);
+    return total;
+}
+
+/*
+* Function: spool_lock()
+*   Takes the exclusive lock on the spool directory that serializes creating,
+*   removing and counting spools.
+*   :param const char *dir: spool directory
+*   :return int: lock descriptor for spool_unlock(), -1 if the directory cannot be opened
+*/
+int spool_lock(const char *dir) {
+    int lock_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (lock_fd >= 0 && flock(lock_fd, LOCK_EX) < 0) {
+        close(lock_fd);
+        return -1;
+    }
+    return lock_fd;
+}
+
+/*
+* Function: spool_unlock()
+*   :param int lock_fd: descriptor from spool_lock() (-1 is ignored)
+*/
+void spool_unlock(int lock_fd) {
+    if (lock_fd >= 0) {
+        close(lock_fd);
+    }
+}
+
+/*
+* Function: spool_valid_token()
+*   Checks a token received from a client before it is used in a path.
+*   :param const char *token: SPOOL_TOKEN_LEN characters
+*   :return bool: true if the token is uppercase hex
+*/
+bool spool_valid_token(const char *token) {
+    for (int i = 0; i < SPOOL_TOKEN_LEN; i++) {
+        if (!((token[i] >= '0' && token[i] <= '9') || (token[i] >= 'A' && token[i] <= 'F'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+* Function: spool_path()
+*   :param char *path: buffer for the spool path
+*   :param size_t size: size of path buffer
+*   :param const char *dir: spool directory
+*   :param const char *prefix: server name
+*   :param const char *token: session token
+*/
+static void spool_path(char *path, size_t size, const char *dir, const char *prefix, const char *token) {
+    snprintf(path, size, "%s/%s-%.*s%s", dir, prefix, SPOOL_TOKEN_LEN, token, SPOOL_SUFFIX);
+}
+
+/*
+* Function: spool_name()
+*   :param const char *name: directory entry name
+*   :param const char *prefix: server name
+*   :return bool: true if name is a spool file of this server
+*/
+static bool spool_name(const char *name, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    size_t name_len = strlen(name);
+    return name_len == prefix_len + 1 + SPOOL_TOKEN_LEN + strlen(SPOOL_SUFFIX) &&
+           strncmp(name, prefix, prefix_len) == 0 &&
+           strcmp(name + name_len - strlen(SPOOL_SUFFIX), SPOOL_SUFFIX) == 0;
+}
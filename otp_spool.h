@@ -0,0 +1,37 @@
+#ifndef OTP_SPOOL_H
+#define OTP_SPOOL_H
+
+#include <stdbool.h>        // Boolean values
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Session Spool
+Author: Jose Bianchi
+Description: Files holding the partly received input of resumable sessions, so a
+    client whose connection drops can reconnect and continue from the last byte the
+    server stored. A spool file is named after the server and the session token and
+    holds a header (key and message length, big-endian uint64) followed by the key
+    and message characters received so far; its size is the resume offset. The
+    worker serving a session holds an exclusive flock() on the file, so a session is
+    never served twice at once. Files untouched for longer than the session lifetime
+    are removed by spool_sweep(). Workers and the sweep that create or remove spools
+    hold spool_lock() on the directory, so the bytes spooled by a server can be
+    counted by spool_usage() without racing them.
+*/
+
+#define SPOOL_HEADER_SIZE 16
+#define SPOOL_TOKEN_LEN 32          // Uppercase hex characters
+#define SPOOL_NOT_FOUND -1
+#define SPOOL_BUSY -2
+
+int spool_create(const char *dir, const char *prefix, uint64_t key_len, uint64_t msg_len, char *token);
+int spool_open(const char *dir, const char *prefix, const char *token,
+               uint64_t *key_len, uint64_t *msg_len, uint64_t *received);
+void spool_remove(const char *dir, const char *prefix, const char *token);
+void spool_sweep(const char *dir, const char *prefix, int ttl_sec);
+uint64_t spool_usage(const char *dir, const char *prefix);
+int spool_lock(const char *dir);
+void spool_unlock(int lock_fd);
+bool spool_valid_token(const char *token);
+
+#endif
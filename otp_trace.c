@@ -0,0 +1,193 @@
+#define _GNU_SOURCE                 // be64toh()/ htobe64()
+#include <stdio.h>          // Input/ output
+#include <stdlib.h>         // Memory management
+#include <string.h>         // String functions
+#include <time.h>           // Clock functions
+#include <endian.h>         // Byte order conversion
+#include <fcntl.h>          // File control functions
+#include <sys/stat.h>       // File status functions
+#include <unistd.h>         // Process management/ file operations
+#include "otp_trace.h"
+
+static struct timespec trace_start;     // Monotonic start, inherited by worker processes
+
+// Helper function declarations
+static void put_u64(unsigned char *out, uint64_t value);
+static void put_u32(unsigned char *out, uint32_t value);
+static uint64_t get_u64(const unsigned char *in);
+static uint32_t get_u32(const unsigned char *in);
+
+/*
+* Function: trace_open()
+*   Creates (or truncates) a trace file, writes its header and starts the trace
+*   clock. Call before forking workers so they share the descriptor and clock.
+*   :param const char *path: trace file path
+*   :param const char *name: server name stored in the header
+*   :return int: descriptor to pass to trace_write() or -1 if error
+*/
+int trace_open(const char *path, const char *name) {
+    unsigned char header[TRACE_HEADER_SIZE];
+    struct timespec wall;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Error: failed to open trace file");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    memset(header, '\0', sizeof(header));
+    memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    put_u64(header + TRACE_MAGIC_LEN, (uint64_t)wall.tv_sec * 1000000 + wall.tv_nsec / 1000);
+    put_u32(header + TRACE_MAGIC_LEN + 8, TRACE_RECORD_SIZE);
+    memcpy(header + TRACE_MAGIC_LEN + 16, name, strnlen(name, TRACE_NAME_LEN));
+    if (write(fd, header, sizeof(header)) != sizeof(header)) {
+        perror("Error: failed to write trace file");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+* Function: trace_elapsed_us()
+*   :return uint64_t: microseconds since trace_open()
+*/
+uint64_t trace_elapsed_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - trace_start.tv_sec) * 1000000 +
+           (now.tv_nsec - trace_start.tv_nsec) / 1000;
+}
+
+/*
+* Function: trace_write()
+*   Appends one record with a single write().
+*   :param int fd: trace descriptor from trace_open()
+*   :param const struct trace_record *record: record to append
+*   :return int: 0 or -1 if error
+*/
+int trace_write(int fd, const struct trace_record *record) {
+    unsigned char out[TRACE_RECORD_SIZE];
+
+    memset(out, '\0', sizeof(out));
+    put_u64(out, record->arrival_us);
+    put_u64(out + 8, record->key_len);
+    put_u64(out + 16, record->msg_len);
+    put_u32(out + 24, record->connection);
+    put_u32(out + 28, record->sequence);
+    put_u32(out + 32, record->key_us);
+    put_u32(out + 36, record->msg_us);
+    put_u32(out + 40, record->result_us);
+    out[44] = record->transport;
+    out[45] = record->status;
+    out[46] = record->flags;
+    return (write(fd, out, sizeof(out)) == sizeof(out)) ? 0 : -1;
+}
+
+/*
+* Function: trace_read()
+*   Loads a whole trace. A record cut short at the end (server killed mid-write)
+*   is ignored.
+*   :param const char *path: trace file path
+*   :param struct trace_header *header: set to the trace header
+*   :param struct trace_record **records: set to the records (caller frees)
+*   :param size_t *count: set to the number of records
+*   :return int: 0 or -1 if error (message printed)
+*/
+int trace_read(const char *path, struct trace_header *header, struct trace_record **records, size_t *count) {
+    unsigned char head[TRACE_HEADER_SIZE];
+    unsigned char in[TRACE_RECORD_SIZE];
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Error: failed to open trace file");
+        return -1;
+    }
+    if (fread(head, 1, sizeof(head), file) != sizeof(head) ||
+            memcmp(head, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0 ||
+            get_u32(head + TRACE_MAGIC_LEN + 8) != TRACE_RECORD_SIZE) {
+        fprintf(stderr, "Error: '%s' is not a trace file\n", path);
+        fclose(file);
+        return -1;
+    }
+    header->start_us = get_u64(head + TRACE_MAGIC_LEN);
+    memcpy(header->name, head + TRACE_MAGIC_LEN + 16, TRACE_NAME_LEN);
+    header->name[TRACE_NAME_LEN] = '\0';
+    size_t capacity = 1024;
+    *count = 0;
+    *records = malloc(capacity * sizeof(struct trace_record));
+    while (*records && fread(in, 1, sizeof(in), file) == sizeof(in)) {
+        if (*count == capacity) {
+            capacity *= 2;
+            struct trace_record *grown = realloc(*records, capacity * sizeof(struct trace_record));
+            if (!grown) {
+                free(*records);
+                *records = NULL;
+                break;
+            }
+            *records = grown;
+        }
+        struct trace_record *record = &(*records)[(*count)++];
+        record->arrival_us = get_u64(in);
+        record->key_len = get_u64(in + 8);
+        record->msg_len = get_u64(in + 16);
+        record->connection = get_u32(in + 24);
+        record->sequence = get_u32(in + 28);
+        record->key_us = get_u32(in + 32);
+        record->msg_us = get_u32(in + 36);
+        record->result_us = get_u32(in + 40);
+        record->transport = in[44];
+        record->status = in[45];
+        record->flags = in[46];
+    }
+    fclose(file);
+    if (!*records) {
+        perror("Error: failed to allocate memory for trace");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* Function: put_u64()
+*   :param unsigned char *out: 8 bytes receiving value big-endian
+*   :param uint64_t value: value to store
+*/
+static void put_u64(unsigned char *out, uint64_t value) {
+    uint64_t field = htobe64(value);
+    memcpy(out, &field, sizeof(field));
+}
+
+/*
+* Function: put_u32()
+*   :param unsigned char *out: 4 bytes receiving value big-endian
+*   :param uint32_t value: value to store
+*/
+static void put_u32(unsigned char *out, uint32_t value) {
+    uint32_t field = htobe32(value);
+    memcpy(out, &field, sizeof(field));
+}
+
+/*
+* Function: get_u64()
+*   :param const unsigned char *in: 8 bytes holding a big-endian value
+*   :return uint64_t: value in host byte order
+*/
+static uint64_t get_u64(const unsigned char *in) {
+    uint64_t field;
+    memcpy(&field, in, sizeof(field));
+    return be64toh(field);
+}
+
+/*
+* Function: get_u32()
+*   :param const unsigned char *in: 4 bytes holding a big-endian value
+*   :return uint32_t: value in host byte order
+*/
+static uint32_t get_u32(const unsigned char *in) {
+    uint32_t field;
+    memcpy(&field, in, sizeof(field));
+    return be32toh(field);
+}
@@ -0,0 +1,70 @@
+#ifndef OTP_TRACE_H
+#define OTP_TRACE_H
+
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+
+/*
+Module Name: Request Trace
+Author: Jose Bianchi
+Description: Compact binary record of the requests a server handled, without any
+    key or message bytes, for replaying production-shaped load (otp_replay). The
+    file is a header followed by one fixed-size record per request, all fields
+    big-endian:
+        header  TRACE_MAGIC, start time (us since the epoch), record size,
+                reserved, server name (16 bytes, NUL padded)
+        record  arrival (us since trace start), key length, message length,
+                connection number, request number on the connection, key/ message/
+                result stage times (us), transport, status, flags, reserved
+    Worker processes append whole records to one O_APPEND descriptor, so records
+    of concurrent connections never interleave; they are in completion order.
+*/
+
+#define TRACE_MAGIC "OTPTRC01"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_NAME_LEN 16
+#define TRACE_HEADER_SIZE (TRACE_MAGIC_LEN + 16 + TRACE_NAME_LEN)
+#define TRACE_RECORD_SIZE 48
+
+// Transports
+#define TRACE_TCP 0                 // 5 part request over TCP
+#define TRACE_UNIX 1                // Descriptor request over the UNIX socket
+#define TRACE_SESSION 2             // Resumable session (one record per connection)
+
+// Outcomes
+#define TRACE_OK 0
+#define TRACE_FAILED 1              // Client closed early or socket error
+#define TRACE_BUSY 2                // Refused: no budget/ session busy
+#define TRACE_TOO_BIG 3             // Refused: over a size limit
+#define TRACE_TIMEOUT 4             // Cut off at a deadline
+#define TRACE_NO_SESSION 5          // Refused: unknown session
+#define TRACE_KEY_SHORT 6           // Refused: key shorter than message
+
+// Flags
+#define TRACE_RESUMED 0x01          // Session connection continuing an earlier one
+
+struct trace_record {
+    uint64_t arrival_us;            // Part 2 (or session header) received, since trace start
+    uint64_t key_len;
+    uint64_t msg_len;
+    uint32_t connection;            // Connection number, unique within the trace
+    uint32_t sequence;              // Request number on the connection (0 = first)
+    uint32_t key_us;                // Time receiving the key
+    uint32_t msg_us;                // Time receiving message size and message
+    uint32_t result_us;             // Time transforming and sending the result
+    uint8_t transport;
+    uint8_t status;
+    uint8_t flags;
+};
+
+struct trace_header {
+    uint64_t start_us;              // Wall clock time the trace started
+    char name[TRACE_NAME_LEN + 1];  // Server that wrote the trace
+};
+
+int trace_open(const char *path, const char *name);
+uint64_t trace_elapsed_us(void);
+int trace_write(int fd, const struct trace_record *record);
+int trace_read(const char *path, struct trace_header *header, struct trace_record **records, size_t *count);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>          // Input/ output
+#include <string.h>         // String functions
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+#include <unistd.h>         // Process management/ file operations
+#include "otp_unix.h"
+
+/*
+* Function: setup_unix_socket()
+*   Sets up a UNIX-domain socket address with path value.
+*   :param struct sockaddr_un* address: structure for socket address
+*   :param const char *path: filesystem path of the socket
+*   :return int: 0 on success, -1 if path does not fit in the address
+*/
+int setup_unix_socket(struct sockaddr_un* address, const char *path) {
+    // Clear out the address struct
+    memset((char*) address, '\0', sizeof(*address));
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", path);
+        return -1;
+    }
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/*
+* Function: send_fds()
+*   Sends file descriptors over a UNIX-domain socket with SCM_RIGHTS.
+*   :param int socket_fd: connected UNIX-domain socket
+*   :param char mode: request mode byte sent with the descriptors
+*   :param const int *fds: descriptors to pass
+*   :param int fd_count: number of descriptors (at most 8)
+*   :return int: 0 on success, -1 on error
+*/
+int send_fds(int socket_fd, char mode, const int *fds, int fd_count) {
+    char control[CMSG_SPACE(sizeof(int) * 8)];
+    struct iovec iov = { .iov_base = &mode, .iov_len = 1 };
+    struct msghdr header;
+
+    if (fd_count < 1 || fd_count > 8) {
+        return -1;
+    }
+    memset(&header, '\0', sizeof(header));
+    memset(control, '\0', sizeof(control));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    if (sendmsg(socket_fd, &header, MSG_NOSIGNAL) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* Function: recv_fds()
+*   Receives up to max_fds file descriptors sent with send_fds().
+*   Any descriptors received on a malformed message are closed.
+*   :param int socket_fd: connected UNIX-domain socket
+*   :param char *mode: set to request mode byte sent with the descriptors
+*   :param int *fds: array filled with received descriptors
+*   :param int max_fds: capacity of fds (at most 8)
+*   :return int: number of descriptors received, -1 on error
+*/
+int recv_fds(int socket_fd, char *mode, int *fds, int max_fds) {
+    char control[CMSG_SPACE(sizeof(int) * 8)];
+    struct iovec iov = { .iov_base = mode, .iov_len = 1 };
+    struct msghdr header;
+    int received = 0;
+
+    if (max_fds < 1 || max_fds > 8) {
+        return -1;
+    }
+    memset(&header, '\0', sizeof(header));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    if (recvmsg(socket_fd, &header, MSG_CMSG_CLOEXEC) != 1) {
+        return -1;
+    }
+    // Collect every passed descriptor so none leak on a bad message
+    int passed[8];
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count && received < 8; i++) {
+            memcpy(&passed[received++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        }
+    }
+    if (received < 1 || received > max_fds || (header.msg_flags & MSG_CTRUNC)) {
+        for (int i = 0; i < received; i++) {
+            close(passed[i]);
+        }
+        return -1;
+    }
+    memcpy(fds, passed, sizeof(int) * received);
+    return received;
+}
@@ -0,0 +1,35 @@
+#ifndef OTP_UNIX_H
+#define OTP_UNIX_H
+
+#include <sys/socket.h>     // Socket functions
+#include <sys/un.h>         // UNIX-domain socket addresses
+
+/*
+Module Name: UNIX Socket Helpers
+Author: Jose Bianchi
+Description: Shared helpers for local (same host) requests over UNIX-domain sockets.
+    Clients pass open file descriptors to the server with SCM_RIGHTS instead of
+    copying file contents through the socket. Each descriptor message carries one
+    data byte naming the request mode.
+*/
+
+// Request mode sent alongside passed descriptors
+#define UNIX_MODE_FILES 'F'         // message fd, key fd, output fd
+#define UNIX_FILE_FD_COUNT 3
+#define UNIX_MODE_RING 'R'          // shared memory ring fd (see otp_ring.h)
+#define UNIX_MAX_FDS 3
+
+// Status codes returned by the server for descriptor requests (network byte order)
+#define UNIX_STATUS_OK 0
+#define UNIX_STATUS_BAD_INPUT 1
+#define UNIX_STATUS_KEY_SHORT 2
+#define UNIX_STATUS_IO_ERROR 3
+#define UNIX_STATUS_TOO_BIG 4
+#define UNIX_STATUS_BUSY 5          // No bulk slot free in time
+#define UNIX_STATUS_TIMEOUT 6       // Output descriptor not drained in time
+
+int setup_unix_socket(struct sockaddr_un* address, const char *path);
+int send_fds(int socket_fd, char mode, const int *fds, int fd_count);
+int recv_fds(int socket_fd, char *mode, int *fds, int max_fds);
+
+#endif
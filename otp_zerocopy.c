@@ -0,0 +1,149 @@
+#include <string.h>         // String functions
+#include <errno.h>          // Error numbers
+#include <poll.h>           // Descriptor readiness functions
+#include <time.h>           // Clock functions
+#include <netinet/in.h>     // IP protocol levels
+#include <sys/socket.h>     // Socket functions
+#include <linux/errqueue.h> // Extended socket errors
+#include "otp_zerocopy.h"
+
+// Helper function declarations
+static long elapsed_ms(const struct timespec *start);
+
+/*
+* Function: zc_enable()
+*   Turns on zero-copy sends for a socket.
+*   :param struct zc_state *state: completion tracking to reset
+*   :param int socket_fd: connected TCP socket
+*   :return bool: true if the kernel supports zero-copy on the socket
+*/
+bool zc_enable(struct zc_state *state, int socket_fd) {
+    int enable = 1;
+
+    memset(state, '\0', sizeof(*state));
+    state->enabled = (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0);
+    return state->enabled;
+}
+
+/*
+* Function: zc_send()
+*   send() with MSG_ZEROCOPY. Falls back to a copying send when the kernel is out
+*   of memory for pinning pages (ENOBUFS), so the caller never has to. The buffer
+*   must stay unchanged until zc_wait() returns.
+*   :param struct zc_state *state: completion tracking of the socket
+*   :param int socket_fd: socket with zero-copy enabled
+*   :param const void *buffer: bytes to send
+*   :param size_t len: number of bytes
+*   :param int flags: other send() flags
+*   :return ssize_t: bytes sent or -1 with errno set, as send()
+*/
+ssize_t zc_send(struct zc_state *state, int socket_fd, const void *buffer, size_t len, int flags) {
+    if (!state->enabled) {
+        return send(socket_fd, buffer, len, flags);
+    }
+    ssize_t bytes = send(socket_fd, buffer, len, flags | MSG_ZEROCOPY);
+    if (bytes >= 0) {
+        // Every accepted call gets a completion, even a partial one
+        state->next++;
+        return bytes;
+    }
+    if (errno == ENOBUFS) {
+        zc_reap(state, socket_fd);
+        return send(socket_fd, buffer, len, flags);
+    }
+    return -1;
+}
+
+/*
+* Function: zc_reap()
+*   Reads pending completions from the socket error queue without blocking.
+*   Must be called while waiting on the socket too: poll() reports POLLERR as
+*   long as completions are queued.
+*   :param struct zc_state *state: completion tracking of the socket
+*   :param int socket_fd: socket with zero-copy enabled
+*   :return int: send calls newly reported complete
+*/
+int zc_reap(struct zc_state *state, int socket_fd) {
+    int completed = 0;
+
+    while (state->enabled) {
+        char control[128];
+        struct msghdr message;
+        memset(&message, '\0', sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket_fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (!((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) ||
+                  (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(header), sizeof(error));
+            if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0) {
+                continue;
+            }
+            // Range of send calls [ee_info, ee_data] is complete
+            uint32_t count = error.ee_data - error.ee_info + 1;
+            state->done += count;
+            completed += count;
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                state->copied += count;
+            }
+        }
+    }
+    return completed;
+}
+
+/*
+* Function: zc_idle()
+*   :param const struct zc_state *state: completion tracking of the socket
+*   :return bool: true if every zero-copy send has completed
+*/
+bool zc_idle(const struct zc_state *state) {
+    return state->done == state->next;
+}
+
+/*
+* Function: zc_wait()
+*   Waits until every zero-copy send has completed, so the buffers sent can
+*   be reused or freed.
+*   :param struct zc_state *state: completion tracking of the socket
+*   :param int socket_fd: socket with zero-copy enabled
+*   :param long timeout_ms: longest wait (-1 = no limit)
+*   :return bool: true once idle, false on timeout
+*/
+bool zc_wait(struct zc_state *state, int socket_fd, long timeout_ms) {
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    zc_reap(state, socket_fd);
+    while (!zc_idle(state)) {
+        long left_ms = -1;
+        if (timeout_ms >= 0) {
+            left_ms = timeout_ms - elapsed_ms(&start);
+            if (left_ms <= 0) {
+                return false;
+            }
+        }
+        // Queued completions show up as POLLERR, which is always reported
+        struct pollfd waiter = { .fd = socket_fd, .events = 0 };
+        poll(&waiter, 1, (int)left_ms);
+        zc_reap(state, socket_fd);
+    }
+    return true;
+}
+
+/*
+* Function: elapsed_ms()
+*   :param const struct timespec *start: monotonic start time
+*   :return long: milliseconds since start
+*/
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
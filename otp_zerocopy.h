@@ -0,0 +1,35 @@
+#ifndef OTP_ZEROCOPY_H
+#define OTP_ZEROCOPY_H
+
+#include <stdbool.h>        // Boolean values
+#include <stddef.h>         // Size types
+#include <stdint.h>         // Fixed width integers
+#include <sys/types.h>      // Size functions
+
+/*
+Module Name: Zero-Copy Sends
+Author: Jose Bianchi
+Description: Sends with MSG_ZEROCOPY, so the kernel transmits straight from the
+    caller's pages instead of copying them into socket buffers. The pages are only
+    read when they are transmitted, so a buffer must not be changed or freed until
+    the kernel reports every send as complete on the socket error queue; zc_wait()
+    waits for that. Each send call the kernel accepts is numbered, and completions
+    arrive as ranges of those numbers. Where zero-copy is not possible (loopback,
+    devices without scatter-gather) the kernel copies after all and flags the
+    completion, counted in copied.
+*/
+
+struct zc_state {
+    bool enabled;                   // SO_ZEROCOPY set on the socket
+    uint32_t next;                  // Number of the next zero-copy send call
+    uint32_t done;                  // Send calls reported complete
+    uint64_t copied;                // Completions where the kernel copied anyway
+};
+
+bool zc_enable(struct zc_state *state, int socket_fd);
+ssize_t zc_send(struct zc_state *state, int socket_fd, const void *buffer, size_t len, int flags);
+int zc_reap(struct zc_state *state, int socket_fd);
+bool zc_idle(const struct zc_state *state);
+bool zc_wait(struct zc_state *state, int socket_fd, long timeout_ms);
+
+#endif